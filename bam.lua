@@ -101,6 +101,9 @@ config   = get_config()
 platform = get_platform()
 settings = get_base_settings()
 set_compiler( settings, config )
+if family ~= "windows" then
+    settings.link.libs:Add( "pthread" )
+end
 TableLock( settings )
 
 local output_path = PathJoin( BUILD_PATH, PathJoin( platform, config ) )
@@ -128,6 +131,14 @@ else
         AddJob( "valgrind", "valgrind",  "valgrind -v --leak-check=full --track-origins=yes " .. tests .. test_args, tests, tests )
 end
 
-PseudoTarget( "all", tests, tester )
+if family == "windows" then
+        PseudoTarget( "all", tests, tester )
+else
+        local bench = Link( settings, 'fswatcher_bench', Compile( settings, 'bench/fswatcher_bench.cpp' ), lib )
+        bench_args = ""
+        if ScriptArgs["bench"] then bench_args = " " .. ScriptArgs["bench"] end
+        AddJob( "bench", "benchmark", bench .. bench_args, bench, bench )
+        PseudoTarget( "all", tests, tester, bench )
+end
 DefaultTarget( "all" )
 
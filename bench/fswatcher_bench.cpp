@@ -0,0 +1,677 @@
+/*
+   A small drop-in library for watching the filesystem for changes.
+
+   version 0.1, february, 2015
+
+   Copyright (C) 2015- Fredrik Kihlander
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include <fswatcher/fswatcher.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h> // system
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+static const char* bench_dir()
+{
+	static char temp_path[1024] = {0};
+	if( temp_path[0] == '\0' )
+	{
+		strcat( temp_path, P_tmpdir );
+		strcat( temp_path, "/fswatcher_bench/" );
+	}
+	return temp_path;
+}
+
+static double bench_time_ns()
+{
+	timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (double)ts.tv_sec * 1000000000.0 + (double)ts.tv_nsec;
+}
+
+static void bench_reset_dir()
+{
+	char cmd[4096];
+	snprintf( cmd, sizeof( cmd ), "rm -rf %s", bench_dir() );
+	if( system( cmd ) < 0 )
+		printf( "failed to run system( %s )\n", cmd );
+	mkdir( bench_dir(), 0755 );
+}
+
+static void bench_touch( const char* path )
+{
+	int fd = open( path, O_CREAT | O_WRONLY, 0644 );
+	if( fd >= 0 )
+		close( fd );
+}
+
+struct bench_counting_handler
+{
+	fswatcher_event_handler handler;
+	size_t events;
+};
+
+static bool bench_count_event( fswatcher_event_handler* handler, fswatcher_event_type, const char*, const char* )
+{
+	++( (bench_counting_handler*)handler )->events;
+	return true;
+}
+
+/**
+ * Allocator tracking the amount of memory held by a watcher, each allocation is prefixed with its size as
+ * fswatcher_allocator::free() do not pass it.
+ */
+struct bench_tracking_allocator
+{
+	fswatcher_allocator alloc;
+	size_t current;
+	size_t peak;
+};
+
+static void* bench_tracking_realloc( fswatcher_allocator* allocator, void* ptr, size_t, size_t new_size )
+{
+	bench_tracking_allocator* a = (bench_tracking_allocator*)allocator;
+	size_t* block = ptr ? (size_t*)ptr - 2 : 0x0;
+	if( block )
+		a->current -= block[0];
+	block = (size_t*)realloc( block, new_size + 2 * sizeof( size_t ) );
+	if( block == 0x0 )
+		return 0x0;
+	block[0] = new_size;
+	a->current += new_size;
+	if( a->current > a->peak )
+		a->peak = a->current;
+	return block + 2;
+}
+
+static void bench_tracking_free( fswatcher_allocator* allocator, void* ptr )
+{
+	if( ptr == 0x0 )
+		return;
+	bench_tracking_allocator* a = (bench_tracking_allocator*)allocator;
+	size_t* block = (size_t*)ptr - 2;
+	a->current -= block[0];
+	free( block );
+}
+
+static size_t bench_make_tree( char* path, size_t path_len, size_t depth, size_t width )
+{
+	if( depth == 0 )
+		return 0;
+
+	size_t created = 0;
+	for( size_t i = 0; i < width; ++i )
+	{
+		int len = snprintf( path + path_len, 4096 - path_len, "a_fairly_long_directory_name_%zu/", i );
+		mkdir( path, 0755 );
+		created += 1 + bench_make_tree( path, path_len + (size_t)len, depth - 1, width );
+	}
+	path[path_len] = '\0';
+	return created;
+}
+
+/**
+ * Measure memory held by a watcher after the initial crawl of a deep tree.
+ */
+static void bench_memory_vs_tree_size()
+{
+	static const size_t DEPTHS[] = { 2, 3, 4 };
+	static const size_t WIDTH = 10;
+
+	printf( "watcher memory vs tree size\n" );
+	printf( "%10s %10s %12s %12s\n", "depth", "dirs", "bytes", "bytes/dir" );
+
+	for( size_t d = 0; d < sizeof( DEPTHS ) / sizeof( DEPTHS[0] ); ++d )
+	{
+		bench_reset_dir();
+
+		char path[4096];
+		strcpy( path, bench_dir() );
+		size_t dirs = bench_make_tree( path, strlen( path ), DEPTHS[d], WIDTH ) + 1;
+
+		bench_tracking_allocator alloc = { { bench_tracking_realloc, bench_tracking_free }, 0, 0 };
+		fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, bench_dir(), &alloc.alloc );
+		if( watcher == 0x0 )
+		{
+			printf( "failed to create watcher\n" );
+			return;
+		}
+		printf( "%10zu %10zu %12zu %12.1f\n", DEPTHS[d], dirs, alloc.current, (double)alloc.current / (double)dirs );
+		fswatcher_destroy( watcher );
+	}
+}
+
+/**
+ * Measure time spent in fswatcher_poll() per event with a growing amount of watched directories.
+ * Events are spread over all watched directories so that every wd in the watch-table is looked up.
+ */
+static void bench_event_cost_vs_watch_count()
+{
+	static const size_t WATCH_COUNTS[] = { 256, 1024, 4096, 16384 };
+	static const size_t EVENT_COUNT = 16384;
+	static const size_t EVENT_CHUNK = 4096; // stay well below fs.inotify.max_queued_events
+
+	printf( "event cost vs watch count\n" );
+	printf( "%10s %10s %12s\n", "watches", "events", "ns/event" );
+
+	for( size_t c = 0; c < sizeof( WATCH_COUNTS ) / sizeof( WATCH_COUNTS[0] ); ++c )
+	{
+		size_t watch_count = WATCH_COUNTS[c];
+		bench_reset_dir();
+
+		char path[4096];
+		for( size_t i = 0; i < watch_count; ++i )
+		{
+			snprintf( path, sizeof( path ), "%sd%zu", bench_dir(), i );
+			mkdir( path, 0755 );
+		}
+
+		fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, bench_dir(), 0x0 );
+		if( watcher == 0x0 )
+		{
+			printf( "failed to create watcher\n" );
+			return;
+		}
+
+		bench_counting_handler handler = { { bench_count_event }, 0 };
+		double poll_time = 0.0;
+		for( size_t e = 0; e < EVENT_COUNT; e += EVENT_CHUNK )
+		{
+			for( size_t i = e; i < e + EVENT_CHUNK; ++i )
+			{
+				snprintf( path, sizeof( path ), "%sd%zu/f%zu", bench_dir(), ( i * 7919 ) % watch_count, i );
+				bench_touch( path );
+			}
+
+			double start = bench_time_ns();
+			fswatcher_poll( watcher, &handler.handler, 0x0 );
+			poll_time += bench_time_ns() - start;
+		}
+
+		printf( "%10zu %10zu %12.1f\n", watch_count, handler.events, handler.events ? poll_time / (double)handler.events : 0.0 );
+		fswatcher_destroy( watcher );
+	}
+}
+
+/**
+ * Measure time spent in fswatcher_create_ex() crawling a generated tree with different amount of crawl-threads.
+ */
+static void bench_crawl_threads()
+{
+	static const unsigned int THREAD_COUNTS[] = { 1, 2, 4, 8 };
+	static const int RUNS = 3;
+
+	bench_reset_dir();
+	char path[4096];
+	strcpy( path, bench_dir() );
+	size_t dirs = bench_make_tree( path, strlen( path ), 4, 10 ) + 1;
+
+	printf( "startup crawl of %zu dirs vs crawl threads\n", dirs );
+	printf( "%10s %12s\n", "threads", "ms" );
+
+	for( size_t t = 0; t < sizeof( THREAD_COUNTS ) / sizeof( THREAD_COUNTS[0] ); ++t )
+	{
+		double best = 0.0;
+		for( int r = 0; r < RUNS; ++r )
+		{
+			fswatcher_create_params params;
+			memset( &params, 0x0, sizeof( params ) );
+			params.flags         = FSWATCHER_CREATE_DEFAULT;
+			params.types         = FSWATCHER_EVENT_ALL;
+			params.watch_dir     = bench_dir();
+			params.crawl_threads = THREAD_COUNTS[t];
+
+			double start = bench_time_ns();
+			fswatcher_t watcher = fswatcher_create_ex( &params );
+			double time = bench_time_ns() - start;
+			if( watcher == 0x0 )
+			{
+				printf( "failed to create watcher\n" );
+				return;
+			}
+			fswatcher_destroy( watcher );
+
+			if( r == 0 || time < best )
+				best = time;
+		}
+		printf( "%10u %12.2f\n", THREAD_COUNTS[t], best / 1000000.0 );
+	}
+}
+
+struct bench_writer
+{
+	size_t files;
+	volatile bool done;
+};
+
+static void* bench_writer_main( void* arg )
+{
+	bench_writer* writer = (bench_writer*)arg;
+	char path[4096];
+	for( size_t i = 0; i < writer->files; ++i )
+	{
+		snprintf( path, sizeof( path ), "%sf%zu", bench_dir(), i );
+		bench_touch( path );
+	}
+	__atomic_store_n( &writer->done, true, __ATOMIC_RELEASE );
+	return 0x0;
+}
+
+/**
+ * Handler simulating a consumer doing real work per event. The first event stalls until the writer is done,
+ * i.e. hashing a large file, so that the whole burst arrives while the consumer is busy.
+ */
+struct bench_slow_handler
+{
+	fswatcher_event_handler handler;
+	bench_writer* writer;
+	double work_ns;
+	size_t events;
+	size_t overflows;
+};
+
+static bool bench_slow_event( fswatcher_event_handler* handler, fswatcher_event_type type, const char*, const char* )
+{
+	bench_slow_handler* h = (bench_slow_handler*)handler;
+	if( type == FSWATCHER_EVENT_BUFFER_OVERFLOW )
+		++h->overflows;
+	else
+		++h->events;
+
+	while( h->events == 1 && !__atomic_load_n( &h->writer->done, __ATOMIC_ACQUIRE ) )
+		usleep( 1000 );
+
+	double end = bench_time_ns() + h->work_ns;
+	while( bench_time_ns() < end ) {}
+	return true;
+}
+
+/**
+ * Measure lost events when a slow consumer polls while another thread creates files faster than they are consumed,
+ * with and without FSWATCHER_CREATE_READER_THREAD.
+ */
+static void bench_overflow_reader_thread()
+{
+	static const size_t FILE_COUNT = 65536; // 4x the default fs.inotify.max_queued_events
+	static const double WORK_NS    = 20000.0;
+
+	printf( "overflow with slow consumer, %zu creates, %.0f us work per event\n", FILE_COUNT, WORK_NS / 1000.0 );
+	printf( "%14s %10s %10s %10s %10s\n", "mode", "events", "lost", "overflows", "ms" );
+
+	for( int mode = 0; mode < 2; ++mode )
+	{
+		bench_reset_dir();
+
+		fswatcher_create_params params;
+		memset( &params, 0x0, sizeof( params ) );
+		params.flags     = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | ( mode ? FSWATCHER_CREATE_READER_THREAD : 0 ) );
+		params.types     = FSWATCHER_EVENT_CREATE;
+		params.watch_dir = bench_dir();
+		fswatcher_t watcher = fswatcher_create_ex( &params );
+		if( watcher == 0x0 )
+		{
+			printf( "failed to create watcher\n" );
+			return;
+		}
+
+		double start = bench_time_ns();
+		bench_writer writer = { FILE_COUNT, false };
+		pthread_t thread;
+		pthread_create( &thread, 0x0, bench_writer_main, &writer );
+
+		bench_slow_handler handler = { { bench_slow_event }, &writer, WORK_NS, 0, 0 };
+		size_t idle_polls = 0;
+		while( idle_polls < 5 )
+		{
+			size_t before = handler.events + handler.overflows;
+			fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 20 );
+			bool idle = handler.events + handler.overflows == before;
+			idle_polls = idle && __atomic_load_n( &writer.done, __ATOMIC_ACQUIRE ) ? idle_polls + 1 : 0;
+		}
+		pthread_join( thread, 0x0 );
+		double time = bench_time_ns() - start;
+
+		printf( "%14s %10zu %10zu %10zu %10.0f\n", mode ? "reader-thread" : "default", handler.events, FILE_COUNT - handler.events, handler.overflows, time / 1000000.0 );
+		fswatcher_destroy( watcher );
+	}
+}
+
+/**
+ * Number of read-syscalls done by the process so far, syscr in /proc/self/io.
+ */
+static size_t bench_read_syscalls()
+{
+	FILE* f = fopen( "/proc/self/io", "r" );
+	if( f == 0x0 )
+		return 0;
+	char line[256];
+	size_t syscr = 0;
+	while( fgets( line, sizeof( line ), f ) )
+		if( sscanf( line, "syscr: %zu", &syscr ) == 1 )
+			break;
+	fclose( f );
+	return syscr;
+}
+
+/**
+ * Measure read-syscalls needed to drain a storm of events with different read buffer configurations.
+ */
+static void bench_read_buffer_syscalls()
+{
+	static const int FILE_COUNT = 10000; // ... stay below the default max_queued_events of 16384 ...
+	struct
+	{
+		const char* name;
+		unsigned int flags;
+		size_t size;
+	} configs[] = {
+		{ "4KB",      0, 0 },
+		{ "64KB",     0, 64 * 1024 },
+		{ "fionread", FSWATCHER_CREATE_FIONREAD_BUFFER, 0 },
+	};
+
+	printf( "read-syscalls to drain %d create events\n", FILE_COUNT );
+	printf( "%10s %12s %16s\n", "buffer", "events", "syscalls/1000ev" );
+
+	char path[4096];
+	for( size_t c = 0; c < sizeof( configs ) / sizeof( configs[0] ); ++c )
+	{
+		bench_reset_dir();
+
+		fswatcher_create_params params;
+		memset( &params, 0x0, sizeof( params ) );
+		params.flags            = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | configs[c].flags );
+		params.types            = FSWATCHER_EVENT_ALL;
+		params.watch_dir        = bench_dir();
+		params.read_buffer_size = configs[c].size;
+		fswatcher_t watcher = fswatcher_create_ex( &params );
+		if( watcher == 0x0 )
+		{
+			printf( "failed to create watcher\n" );
+			return;
+		}
+
+		for( int i = 0; i < FILE_COUNT; ++i )
+		{
+			snprintf( path, sizeof( path ), "%sfile_%d", bench_dir(), i );
+			bench_touch( path );
+		}
+
+		bench_counting_handler handler = { { bench_count_event }, 0 };
+		size_t syscalls = bench_read_syscalls();
+		fswatcher_poll( watcher, &handler.handler, 0x0 );
+		// ... the read of /proc/self/io itself is counted as well ...
+		syscalls = bench_read_syscalls() - syscalls;
+
+		printf( "%10s %12zu %16.2f\n", configs[c].name, handler.events, handler.events ? (double)syscalls * 1000.0 / (double)handler.events : 0.0 );
+		fswatcher_destroy( watcher );
+	}
+}
+
+/**
+ * Collect the paths of the target items of a workload, either files spread over a deep tree or files in one wide
+ * directory.
+ */
+struct bench_workload
+{
+	const char* name;
+	size_t depth;      ///< depth of generated tree, 0 for a single wide directory.
+	size_t width;      ///< sub-directories per directory.
+	size_t files;      ///< files in the storm, spread round-robin over all directories.
+};
+
+static size_t bench_list_dirs( char* path, size_t path_len, size_t depth, size_t width, char (*dirs)[256], size_t dirs_cap, size_t dirs_cnt )
+{
+	if( dirs_cnt < dirs_cap )
+		snprintf( dirs[dirs_cnt++], sizeof( dirs[0] ), "%s", path );
+	if( depth == 0 )
+		return dirs_cnt;
+	for( size_t i = 0; i < width; ++i )
+	{
+		int len = snprintf( path + path_len, 4096 - path_len, "a_fairly_long_directory_name_%zu/", i );
+		dirs_cnt = bench_list_dirs( path, path_len + (size_t)len, depth - 1, width, dirs, dirs_cap, dirs_cnt );
+	}
+	path[path_len] = '\0';
+	return dirs_cnt;
+}
+
+static double bench_drain( fswatcher_t watcher, size_t expected, size_t* events )
+{
+	bench_counting_handler handler = { { bench_count_event }, 0 };
+	double start = bench_time_ns();
+	for( int i = 0; i < 100 && handler.events < expected; ++i )
+		fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 100 );
+	*events = handler.events;
+	return bench_time_ns() - start;
+}
+
+/**
+ * Run create, modify and move storms over generated trees and report crawl time, peak watcher memory and event
+ * throughput for each. Throughput is measured over the polls only, the storm is generated before polling.
+ */
+static void bench_workloads()
+{
+	static const bench_workload WORKLOADS[] = {
+		{ "wide",   0, 0, 8000 },
+		{ "deep",   5, 4, 8000 },
+		{ "bushy",  3, 20, 8000 },
+	};
+	static const size_t MAX_DIRS = 16384;
+	char (*dirs)[256] = (char(*)[256])malloc( sizeof( *dirs ) * MAX_DIRS );
+
+	printf( "workloads, events/s measured over the polls draining each storm\n" );
+	printf( "%8s %8s %10s %12s %14s %14s %14s\n", "workload", "dirs", "crawl ms", "peak bytes", "create ev/s", "modify ev/s", "move ev/s" );
+
+	char path[4096];
+	char dst[4096];
+	for( size_t w = 0; w < sizeof( WORKLOADS ) / sizeof( WORKLOADS[0] ); ++w )
+	{
+		const bench_workload* wl = &WORKLOADS[w];
+		bench_reset_dir();
+		strcpy( path, bench_dir() );
+		bench_make_tree( path, strlen( path ), wl->depth, wl->width );
+		size_t dirs_cnt = bench_list_dirs( path, strlen( path ), wl->depth, wl->width, dirs, MAX_DIRS, 0 );
+
+		bench_tracking_allocator alloc = { { bench_tracking_realloc, bench_tracking_free }, 0, 0 };
+		double start = bench_time_ns();
+		fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, bench_dir(), &alloc.alloc );
+		double crawl = bench_time_ns() - start;
+		if( watcher == 0x0 )
+		{
+			printf( "failed to create watcher\n" );
+			break;
+		}
+
+		double rate[3];
+		for( int storm = 0; storm < 3; ++storm )
+		{
+			for( size_t i = 0; i < wl->files; ++i )
+			{
+				snprintf( path, sizeof( path ), "%sfile_%zu", dirs[i % dirs_cnt], i );
+				switch( storm )
+				{
+					case 0: bench_touch( path ); break;
+					case 1:
+					{
+						int fd = open( path, O_WRONLY | O_APPEND );
+						if( fd >= 0 )
+						{
+							if( write( fd, "a", 1 ) < 0 ) {}
+							close( fd );
+						}
+						break;
+					}
+					case 2:
+						snprintf( dst, sizeof( dst ), "%smoved_%zu", dirs[i % dirs_cnt], i );
+						rename( path, dst );
+						break;
+				}
+			}
+			size_t events;
+			double time = bench_drain( watcher, wl->files, &events );
+			rate[storm] = time > 0.0 ? (double)events * 1000000000.0 / time : 0.0;
+		}
+
+		printf( "%8s %8zu %10.2f %12zu %14.0f %14.0f %14.0f\n", wl->name, dirs_cnt, crawl / 1000000.0, alloc.peak, rate[0], rate[1], rate[2] );
+		fswatcher_destroy( watcher );
+	}
+	free( dirs );
+}
+
+/**
+ * Writer creating files at a steady rate, recording when each file was created.
+ */
+struct bench_latency_writer
+{
+	size_t files;
+	double interval_ns;
+	double* written;
+};
+
+static void* bench_latency_writer_main( void* arg )
+{
+	bench_latency_writer* writer = (bench_latency_writer*)arg;
+	char path[4096];
+	for( size_t i = 0; i < writer->files; ++i )
+	{
+		snprintf( path, sizeof( path ), "%sl_%zu", bench_dir(), i );
+		double now = bench_time_ns();
+		__atomic_store( &writer->written[i], &now, __ATOMIC_RELEASE );
+		bench_touch( path );
+		while( bench_time_ns() < now + writer->interval_ns )
+			usleep( 50 );
+	}
+	return 0x0;
+}
+
+struct bench_latency_handler
+{
+	fswatcher_event_handler handler;
+	bench_latency_writer* writer;
+	double* latency;
+	size_t events;
+};
+
+static bool bench_latency_event( fswatcher_event_handler* handler, fswatcher_event_type type, const char* src, const char* )
+{
+	bench_latency_handler* h = (bench_latency_handler*)handler;
+	const char* name = src ? strrchr( src, '/' ) : 0x0;
+	size_t index;
+	if( type != FSWATCHER_EVENT_CREATE || name == 0x0 || sscanf( name, "/l_%zu", &index ) != 1 || index >= h->writer->files )
+		return true;
+	double written;
+	__atomic_load( &h->writer->written[index], &written, __ATOMIC_ACQUIRE );
+	h->latency[h->events++] = bench_time_ns() - written;
+	return true;
+}
+
+static int bench_compare_double( const void* a, const void* b )
+{
+	double da = *(const double*)a;
+	double db = *(const double*)b;
+	return da < db ? -1 : ( da > db ? 1 : 0 );
+}
+
+/**
+ * Measure time from a file being created to its event reaching the handler with a consumer waiting in a blocking
+ * poll, with and without FSWATCHER_CREATE_READER_THREAD.
+ */
+static void bench_latency()
+{
+	static const size_t FILE_COUNT     = 2000;
+	static const double INTERVAL_NS    = 250000.0;
+
+	printf( "write to callback latency, %zu creates every %.0f us\n", FILE_COUNT, INTERVAL_NS / 1000.0 );
+	printf( "%14s %10s %10s %10s %10s %10s\n", "mode", "events", "p50 us", "p90 us", "p99 us", "max us" );
+
+	double* written = (double*)malloc( sizeof( double ) * FILE_COUNT );
+	double* latency = (double*)malloc( sizeof( double ) * FILE_COUNT );
+	for( int mode = 0; mode < 2; ++mode )
+	{
+		bench_reset_dir();
+
+		fswatcher_create_params params;
+		memset( &params, 0x0, sizeof( params ) );
+		params.flags     = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_BLOCKING | ( mode ? FSWATCHER_CREATE_READER_THREAD : 0 ) );
+		params.types     = FSWATCHER_EVENT_ALL;
+		params.watch_dir = bench_dir();
+		fswatcher_t watcher = fswatcher_create_ex( &params );
+		if( watcher == 0x0 )
+		{
+			printf( "failed to create watcher\n" );
+			break;
+		}
+
+		bench_latency_writer writer = { FILE_COUNT, INTERVAL_NS, written };
+		bench_latency_handler handler = { { bench_latency_event }, &writer, latency, 0 };
+		pthread_t thread;
+		pthread_create( &thread, 0x0, bench_latency_writer_main, &writer );
+		double deadline = bench_time_ns() + (double)FILE_COUNT * INTERVAL_NS + 5000000000.0;
+		while( handler.events < FILE_COUNT && bench_time_ns() < deadline )
+			fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 100 );
+		pthread_join( thread, 0x0 );
+		fswatcher_destroy( watcher );
+
+		qsort( latency, handler.events, sizeof( double ), bench_compare_double );
+		size_t n = handler.events;
+		if( n == 0 )
+			continue;
+		printf( "%14s %10zu %10.1f %10.1f %10.1f %10.1f\n", mode ? "reader-thread" : "default", n,
+		        latency[n * 50 / 100] / 1000.0, latency[n * 90 / 100] / 1000.0, latency[n * 99 / 100] / 1000.0, latency[n - 1] / 1000.0 );
+	}
+	free( written );
+	free( latency );
+}
+
+/**
+ * Run bench if no names was passed on the command line or if name is one of them.
+ */
+static void bench_run( int argc, char** argv, const char* name, void (*bench)() )
+{
+	bool run = argc <= 1;
+	for( int i = 1; i < argc && !run; ++i )
+		run = strcmp( argv[i], name ) == 0;
+	if( !run )
+		return;
+	bench();
+	printf( "\n" );
+}
+
+int main( int argc, char** argv )
+{
+	bench_run( argc, argv, "event_cost",  bench_event_cost_vs_watch_count );
+	bench_run( argc, argv, "memory",      bench_memory_vs_tree_size );
+	bench_run( argc, argv, "crawl",       bench_crawl_threads );
+	bench_run( argc, argv, "overflow",    bench_overflow_reader_thread );
+	bench_run( argc, argv, "read_buffer", bench_read_buffer_syscalls );
+	bench_run( argc, argv, "workloads",   bench_workloads );
+	bench_run( argc, argv, "latency",     bench_latency );
+
+	bench_reset_dir();
+	rmdir( bench_dir() );
+	return 0;
+}
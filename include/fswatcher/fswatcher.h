@@ -28,6 +28,7 @@
 #define FSWATCHER_H_INCLUDED
 
 #include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,6 +45,12 @@ enum fswatcher_create_flags
 {
 	FSWATCHER_CREATE_BLOCKING  = (1 << 1), ///< calls to fswatcher_poll should block until 1 or more events arrive.
 	FSWATCHER_CREATE_RECURSIVE = (1 << 2), ///< the directory watch should recursively add all sub-directories to watch.
+	FSWATCHER_CREATE_COALESCE  = (1 << 3), ///< merge events for the same path and only deliver them when the path has been quiet for fswatcher_create_params::coalesce_ms. Not implemented on windows, creating a watcher with it fails there.
+	FSWATCHER_CREATE_READER_THREAD = (1 << 4), ///< read events from the os on a separate thread into a ring of fswatcher_create_params::reader_ring_size bytes, see fswatcher_create_params::reader_ring_size.
+	FSWATCHER_CREATE_SNAPSHOT  = (1 << 5), ///< keep a snapshot of all watched directories and recover from an os-queue overflow by rescanning them instead of reporting FSWATCHER_EVENT_BUFFER_OVERFLOW. Events close to an overflow might be reported twice. Only implemented for the inotify backend.
+	FSWATCHER_CREATE_FIONREAD_BUFFER = (1 << 6), ///< before each read from the os, grow the read buffer to fit all queued events so that a storm is drained with one syscall, see fswatcher_create_params::read_buffer_size. Only implemented on linux.
+	FSWATCHER_CREATE_CONTENT_HASH = (1 << 7), ///< keep a hash of the content of modified files and drop FSWATCHER_EVENT_MODIFY if the content is the same as when last seen, a file is only read if its size is the same as last seen but its mtime is not, a file that changed size or was replaced is reported without being read. The first modify of a file is always reported. Only implemented on linux.
+	FSWATCHER_CREATE_ASYNC_CRAWL = (1 << 8), ///< return from fswatcher_create() once the watched dir itself is watched and crawl the directories below it on a separate thread, see fswatcher_crawl_progress(). Only implemented on linux.
 	FSWATCHER_CREATE_DEFAULT   = FSWATCHER_CREATE_RECURSIVE
 };
 
@@ -55,7 +62,8 @@ enum fswatcher_event_type
 	FSWATCHER_EVENT_CREATE = (1 << 1), ///< file in "src" was just created.
 	FSWATCHER_EVENT_REMOVE = (1 << 2), ///< file in "src" was just removed.
 	FSWATCHER_EVENT_MODIFY = (1 << 3), ///< file in "src" was just modified.
-	FSWATCHER_EVENT_MOVE   = (1 << 4), ///< file was moved from "src" to "dst", if "src" or "dst" is 0x0 it indicates that the path was outside the current watch.
+	FSWATCHER_EVENT_MOVE   = (1 << 4), ///< file or directory was moved from "src" to "dst", if "src" or "dst" is 0x0 it indicates that the path was outside the current watch. a moved directory is one event, not one per item below it.
+	FSWATCHER_EVENT_WRITE_DONE = (1 << 5), ///< file in "src" was closed after being opened for writing, see fswatcher_create_params::write_settle_ms. not part of FSWATCHER_EVENT_ALL, only implemented on linux.
 
 	FSWATCHER_EVENT_ALL = FSWATCHER_EVENT_CREATE |
 						  FSWATCHER_EVENT_REMOVE |
@@ -65,6 +73,20 @@ enum fswatcher_event_type
 	FSWATCHER_EVENT_BUFFER_OVERFLOW ///< doc me
 };
 
+/**
+ * Backend used by a watcher to get events from the os, selected with fswatcher_create_params::backend.
+ */
+enum fswatcher_backend
+{
+	FSWATCHER_BACKEND_DEFAULT = 0, ///< default backend for the platform.
+	FSWATCHER_BACKEND_INOTIFY,     ///< linux only, inotify with one watch per directory.
+	FSWATCHER_BACKEND_FANOTIFY,    ///< linux only, fanotify watching the whole filesystem containing the watched dir with one mark,
+	                               ///< events outside of the watched dir are filtered out. Requires CAP_SYS_ADMIN and linux 5.9.
+	FSWATCHER_BACKEND_POLL         ///< linux only, rescan the watched dirs every fswatcher_create_params::poll_interval_ms and diff
+	                               ///< against a snapshot, for filesystems where the os does not report changes, i.e. network
+	                               ///< and FUSE mounts. See fswatcher_create_params::poll_interval_ms.
+};
+
 /**
  *
  */
@@ -156,11 +178,48 @@ struct fswatcher_event_handler
 	 * @param src path to source file, can be 0x0 if event has no source. ( this can happen for example on a move if file was moved from non-watched folder to watched folder. )
 	 * @param dst path to destination file, can be 0x0 if event has no destination. ( this can happen for example on a move if file was moved from watched folder to non-watched folder. )
 	 *
-	 * @return false if poll should end.
+	 * @return false if poll should end, events not yet delivered are kept until next poll.
 	 */
 	bool ( *callback )( fswatcher_event_handler* handler, fswatcher_event_type evtype, const char* src, const char* dst );
 };
 
+/**
+ * Struct used together with fswatcher_poll_roots() to fetch events from fswatcher together with the root they belong
+ * to, see fswatcher_event_handler.
+ */
+struct fswatcher_root_event_handler
+{
+	/**
+	 * Callback used per event that is queued on the fswatcher.
+	 *
+	 * @param root id of root returned by fswatcher_add_root(), 0 for the dir passed to fswatcher_create().
+	 *
+	 * @see fswatcher_event_handler::callback for the other parameters and return value.
+	 */
+	bool ( *callback )( fswatcher_root_event_handler* handler, uint32_t root, fswatcher_event_type evtype, const char* src, const char* dst );
+};
+
+/**
+ * Value returned by fswatcher_add_root() on failure.
+ */
+#define FSWATCHER_NO_ROOT 0xFFFFFFFFu
+
+/**
+ * Value of fswatcher_event::src/dst if the event has no such path.
+ */
+#define FSWATCHER_NO_PATH 0xFFFFFFFFu
+
+/**
+ * Event record filled by fswatcher_poll_batch().
+ */
+struct fswatcher_event
+{
+	fswatcher_event_type type; ///< type of event.
+	uint32_t root;             ///< id of root the event belongs to, see fswatcher_add_root().
+	uint32_t src;              ///< offset of zero-terminated src path in path_arena passed to fswatcher_poll_batch() or FSWATCHER_NO_PATH.
+	uint32_t dst;              ///< offset of zero-terminated dst path in path_arena passed to fswatcher_poll_batch() or FSWATCHER_NO_PATH.
+};
+
 /**
  * Create a new fswatcher watching a specific directory and potential sub-directories.
  *
@@ -173,6 +232,144 @@ struct fswatcher_event_handler
  */
 fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type types, const char* watch_dir, fswatcher_allocator* allocator );
 
+/**
+ * Parameters to fswatcher_create_ex(), zero-initialize and fill in the members that is needed.
+ */
+struct fswatcher_create_params
+{
+	fswatcher_create_flags flags;     ///< see fswatcher_create().
+	fswatcher_event_type   types;     ///< see fswatcher_create().
+	const char*            watch_dir; ///< see fswatcher_create().
+	fswatcher_allocator*   allocator; ///< see fswatcher_create().
+
+	/**
+	 * Quiet period in ms used with FSWATCHER_CREATE_COALESCE, 0 selects the default of 100ms.
+	 *
+	 * Events for a path are held back until no new event has arrived for the path during this period and are
+	 * merged while held, modify + modify -> modify, create + modify -> create, modify + remove -> remove and
+	 * create + remove drops both. Moves and buffer overflows are never merged and release all held events for the
+	 * same paths before them so that the order per path is kept, the order between different paths is not kept.
+	 *
+	 * @note The quiet period is measured from when events are read from the os, i.e. during fswatcher_poll(), and
+	 *       fswatcher_poll() need to be called again after the quiet period has passed for held events to be delivered.
+	 *       A blocking poll will wait for that by itself.
+	 *
+	 * @note Only implemented on linux.
+	 */
+	unsigned int coalesce_ms;
+
+	/**
+	 * Number of threads used to crawl the directory-tree when adding watches in fswatcher_create_ex(), the calling
+	 * thread is counted as one of them. 0 or 1 crawls on the calling thread only.
+	 *
+	 * @note The allocator is only called by one thread at a time but might be called from the crawl-threads.
+	 * @note Only implemented on linux.
+	 */
+	unsigned int crawl_threads;
+
+	/**
+	 * Backend to use, if the backend is not available on the system fswatcher_create_ex() returns 0x0.
+	 */
+	fswatcher_backend backend;
+
+	/**
+	 * Size in bytes of the ring used with FSWATCHER_CREATE_READER_THREAD, 0 selects the default of 4MB. Rounded up
+	 * to a power of 2.
+	 *
+	 * The reader thread drains the os event queue into the ring as soon as events arrive so that a slow consumer does
+	 * not cause the os queue to overflow, fs.inotify.max_queued_events on linux. When the ring is full the reader stops
+	 * reading until a poll has made room. Events are still parsed and delivered on the thread calling poll.
+	 *
+	 * @note Only implemented on linux.
+	 */
+	size_t reader_ring_size;
+
+	/**
+	 * Path to a snapshot-file, 0x0 for none. Implies FSWATCHER_CREATE_SNAPSHOT.
+	 *
+	 * fswatcher_destroy() saves the state of the tree watched by fswatcher_create_params::watch_dir to this file. The
+	 * next fswatcher_create_ex() with the same file diffs the tree against it and the changes made while no watcher
+	 * was running are delivered as normal events by the first poll. A missing or invalid file reports nothing.
+	 *
+	 * @note Events not polled before fswatcher_destroy() are reported again by the next watcher.
+	 * @note Roots added with fswatcher_add_root() are not saved.
+	 * @note Only implemented for the inotify backend.
+	 */
+	const char* snapshot_file;
+
+	/**
+	 * Patterns matched against the name-component of every item below the watched dirs, '*' matches any sequence
+	 * of characters and '?' matches one character, i.e. ".git", "build*" or "*.o". Patterns are compiled once at
+	 * create.
+	 *
+	 * Items matching any exclude-pattern are skipped, excluded directories are never watched and no events are
+	 * reported for them or anything below them.
+	 *
+	 * If include_cnt > 0 only events for files matching any include-pattern are reported, directories are not
+	 * affected by include-patterns.
+	 *
+	 * @note Only implemented on linux.
+	 */
+	const char* const* exclude;
+	unsigned int exclude_cnt;
+	const char* const* include;
+	unsigned int include_cnt;
+
+	/**
+	 * Size in bytes of the buffer events are read into from the os, 0 or anything smaller than 4KB selects 4KB. A
+	 * bigger buffer means fewer syscalls when many events are queued. With FSWATCHER_CREATE_FIONREAD_BUFFER this is
+	 * the initial size and the buffer grows, up to 16MB, to fit what is queued. The buffer is never shrunk.
+	 *
+	 * @note Only implemented on linux.
+	 */
+	size_t read_buffer_size;
+
+	/**
+	 * Time in ms a file has to keep the same size after being closed for writing before FSWATCHER_EVENT_WRITE_DONE is
+	 * reported, 0 reports FSWATCHER_EVENT_WRITE_DONE on every close.
+	 *
+	 * Closing the file again during the period restarts it, a file that changed size when the period is over is
+	 * checked again after another period. Only one FSWATCHER_EVENT_WRITE_DONE is reported per settled file no matter
+	 * how many times it was written and closed. Files removed or moved before they settle are not reported.
+	 *
+	 * @note Like for FSWATCHER_CREATE_COALESCE fswatcher_poll() need to be called again after the period has passed,
+	 *       a blocking poll will wait for that by itself.
+	 * @note Only implemented on linux.
+	 */
+	unsigned int write_settle_ms;
+
+	/**
+	 * Time in ms between scans with FSWATCHER_BACKEND_POLL, 0 selects the default of 1000ms.
+	 *
+	 * Each scan stats every watched item, with io_uring in batches if available. Directories whose mtime has not
+	 * changed since they were last listed are not listed again. Items are matched by inode so that a move within the
+	 * watched dirs is reported as FSWATCHER_EVENT_MOVE. fswatcher_get_fd() becomes readable when a scan is due.
+	 *
+	 * @note Changes that are undone between two scans are not reported, events are delivered at scan-time and
+	 *       FSWATCHER_EVENT_WRITE_DONE is never reported.
+	 * @note Symlinked directories are not followed.
+	 */
+	unsigned int poll_interval_ms;
+
+	/**
+	 * Number of directory-levels watched below each root, counting the root itself as the first level. 0 watches all
+	 * levels, 1 only the root.
+	 *
+	 * Directories created or moved in below the limit are reported but not watched. Deeper levels of a subtree can be
+	 * watched later with fswatcher_watch_subtree().
+	 *
+	 * @note Only implemented on linux.
+	 */
+	unsigned int max_depth;
+};
+
+/**
+ * Create a new fswatcher with extended parameters, see fswatcher_create_params.
+ *
+ * @param params parameters to create watcher with.
+ */
+fswatcher_t fswatcher_create_ex( const fswatcher_create_params* params );
+
 /**
  * Destroy fswatcher_t and free all its used resources.
  *
@@ -180,6 +377,95 @@ fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type
  */
 void fswatcher_destroy( fswatcher_t watcher );
 
+/**
+ * Add another directory to watch to an existing watcher, sharing os-resources with the directories already watched.
+ * Events are tagged with the returned id, see fswatcher_poll_roots() and fswatcher_event::root.
+ *
+ * A move between two roots is reported as a move out of the src root and a move into the dst root. Directories that are
+ * already watched by another root, i.e. nested roots, stay with the root that watched them first on linux/inotify.
+ * An overflow is reported once with root 0.
+ *
+ * @note The dir passed to fswatcher_create() always has id 0, ids of removed roots are reused.
+ * @note Only implemented on linux. Other platforms only watch the dir passed to fswatcher_create(), as root 0, and
+ *       always return FSWATCHER_NO_ROOT.
+ *
+ * @param watcher to add root to.
+ * @param watch_dir directory to watch.
+ *
+ * @return id of added root or FSWATCHER_NO_ROOT on failure.
+ */
+uint32_t fswatcher_add_root( fswatcher_t watcher, const char* watch_dir );
+
+/**
+ * Stop watching a root added with fswatcher_add_root() or the dir passed to fswatcher_create(), events for the
+ * root that has not been delivered yet might still be delivered.
+ *
+ * @param watcher to remove root from.
+ * @param root id of root to remove.
+ *
+ * @return false if root was not a valid root id.
+ */
+bool fswatcher_remove_root( fswatcher_t watcher, uint32_t root );
+
+/**
+ * Watch directory at path and its sub-directories down to max_depth levels, counting path itself as the first level,
+ * on top of what is already watched. Used to expand watching of a subtree below fswatcher_create_params::max_depth
+ * once it becomes interesting.
+ *
+ * Directories between path and the closest watched directory above it are watched as well, but not their other
+ * sub-directories. Directories created later below path are watched down to the same depth.
+ *
+ * @note Only implemented on linux for the inotify and poll backends.
+ *
+ * @param watcher to watch subtree with.
+ * @param path directory inside one of the roots of watcher.
+ * @param max_depth number of levels to watch, 0 for all.
+ *
+ * @return false if path is not inside a root or could not be watched.
+ */
+bool fswatcher_watch_subtree( fswatcher_t watcher, const char* path, unsigned int max_depth );
+
+/**
+ * Stop watching directory at path and everything below it. Creation and removal of path itself is still reported as
+ * long as its parent is watched.
+ *
+ * @note Only implemented on linux for the inotify and poll backends.
+ *
+ * @param watcher to unwatch subtree from.
+ * @param path watched directory below one of the roots of watcher, roots are removed with fswatcher_remove_root().
+ *
+ * @return false if path was not watched.
+ */
+bool fswatcher_unwatch_subtree( fswatcher_t watcher, const char* path );
+
+/**
+ * Progress of the crawls adding watches, see fswatcher_crawl_progress().
+ */
+struct fswatcher_progress
+{
+	uint64_t dirs_scanned;  ///< directories listed by crawls so far.
+	uint64_t watches_added; ///< directories watched by crawls so far.
+	bool     done;          ///< the crawl started by fswatcher_create() is done.
+};
+
+/**
+ * Get progress of the crawl of the dir passed to fswatcher_create(). Without FSWATCHER_CREATE_ASYNC_CRAWL the crawl is
+ * done when fswatcher_create() returns, with it the crawl runs on a separate thread and this can be called from any
+ * thread to check if the watcher is ready. Counts include later crawls by fswatcher_add_root() and
+ * fswatcher_watch_subtree().
+ *
+ * While the crawl is running events for directories that has already been watched are delivered as usual and calls
+ * that change the watched tree wait for the crawl while it touches it. With FSWATCHER_CREATE_SNAPSHOT the snapshot
+ * is taken once the crawl is done, overflows before that are reported as FSWATCHER_EVENT_BUFFER_OVERFLOW, and
+ * FSWATCHER_BACKEND_POLL starts scanning once it is done.
+ *
+ * @note Only implemented on linux, other platforms report done with all counts 0.
+ *
+ * @param watcher to get crawl progress for.
+ * @param progress filled with progress.
+ */
+void fswatcher_crawl_progress( fswatcher_t watcher, fswatcher_progress* progress );
+
 /**
  * Poll an fswatcher for new events, this call is blocking if FSWATCHER_CREATE_BLOCKING was passed to fswatcher_create().
  *
@@ -188,12 +474,219 @@ void fswatcher_destroy( fswatcher_t watcher );
  *       The more usual case is the src/dst parameters to the callback function. These allocations will only be alive during
  *       the callback and can thusly be allocated with a stack-allocator or other temporary allocator.
  *
+ * @note On linux src/dst are built in scratch-buffers owned by the watcher and allocated with the allocator passed to
+ *       fswatcher_create(), these are reused between events and polls. When the buffers has grown to fit the longest
+ *       path seen a poll will not allocate any memory unless new directories are added to the watch.
+ *       The allocator passed to fswatcher_poll() is not used.
+ *
+ * @note On linux/inotify a directory created in a watched directory is listed once it is watched and a CREATE event is
+ *       reported for everything already in it, sub-directories included, so nothing created before the watch was
+ *       added is missed. At most 1024 such items are reported per poll, the rest on the following polls. Items
+ *       created just as the directory is listed might be reported twice.
+ *
  * @param watcher to poll.
  * @param handler to poll events with.
  * @param allocator used to allocate temporary data during poll or 0x0 to use malloc/free.
  */
 void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator );
 
+/**
+ * Poll an fswatcher for new events, waiting at most timeout_ms for an event to be delivered if there is none available,
+ * independent of FSWATCHER_CREATE_BLOCKING.
+ *
+ * @param watcher to poll.
+ * @param handler to poll events with.
+ * @param allocator used to allocate temporary data during poll or 0x0 to use malloc/free, see fswatcher_poll().
+ * @param timeout_ms max time to wait, 0 to not wait at all and -1 to wait until an event is delivered.
+ */
+void fswatcher_poll_timeout( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator, int timeout_ms );
+
+/**
+ * Poll an fswatcher for new events as fswatcher_poll_timeout() but also pass the root of each event to handler.
+ *
+ * @param watcher to poll.
+ * @param handler to poll events with.
+ * @param timeout_ms max time to wait, 0 to not wait at all and -1 to wait until an event is delivered.
+ */
+void fswatcher_poll_roots( fswatcher_t watcher, fswatcher_root_event_handler* handler, int timeout_ms );
+
+/**
+ * Get the os file descriptor used by the watcher, it becomes readable when there are new events to poll and can be
+ * waited on with select/poll/epoll together with other fds. Events should only be read via fswatcher_poll*().
+ *
+ * @note with FSWATCHER_CREATE_COALESCE held events do not make the fd readable, poll again after the quiet period.
+ * @note Only implemented on linux, returns -1 on other platforms.
+ *
+ * @param watcher to get fd from.
+ */
+int fswatcher_get_fd( fswatcher_t watcher );
+
+/**
+ * Make a poll waiting for events in another thread return, with or without events delivered. If no poll is waiting
+ * the next poll that would wait returns early instead. Safe to call from any thread while the watcher is alive.
+ *
+ * @note On windows this cancels the pending read of the watched dir, a new one is started by the poll that wakes up.
+ * @note Not implemented on osx.
+ *
+ * @param watcher to wake up.
+ */
+void fswatcher_wakeup( fswatcher_t watcher );
+
+/**
+ * Runtime statistics of a watcher, see fswatcher_get_stats(). Counters are totals since the watcher was created.
+ */
+struct fswatcher_stats
+{
+	size_t   watches;           ///< directories watched, inotify, or filesystems marked, fanotify.
+	size_t   memory;            ///< bytes currently held through the watcher allocator.
+
+	uint64_t events_create;     ///< events delivered to handlers and batches, per type.
+	uint64_t events_remove;
+	uint64_t events_modify;
+	uint64_t events_move;
+	uint64_t events_write_done;
+	uint64_t events_modify_dropped; ///< modify events dropped as content was unchanged, FSWATCHER_CREATE_CONTENT_HASH.
+	uint64_t overflows;         ///< times the os event queue overflowed, counted even if recovered with FSWATCHER_CREATE_SNAPSHOT.
+	uint64_t read_syscalls;     ///< read() calls on the os notification fd, including calls from the reader thread.
+
+	uint64_t add_watch_failures;        ///< directories that could not be watched, sum of the buckets below.
+	uint64_t add_watch_failures_limit;  ///< ENOSPC or ENOMEM, i.e. fs.inotify.max_user_watches reached.
+	uint64_t add_watch_failures_access; ///< EACCES or EPERM.
+	uint64_t add_watch_failures_gone;   ///< ENOENT or ENOTDIR, removed before it could be watched.
+	uint64_t add_watch_failures_other;
+
+	uint64_t max_poll_ns;       ///< longest time a single poll spent handling events, time spent waiting for events is excluded.
+};
+
+/**
+ * Get runtime statistics of watcher. Counters are always maintained and cheap to update, this call sums up memory
+ * held by the watcher and might be slower, but it is not meant to be called per event.
+ *
+ * @note On windows only watches, memory, the event counters, overflows and read_syscalls are maintained, the other
+ *       members are 0. On osx all members are 0.
+ *
+ * @param watcher to get statistics for.
+ * @param stats filled with statistics.
+ */
+void fswatcher_get_stats( fswatcher_t watcher, fswatcher_stats* stats );
+
+/**
+ * Poll an fswatcher for new events and fill them into a caller-owned array instead of calling a handler per event,
+ * this call is blocking until at least one event is available if FSWATCHER_CREATE_BLOCKING was passed to fswatcher_create().
+ *
+ * Events that do not fit in out or path_arena are kept by the watcher and returned by the next call to fswatcher_poll_batch()
+ * or fswatcher_poll(), so no events are lost if the arrays are filled.
+ *
+ * @example
+ *
+ * fswatcher_event events[256];
+ * char paths[64 * 1024];
+ * size_t count;
+ * while( ( count = fswatcher_poll_batch( w, events, 256, paths, sizeof( paths ) ) ) > 0 )
+ * {
+ *     for( size_t i = 0; i < count; ++i )
+ *         handle( events[i].type, events[i].src != FSWATCHER_NO_PATH ? paths + events[i].src : 0x0 );
+ * }
+ *
+ * @note path_arena need to be large enough to hold both src and dst of a single event, i.e. 2 paths, or no event can be returned.
+ *
+ * @param watcher to poll.
+ * @param out array to fill with events.
+ * @param cap number of events that fit in out.
+ * @param path_arena buffer where paths referenced by the events are stored.
+ * @param arena_size size of path_arena in bytes.
+ *
+ * @return number of events written to out.
+ */
+size_t fswatcher_poll_batch( fswatcher_t watcher, fswatcher_event* out, size_t cap, char* path_arena, size_t arena_size );
+
+/**
+ * Dispatcher running an event handler on a pool of worker threads, see fswatcher_dispatcher_create().
+ */
+typedef struct fswatcher_dispatcher* fswatcher_dispatcher_t;
+
+/**
+ * Parameters to fswatcher_dispatcher_create(), zero-initialize and fill in the members that is needed.
+ */
+struct fswatcher_dispatcher_params
+{
+	fswatcher_event_handler* handler;   ///< handler called on the worker threads, must stay alive until the dispatcher is destroyed.
+	fswatcher_allocator*     allocator; ///< allocator used by the dispatcher or 0x0 to use malloc/free.
+	unsigned int workers;               ///< number of worker threads, 0 selects 4.
+	unsigned int queue_size;            ///< max events queued per worker, 0 selects 1024.
+};
+
+/**
+ * Create a dispatcher that fans events out to a pool of worker threads, the handler returned by
+ * fswatcher_dispatcher_handler() is passed to fswatcher_poll() in place of the handler to run.
+ *
+ * Events are sharded over the workers by the directory of their path, src or dst if there is no src, so events for
+ * the same path, and for all items in the same directory, are handled in the order they were polled. An event that
+ * creates, removes or moves an item is also ordered against events in the item itself, in case it is a directory, and
+ * a move against events in its destination directory, i.e. the create of a directory is handled before the events
+ * for what is created in it and a move before later events for the moved item. The workers involved wait for each
+ * other to get that order. Events without a path, i.e. FSWATCHER_EVENT_BUFFER_OVERFLOW, are handled after all events
+ * before them and before all events after them. Other events in different directories are handled in parallel and in
+ * no particular order.
+ *
+ * When the queue of a worker is full the poll blocks until the worker has made room, so a slow handler holds back
+ * the poll and with that the reading of events from the os.
+ *
+ * When the handler returns false the poll stops after the next event it dispatches, events already queued on the
+ * workers are still handled.
+ *
+ * If a queue slot can not grow to fit the paths of an event the dispatcher waits for all workers to finish and calls
+ * the handler for that event on the polling thread, so the event keeps its place in the order. These events are
+ * counted in fswatcher_dispatcher_stats::events_inline.
+ *
+ * @note The handler is called from multiple threads at once.
+ * @note The allocator is only called from fswatcher_dispatcher_create(), fswatcher_dispatcher_destroy() and the
+ *       thread polling, the queues grow to fit the longest paths seen and are then reused.
+ * @note Only implemented on linux.
+ *
+ * @param params parameters to create dispatcher with.
+ *
+ * @return created dispatcher or 0x0 on failure.
+ */
+fswatcher_dispatcher_t fswatcher_dispatcher_create( const fswatcher_dispatcher_params* params );
+
+/**
+ * Wait for all events queued on dispatcher to be handled and destroy it.
+ *
+ * @param dispatcher to destroy.
+ */
+void fswatcher_dispatcher_destroy( fswatcher_dispatcher_t dispatcher );
+
+/**
+ * Get the handler to poll with to dispatch events to the workers of dispatcher.
+ *
+ * @param dispatcher to get handler for.
+ */
+fswatcher_event_handler* fswatcher_dispatcher_handler( fswatcher_dispatcher_t dispatcher );
+
+/**
+ * Wait for all events queued on dispatcher so far to be handled.
+ *
+ * @param dispatcher to flush.
+ */
+void fswatcher_dispatcher_flush( fswatcher_dispatcher_t dispatcher );
+
+/**
+ * Statistics of a dispatcher, see fswatcher_dispatcher_get_stats().
+ */
+struct fswatcher_dispatcher_stats
+{
+	uint64_t events_inline; ///< events handled on the polling thread as they could not be queued, out of memory.
+};
+
+/**
+ * Get runtime statistics of dispatcher.
+ *
+ * @param dispatcher to get statistics for.
+ * @param stats filled with statistics.
+ */
+void fswatcher_dispatcher_get_stats( fswatcher_dispatcher_t dispatcher, fswatcher_dispatcher_stats* stats );
+
 #ifdef __cplusplus
 }
 #endif  // __cplusplus
@@ -28,33 +28,488 @@
 
 #include <sys/stat.h>
 #include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/eventfd.h>
+#include <sys/statfs.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h> // FIONREAD
+#include <sys/timerfd.h>
+#include <sys/syscall.h> // io_uring_setup, io_uring_enter
+#include <linux/io_uring.h>
+#include <fcntl.h> // open_by_handle_at
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
 #include <stdlib.h> // malloc
 #include <unistd.h> // read
 #include <stdio.h>  // printf
 #include <dirent.h>
 #include <string.h>
+#include <time.h>
 
 // write something about how we suppose that the kernels will keep on working as they do now:
 // In the current kernel inotify implementation move events are always emitted as contiguous pairs with IN_MOVED_FROM immediately followed by IN_MOVED_TO
 
+#define FSWATCHER_NO_NODE 0xFFFFFFFFu
+#define FSWATCHER_DEPTH_ALL 0xFFFFFFFFu                  // fswatcher_node::depth_left of a node with no depth-limit.
+#define FSWATCHER_READER_BUFFER_SIZE ( 64 * 1024 )
+#define FSWATCHER_READ_BUFFER_MIN    ( 4 * 1024 )          // fits at least one record of max size, inotify and fanotify.
+#define FSWATCHER_READ_BUFFER_MAX    ( 16 * 1024 * 1024 )  // upper limit for FSWATCHER_CREATE_FIONREAD_BUFFER.
+#define FSWATCHER_STAT_BATCH         256                   // max stats submitted to io_uring at once.
+#define FSWATCHER_URING_RETRIES      16                    // io_uring_enter() calls in a row without progress before giving up on io_uring.
+#define FSWATCHER_NEW_DIR_BATCH      1024                  // max items of new directories listed per poll.
+#define FSWATCHER_MTIME_SLACK_NS     ( 2000000000ll )      // directory mtimes younger than this are not trusted, covers coarse fs timestamps.
+#define FSWATCHER_CONTENT_CHUNK      ( 64 * 1024 )         // bytes read at a time when hashing a file, multiple of 32.
+
 struct fswatcher_item
 {
-	int wd;
-	const char* path;
+	int wd;        ///< watch descriptor of item, 0 marks an empty slot in the watch-table.
+	uint32_t node; ///< index of directory-node watched by wd.
+};
+
+/**
+ * Watched directories are stored as a tree of nodes where each node only stores its own name-component and the
+ * index of its parent. Full paths are only built when an event is delivered. Root-nodes store the full path to
+ * the watched directory as name.
+ */
+struct fswatcher_node
+{
+	int      wd;          ///< watch descriptor of node, 0 if watch is removed but node is still parent to other nodes, -1 if node is unused.
+	uint32_t parent;      ///< index of parent node, FSWATCHER_NO_NODE for root-nodes. Next free node for unused nodes.
+	uint32_t children;    ///< number of nodes that has this node as parent, node is kept alive until this reach 0.
+	uint32_t first_child; ///< first node in the list of nodes that has this node as parent, FSWATCHER_NO_NODE if none.
+	uint32_t next_sibling;///< next node with the same parent, FSWATCHER_NO_NODE if last.
+	uint32_t prev_sibling;///< previous node with the same parent, FSWATCHER_NO_NODE if first.
+	uint32_t name_offset; ///< offset of name-component in fswatcher::names.
+	uint32_t name_len;    ///< length of name-component, including trailing '/'.
+	uint32_t root;        ///< id of the watch-root the node belongs to.
+	uint32_t depth_left;  ///< levels of sub-directories below the node that are watched, FSWATCHER_DEPTH_ALL for no limit.
+};
+
+/**
+ * Directory created after its parent was watched, identified by both node and wd as the node might be released and
+ * reused before the directory is listed.
+ */
+struct fswatcher_new_dir
+{
+	uint32_t node;
+	int      wd;
+};
+
+/**
+ * Destination of parsed events, used to share the inotify read-loop between fswatcher_poll() and fswatcher_poll_batch().
+ */
+struct fswatcher_sink
+{
+	/**
+	 * Deliver one event.
+	 *
+	 * @return false if the event could not be consumed, processing stops and the event is delivered again on next poll.
+	 */
+	bool ( *emit )( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst );
+
+	bool   stop;      ///< set by emit() to stop processing after the current, consumed, event.
+	size_t delivered; ///< number of events consumed by sink.
+};
+
+struct fswatcher_coalesce_entry
+{
+	fswatcher_event_type type;
+	uint32_t root;
+	bool     indexed;  ///< entry can be found via fswatcher_coalescer::index and later events for the same path will merge into it.
+	bool     released; ///< entry has been delivered and is waiting to be compacted away.
+	uint64_t hash;     ///< hash of src path.
+	uint64_t deadline; ///< time in ms when entry is released if no more events arrive for the path.
+	uint32_t src;      ///< offset of src in fswatcher_coalescer::arena or FSWATCHER_NO_PATH.
+	uint32_t dst;      ///< offset of dst in fswatcher_coalescer::arena or FSWATCHER_NO_PATH.
+};
+
+/**
+ * Sink sitting between the inotify parsing and the user sink when FSWATCHER_CREATE_COALESCE is used. Events are stored
+ * in arrival order and merged per path, entries are released to the user sink when the path has been quiet for quiet_ms.
+ */
+struct fswatcher_coalescer
+{
+	fswatcher_sink  sink;
+	fswatcher_t     watcher;
+	fswatcher_sink* target; ///< user sink of the current poll.
+	uint32_t        quiet_ms;
+
+	size_t entries_cnt;
+	size_t entries_cap;
+	fswatcher_coalesce_entry* entries;
+
+	size_t arena_size;
+	size_t arena_cap;
+	char*  arena;
+
+	// hash-table from path-hash to index in entries, FSWATCHER_NO_NODE marks an empty slot.
+	size_t    index_cnt;
+	size_t    index_cap; ///< always a power of 2.
+	uint32_t* index;
+};
+
+struct fswatcher_settle_entry
+{
+	uint32_t root;
+	bool     released; ///< entry has been delivered or dropped and is waiting to be compacted away.
+	uint64_t hash;     ///< hash of path.
+	uint64_t deadline; ///< time in ms when the size of the file is checked again.
+	int64_t  size;     ///< size of file when it was last checked.
+	uint32_t path;     ///< offset of path in fswatcher_settler::arena.
+};
+
+/**
+ * Files closed after writing waiting for their size to settle, fswatcher_create_params::write_settle_ms. Entries are
+ * kept in the order they were closed and looked up by path through index, as for fswatcher_coalescer.
+ */
+struct fswatcher_settler
+{
+	uint32_t settle_ms; ///< 0 if files are reported on close.
+
+	size_t entries_cnt;
+	size_t entries_cap;
+	fswatcher_settle_entry* entries;
+
+	size_t arena_size;
+	size_t arena_cap;
+	char*  arena;
+
+	// hash-table from path-hash to index in entries of all entries not released, FSWATCHER_NO_NODE marks an empty slot.
+	size_t    index_cnt;
+	size_t    index_cap; ///< always a power of 2.
+	uint32_t* index;
+};
+
+struct fswatcher_content_entry
+{
+	uint64_t path_hash; ///< hash of path, 0 marks an empty slot.
+	uint64_t inode;
+	uint64_t size;
+	int64_t  mtime;     ///< modification time in ns.
+	uint64_t content;   ///< hash of the content of the file, only valid if hashed.
+	bool     hashed;    ///< false if the file was reported without being read, see fswatcher_content_read().
+	uint32_t path;      ///< offset of path in fswatcher::content_arena.
+};
+
+/**
+ * Directory passed to fswatcher_create() or fswatcher_add_root(), the id of a root is its index in fswatcher::roots.
+ */
+struct fswatcher_root
+{
+	bool     used;
+	uint32_t node;     ///< inotify, top directory-node of root or FSWATCHER_NO_NODE if it has been removed from disk.
+	int      mount_fd; ///< fanotify, fd to the root dir used with open_by_handle_at().
+	fsid_t   fsid;     ///< fanotify, id of the marked filesystem.
+	char*    real;     ///< fanotify, realpath() of root dir, without trailing '/'.
+	size_t   real_len;
+	char*    user;     ///< fanotify, root dir as passed by the user, with trailing '/'.
+	size_t   user_len;
+};
+
+struct fswatcher_snap_entry
+{
+	uint64_t inode;
+	uint64_t size;
+	int64_t  mtime;           ///< modification time in ns.
+	uint32_t name_offset;     ///< offset of name in fswatcher_snap_dir::names.
+	uint32_t name_len;
+	bool     is_dir;
+};
+
+/**
+ * Snapshot of the entries in one directory, sorted by name.
+ */
+struct fswatcher_snap_dir
+{
+	fswatcher_snap_entry* entries;
+	uint32_t entries_cnt;
+	uint32_t entries_cap;
+
+	char*    names;           ///< name of all entries, not zero-terminated.
+	uint32_t names_size;
+	uint32_t names_cap;
+	uint32_t names_garbage;   ///< bytes in names used by erased entries.
+
+	int64_t  mtime;           ///< mtime in ns of the directory itself when it was listed, 0 if it has to be listed on the next scan.
+	bool     scanned;         ///< directory has been listed at least once, false for snapshots only built from events.
+};
+
+/**
+ * Item of a directory being scanned, names are zero-terminated so that they can be passed to the kernel as is.
+ */
+struct fswatcher_stat_item
+{
+	uint32_t    name; ///< offset of name in fswatcher_stat_batch::names.
+	uint32_t    name_len;
+	bool        ok;   ///< st is valid.
+	struct stat st;
+};
+
+struct fswatcher_stat_batch
+{
+	char*  names;
+	size_t names_size;
+	size_t names_cap;
+
+	fswatcher_stat_item* items;
+	size_t items_cnt;
+	size_t items_cap;
+};
+
+/**
+ * io_uring used to stat the items of a directory in batches with IORING_OP_STATX, set up on first use. fd is -1 if
+ * io_uring is not available, then items are stat:ed one by one with fstatat().
+ */
+struct fswatcher_uring
+{
+	bool      tried;
+	int       fd;
+	unsigned  sq_entries;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	io_uring_sqe* sqes;
+	io_uring_cqe* cqes;
+
+	void*  sq_ring;
+	size_t sq_ring_size;
+	void*  cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	struct statx* results; ///< FSWATCHER_STAT_BATCH results, allocated with the watcher allocator.
+};
+
+struct fswatcher_event_queue
+{
+	size_t events_head;
+	size_t events_cnt;
+	size_t events_cap;
+	fswatcher_event* events;
+
+	size_t arena_size;
+	size_t arena_cap;
+	char*  arena;
+};
+
+struct fswatcher_path_buffer
+{
+	char*  ptr;
+	size_t cap;
+};
+
+struct fswatcher_fid_slot
+{
+	uint64_t hash;   ///< hash of file handle, 0 marks an empty slot.
+	uint32_t offset; ///< offset of cached entry in fswatcher_fid_cache::arena.
+};
+
+/**
+ * Cache from fanotify directory file handle to the directory path as reported to the user. Entries are stored in
+ * arena as [uint32 key_len][key][uint32 path_len][path + '\0'] where key is handle-type + handle-bytes and path_len
+ * is FSWATCHER_NO_PATH for directories outside the watched root.
+ */
+struct fswatcher_fid_cache
+{
+	size_t slots_cnt;
+	size_t slots_cap; ///< always a power of 2.
+	fswatcher_fid_slot* slots;
+
+	size_t arena_size;
+	size_t arena_cap;
+	char*  arena;
+};
+
+/**
+ * Filter-patterns are compiled at create into rules, most patterns seen in practice are a plain name, "name*" or
+ * "*.ext" and are matched with a single compare, the rest use the general glob-matcher.
+ */
+enum fswatcher_filter_kind
+{
+	FSWATCHER_FILTER_EXACT,
+	FSWATCHER_FILTER_PREFIX,
+	FSWATCHER_FILTER_SUFFIX,
+	FSWATCHER_FILTER_GLOB
+};
+
+struct fswatcher_filter_rule
+{
+	fswatcher_filter_kind kind;
+	uint32_t offset; ///< offset of text to match in fswatcher_filter::text, wildcards stripped for prefix and suffix.
+	uint32_t len;
+};
+
+struct fswatcher_filter
+{
+	fswatcher_filter_rule* rules;
+	uint32_t rules_cnt;
+	char*    text;
+	size_t   text_size;
 };
 
 struct fswatcher
 {
 	fswatcher_allocator* allocator;
-	int notifierfd;
+	fswatcher_backend backend;
+	int notifierfd; ///< inotify or fanotify fd depending on backend.
+	int wakeupfd;   ///< eventfd signaled by fswatcher_wakeup(), waited on together with notifierfd.
 
 	uint32_t watch_flags;
 
+	// fswatcher_create_params::exclude and include, read-only after create.
+	fswatcher_filter exclude;
+	fswatcher_filter include;
+
+	// watch-table, open addressed hash-table indexed by wd. inotify hands out wd:s as small, dense and increasing
+	// ints so "wd & ( watches_cap - 1 )" is close to a direct mapping and collisions are resolved by linear probing.
 	size_t watches_cnt;
-	size_t watches_cap;
+	size_t watches_cap; ///< always a power of 2.
 	fswatcher_item* watches;
+
+	// directory-tree, unused nodes are linked via fswatcher_node::parent starting at nodes_free.
+	uint32_t nodes_cnt;
+	uint32_t nodes_cap;
+	uint32_t nodes_free;
+	fswatcher_node* nodes;
+
+	// index of nodes by parent + name, open addressed hash-table of node indices with FSWATCHER_NO_NODE marking an
+	// empty slot, used to find the node of a sub-directory from an event on its parent.
+	size_t    children_index_cnt;
+	size_t    children_index_cap; ///< always a power of 2.
+	uint32_t* children_index;
+
+	// arena holding name-components of all nodes, names of freed nodes are counted as garbage and reclaimed on grow.
+	uint32_t names_size;
+	uint32_t names_cap;
+	uint32_t names_garbage;
+	char* names;
+
+	// scratch-buffers used to build paths passed to the event handler, reused between events and polls.
+	fswatcher_path_buffer path;
+	fswatcher_path_buffer move_src;
+
+	// src of a IN_MOVED_FROM waiting for its IN_MOVED_TO, kept between polls if the sink was full.
+	bool     move_src_valid;
+	uint32_t move_cookie;
+	uint32_t move_src_root;
+	uint32_t move_src_node; ///< node of the moved directory, FSWATCHER_NO_NODE for files.
+
+	// IN_MOVE is always watched to keep the directory-tree correct, MOVE events are only reported if requested.
+	bool report_moves;
+
+	// directories created after their parent was watched, listed a batch at a time by polls to report what was created
+	// in them before their watch was added. new_dir_stream is the listing of new_dir, kept open between polls.
+	size_t new_dirs_cnt;
+	size_t new_dirs_cap;
+	fswatcher_new_dir* new_dirs;
+	fswatcher_new_dir  new_dir;
+	DIR*               new_dir_stream;
+
+	bool blocking;
+	bool coalesce;
+	fswatcher_coalescer coalescer;
+	fswatcher_settler settler;
+
+	// FSWATCHER_CREATE_CONTENT_HASH, open addressed hash-table of modified files by path, paths are stored in content_arena.
+	bool content_hash;
+	size_t content_cnt;
+	size_t content_cap; ///< always a power of 2.
+	fswatcher_content_entry* content;
+	size_t content_arena_size;
+	size_t content_arena_cap;
+	size_t content_arena_garbage; ///< bytes of paths of erased entries, dropped when the arena is rebuilt.
+	char*  content_arena;
+	uint8_t* content_buf; ///< FSWATCHER_CONTENT_CHUNK bytes files are read into, allocated on first use.
+
+	// FSWATCHER_CREATE_SNAPSHOT, snapshot per directory-node indexed as nodes, grown on demand.
+	bool snapshot;
+	uint32_t snaps_cap;
+	fswatcher_snap_dir* snaps;
+	fswatcher_snap_dir snap_scratch;
+
+	// used by snapshot scans to stat all items of a directory.
+	fswatcher_stat_batch stat_batch;
+	fswatcher_uring uring;
+
+	// FSWATCHER_BACKEND_POLL, directories get made up watch descriptors and notifierfd is a timer firing when a scan is due.
+	int poll_next_wd;
+
+	// event types requested at create, events synthesized by the watcher are filtered with this.
+	fswatcher_event_type types;
+
+	// fswatcher_create_params::snapshot_file, saved on destroy once creation has succeeded.
+	char* snapshot_file;
+	bool persist_ready;
+
+	// events synthesized by the watcher, delivered before any more events are read from the os.
+	fswatcher_event_queue queue;
+
+	// watched roots, unused slots are reused by fswatcher_add_root().
+	uint32_t roots_cnt;
+	uint32_t roots_cap;
+	fswatcher_root* roots;
+	unsigned int crawl_threads;
+	uint32_t max_depth; ///< fswatcher_create_params::max_depth, 0 for no limit.
+
+	// FSWATCHER_CREATE_ASYNC_CRAWL, root 0 is crawled by crawl_thread. tree_lock is held by the crawl while it touches
+	// the directory-tree and by all calls that might touch the tree while async_crawl is set.
+	bool            async_crawl;
+	bool            crawl_started;
+	bool            crawl_cancel;   ///< set by fswatcher_destroy() to stop the crawl early.
+	bool            crawl_done;
+	pthread_t       crawl_thread;
+	pthread_mutex_t tree_lock;
+	uint64_t        crawl_dirs_scanned;  ///< directories listed by crawls, see fswatcher_crawl_progress().
+	uint64_t        crawl_watches_added; ///< directories watched by crawls, see fswatcher_crawl_progress().
+
+	// fanotify backend, the whole filesystem of each root is marked and events outside of the roots are filtered out.
+	uint32_t fan_mask;    ///< fanotify event mask.
+	uint64_t fan_done;    ///< mask-bits of the current fanotify record that has already been delivered.
+	fswatcher_fid_cache fid_cache;
+
+	// FSWATCHER_CREATE_READER_THREAD, the reader thread reads raw records from notifierfd into ring as fast as it can and
+	// polls copy them from ring into read_buffer. ring_head is only written by the reader and ring_tail by the poll.
+	bool      reader_started;
+	pthread_t reader;
+	int       reader_stopfd;  ///< eventfd signaled by fswatcher_destroy() to stop the reader.
+	int       ring_datafd;    ///< eventfd signaled by the reader when records has been pushed.
+	int       ring_spacefd;   ///< eventfd signaled by polls when records has been popped while reader_blocked is set.
+	bool      reader_blocked; ///< reader is waiting for space in ring.
+	char*     reader_buffer;
+	char*     ring;
+	size_t    ring_cap;       ///< always a power of 2.
+	size_t    ring_head;      ///< total bytes pushed.
+	size_t    ring_tail;      ///< total bytes popped.
+
+	// counters reported by fswatcher_get_stats(), updated with atomics where other threads might touch them, i.e.
+	// add-watch failures from crawl-threads and read_syscalls from the reader thread.
+	fswatcher_stats stats;
+
+	// events read from the kernel, read_pos is the next event to process. Allocated so aligned to at least 8 to fit
+	// both inotify_event and fanotify_event_metadata.
+	size_t read_pos;
+	size_t read_end;
+	size_t read_buffer_cap;
+	char*  read_buffer;
+	bool   read_fionread; ///< FSWATCHER_CREATE_FIONREAD_BUFFER, grow read_buffer to fit all queued events before a read.
 };
 
+static void fswatcher_snap_clear( fswatcher_t w, uint32_t node );
+static void fswatcher_snap_free( fswatcher_t w, fswatcher_snap_dir* dir );
+static void fswatcher_snap_build( fswatcher_t w, uint32_t root );
+static void fswatcher_persist_save( fswatcher_t w );
+static bool fswatcher_persist_load( fswatcher_t w );
+static bool fswatcher_snap_rescan_all( fswatcher_t w );
+static void fswatcher_uring_free( fswatcher_t w );
+static bool fswatcher_coalesce_emit( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst );
+static bool fswatcher_write_done( fswatcher_t w, fswatcher_sink* sink, uint32_t root, const char* path );
+static bool fswatcher_emit_modify( fswatcher_t w, fswatcher_sink* sink, uint32_t root, const char* path );
+static void fswatcher_content_forget( fswatcher_t w, const char* path );
+
 static void* fswatcher_default_realloc( fswatcher_allocator*, void* ptr, size_t, size_t new_size )
 {
 	return realloc( ptr, new_size );
@@ -78,292 +533,5285 @@ static void fswatcher_free( fswatcher_allocator* allocator, void* ptr )
 		allocator->free( allocator, ptr );
 }
 
-static char* fswatcher_strdup( fswatcher_allocator* allocator, const char* str )
+static void fswatcher_lock_tree( fswatcher_t w )
 {
-	size_t len = strlen( str ) + 1;
-	char* res = (char*)fswatcher_realloc( allocator, 0x0, 0, len );
-	strcpy( res, str );
-	return res;
+	if( w->async_crawl )
+		pthread_mutex_lock( &w->tree_lock );
 }
 
-static const char* fswatcher_find_wd_path( fswatcher_t w, int wd )
+static void fswatcher_unlock_tree( fswatcher_t w )
 {
-	for( size_t i = 0; i < w->watches_cnt; ++ i )
-		if( wd == w->watches[i].wd )
-			return w->watches[i].path;
-	return 0x0;
+	if( w->async_crawl )
+		pthread_mutex_unlock( &w->tree_lock );
 }
 
-static void fswatcher_add( fswatcher_t w, char* path )
+/**
+ * Check if the crawl of root 0 is done, always true unless FSWATCHER_CREATE_ASYNC_CRAWL.
+ */
+static bool fswatcher_crawl_complete( fswatcher_t w )
 {
-	int wd = inotify_add_watch( w->notifierfd, path, w->watch_flags );
-	if( wd < 0 )
+	return !w->async_crawl || __atomic_load_n( &w->crawl_done, __ATOMIC_ACQUIRE );
+}
+
+static bool fswatcher_filter_compile( fswatcher_allocator* allocator, fswatcher_filter* filter, const char* const* patterns, unsigned int patterns_cnt )
+{
+	size_t text_size = 0;
+	for( unsigned int i = 0; i < patterns_cnt; ++i )
+		text_size += strlen( patterns[i] );
+	if( patterns_cnt == 0 )
+		return true;
+	if( text_size > 0xFFFFFFFFu )
+		return false;
+
+	filter->rules = (fswatcher_filter_rule*)fswatcher_realloc( allocator, 0x0, 0, sizeof( fswatcher_filter_rule ) * patterns_cnt );
+	filter->text  = (char*)fswatcher_realloc( allocator, 0x0, 0, text_size + 1 );
+	if( filter->rules == 0x0 || filter->text == 0x0 )
+		return false;
+	filter->text_size = text_size + 1;
+
+	uint32_t text_pos = 0;
+	for( unsigned int i = 0; i < patterns_cnt; ++i )
 	{
-		fprintf(stderr, "failed to add a watch for %s ", path);
-		perror("");
-		return;
+		const char* p = patterns[i];
+		uint32_t len = (uint32_t)strlen( p );
+		uint32_t wildcards = 0;
+		bool     other     = false; // ... any wildcard not at the first or last position ...
+		for( uint32_t c = 0; c < len; ++c )
+		{
+			if( p[c] != '*' && p[c] != '?' )
+				continue;
+			++wildcards;
+			other |= p[c] == '?' || ( c != 0 && c != len - 1 );
+		}
+
+		fswatcher_filter_rule* rule = &filter->rules[filter->rules_cnt++];
+		rule->kind   = FSWATCHER_FILTER_GLOB;
+		rule->offset = text_pos;
+		rule->len    = len;
+		if( wildcards == 0 )
+			rule->kind = FSWATCHER_FILTER_EXACT;
+		else if( wildcards == 1 && !other && len > 1 )
+		{
+			rule->kind = p[0] == '*' ? FSWATCHER_FILTER_SUFFIX : FSWATCHER_FILTER_PREFIX;
+			rule->len  = len - 1;
+			if( p[0] == '*' )
+				++p;
+		}
+		memcpy( filter->text + text_pos, p, rule->len );
+		text_pos += rule->len;
+	}
+	return true;
+}
+
+static void fswatcher_filter_free( fswatcher_allocator* allocator, fswatcher_filter* filter )
+{
+	fswatcher_free( allocator, filter->rules );
+	fswatcher_free( allocator, filter->text );
+}
+
+/**
+ * Match name against glob-pattern where '*' match any sequence of characters and '?' matches one character.
+ */
+static bool fswatcher_glob_match( const char* pattern, size_t pattern_len, const char* name, size_t name_len )
+{
+	// ... greedy with backtracking to the last '*', linear in practice ...
+	size_t p = 0;
+	size_t n = 0;
+	size_t star = (size_t)-1;
+	size_t star_n = 0;
+	while( n < name_len )
+	{
+		if( p < pattern_len && ( pattern[p] == '?' || pattern[p] == name[n] ) )
+		{
+			++p;
+			++n;
+		}
+		else if( p < pattern_len && pattern[p] == '*' )
+		{
+			star   = p++;
+			star_n = n;
+		}
+		else if( star != (size_t)-1 )
+		{
+			p = star + 1;
+			n = ++star_n;
+		}
+		else
+			return false;
 	}
-	if( w->watches_cnt >= w->watches_cap )
+	while( p < pattern_len && pattern[p] == '*' )
+		++p;
+	return p == pattern_len;
+}
+
+static bool fswatcher_filter_match( const fswatcher_filter* filter, const char* name, size_t name_len )
+{
+	for( uint32_t i = 0; i < filter->rules_cnt; ++i )
 	{
-		w->watches = (fswatcher_item*)fswatcher_realloc( w->allocator, w->watches, sizeof(fswatcher_item) * w->watches_cap, sizeof(fswatcher_item) * w->watches_cap * 2 );
-		w->watches_cap *= 2;
+		const fswatcher_filter_rule* rule = &filter->rules[i];
+		const char* text = filter->text + rule->offset;
+		switch( rule->kind )
+		{
+			case FSWATCHER_FILTER_EXACT:
+				if( name_len == rule->len && memcmp( name, text, name_len ) == 0 )
+					return true;
+				break;
+			case FSWATCHER_FILTER_PREFIX:
+				if( name_len >= rule->len && memcmp( name, text, rule->len ) == 0 )
+					return true;
+				break;
+			case FSWATCHER_FILTER_SUFFIX:
+				if( name_len >= rule->len && memcmp( name + name_len - rule->len, text, rule->len ) == 0 )
+					return true;
+				break;
+			case FSWATCHER_FILTER_GLOB:
+				if( fswatcher_glob_match( text, rule->len, name, name_len ) )
+					return true;
+				break;
+		}
 	}
+	return false;
+}
 
-	w->watches[ w->watches_cnt ].wd = wd;
-	w->watches[ w->watches_cnt ].path = fswatcher_strdup( w->allocator, path );
-	++w->watches_cnt;
+/**
+ * Check if item with name-component name should be skipped, excluded directories are never watched and events for
+ * filtered items are dropped.
+ */
+static bool fswatcher_filtered( fswatcher_t w, const char* name, size_t name_len, bool is_dir )
+{
+	if( fswatcher_filter_match( &w->exclude, name, name_len ) )
+		return true;
+	return !is_dir && w->include.rules_cnt > 0 && !fswatcher_filter_match( &w->include, name, name_len );
 }
 
-static void fswatcher_remove( fswatcher_t w, int wd )
+static size_t fswatcher_wd_slot( fswatcher_t w, int wd )
 {
-	for( size_t i = 0; i < w->watches_cnt; ++ i )
-	{
-		if( wd != w->watches[i].wd )
-			continue;
+	return (size_t)wd & ( w->watches_cap - 1 );
+}
 
-		fswatcher_free( w->allocator, (void*)w->watches[i].path );
-		w->watches[i].wd = 0;
-		w->watches[i].path = 0x0;
+static fswatcher_item* fswatcher_find_wd( fswatcher_t w, int wd )
+{
+	for( size_t i = fswatcher_wd_slot( w, wd ); w->watches[i].wd != 0; i = ( i + 1 ) & ( w->watches_cap - 1 ) )
+		if( wd == w->watches[i].wd )
+			return &w->watches[i];
+	return 0x0;
+}
 
-		size_t swap_index = w->watches_cnt - 1;
-		if( i != swap_index )
-			memcpy( w->watches + i, w->watches + swap_index, sizeof( fswatcher_item ) );
-		--w->watches_cnt;
-		return;
-	}
+static void fswatcher_insert_wd( fswatcher_item* watches, size_t watches_cap, int wd, uint32_t node )
+{
+	size_t i = (size_t)wd & ( watches_cap - 1 );
+	while( watches[i].wd != 0 )
+		i = ( i + 1 ) & ( watches_cap - 1 );
+	watches[i].wd   = wd;
+	watches[i].node = node;
 }
 
-static void fswatcher_recursive_add( fswatcher_t w, char* path_buffer, size_t path_len, size_t path_max )
+static bool fswatcher_grow_watches( fswatcher_t w )
 {
-	fswatcher_add( w, path_buffer );
-	DIR* dirp = opendir( path_buffer );
-	dirent* ent;
-	while( ( ent = readdir( dirp ) ) != 0x0 )
-	{
-		if( ( ent->d_type != DT_DIR && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN ) )
-			continue;
+	// ... keep load-factor below 50% to keep probe-sequences short ...
+	if( ( w->watches_cnt + 1 ) * 2 <= w->watches_cap )
+		return true;
 
-		if( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
-			continue;
+	size_t new_cap = w->watches_cap * 2;
+	fswatcher_item* new_watches = (fswatcher_item*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof(fswatcher_item) * new_cap );
+	if( new_watches == 0x0 )
+		return false;
+	memset( new_watches, 0x0, sizeof(fswatcher_item) * new_cap );
 
-		size_t d_name_size = strlen( ent->d_name );
-		if( path_len + d_name_size + 2 >= path_max )
-			return; // TODO: handle!
+	for( size_t i = 0; i < w->watches_cap; ++i )
+		if( w->watches[i].wd != 0 )
+			fswatcher_insert_wd( new_watches, new_cap, w->watches[i].wd, w->watches[i].node );
 
-		strcpy( path_buffer + path_len, ent->d_name );
-		path_buffer[ path_len + d_name_size ] = '/';
-		path_buffer[ path_len + d_name_size + 1 ] = '\0';
+	fswatcher_free( w->allocator, w->watches );
+	w->watches     = new_watches;
+	w->watches_cap = new_cap;
+	return true;
+}
 
-		if( ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN )
-		{
-			struct stat statbuf;
-			if( stat( path_buffer, &statbuf ) == -1 )
-				continue;
+static void fswatcher_erase_wd( fswatcher_t w, fswatcher_item* item )
+{
+	--w->watches_cnt;
 
-			if( !S_ISDIR( statbuf.st_mode ) )
-				continue;
+	// ... backward shift deletion, move items in the probe-sequence after the removed one up so that no tombstones are needed ...
+	size_t mask = w->watches_cap - 1;
+	size_t hole = (size_t)( item - w->watches );
+	for( size_t i = ( hole + 1 ) & mask; w->watches[i].wd != 0; i = ( i + 1 ) & mask )
+	{
+		size_t home = fswatcher_wd_slot( w, w->watches[i].wd );
+		if( ( ( i - home ) & mask ) >= ( ( i - hole ) & mask ) )
+		{
+			w->watches[hole] = w->watches[i];
+			hole = i;
 		}
-
-		fswatcher_recursive_add( w, path_buffer, path_len + d_name_size + 1, path_max );
 	}
-	path_buffer[path_len] = '\0';
+	w->watches[hole].wd   = 0;
+	w->watches[hole].node = FSWATCHER_NO_NODE;
+}
 
-	closedir( dirp );
+static uint64_t fswatcher_child_hash( uint32_t parent, const char* name, size_t name_len )
+{
+	// ... FNV-1a of parent and name ...
+	uint64_t hash = 14695981039346656037ull;
+	for( int i = 0; i < 4; ++i )
+		hash = ( hash ^ ( ( parent >> ( i * 8 ) ) & 0xFF ) ) * 1099511628211ull;
+	for( size_t i = 0; i < name_len; ++i )
+		hash = ( hash ^ (uint8_t)name[i] ) * 1099511628211ull;
+	return hash;
 }
 
-fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type types, const char* watch_dir, fswatcher_allocator* allocator )
+static size_t fswatcher_child_slot( fswatcher_t w, uint32_t node_index, size_t cap )
 {
-	if( allocator == 0x0 )
-		allocator = &g_fswatcher_default_alloc;
+	// ... names are stored with a trailing '/', not part of the hash so that lookups can use the plain name ...
+	fswatcher_node* node = &w->nodes[node_index];
+	return (size_t)fswatcher_child_hash( node->parent, w->names + node->name_offset, node->name_len - 1 ) & ( cap - 1 );
+}
 
-	fswatcher* w = (fswatcher*)fswatcher_realloc( allocator, 0x0, 0, sizeof( fswatcher ) );
-	memset( w, 0x0, sizeof( fswatcher ) );
-	w->allocator = allocator;
-	w->watch_flags = 0;
+static void fswatcher_child_index_insert( fswatcher_t w, uint32_t* index, size_t cap, uint32_t node_index )
+{
+	size_t i = fswatcher_child_slot( w, node_index, cap );
+	while( index[i] != FSWATCHER_NO_NODE )
+		i = ( i + 1 ) & ( cap - 1 );
+	index[i] = node_index;
+}
 
-	if( types & FSWATCHER_EVENT_CREATE ) w->watch_flags |= IN_CREATE;
-	if( types & FSWATCHER_EVENT_REMOVE ) w->watch_flags |= IN_DELETE;
-	if( types & FSWATCHER_EVENT_MOVE   ) w->watch_flags |= IN_MOVE;
-	if( types & FSWATCHER_EVENT_MODIFY ) w->watch_flags |= IN_MODIFY;
-	w->watch_flags |= IN_DELETE_SELF;
+static bool fswatcher_grow_children_index( fswatcher_t w )
+{
+	// ... keep load-factor below 50% to keep probe-sequences short ...
+	if( ( w->children_index_cnt + 1 ) * 2 <= w->children_index_cap )
+		return true;
 
-	int inotify_flags = 0;
-	if( ( flags & FSWATCHER_CREATE_BLOCKING ) == 0 )
-		inotify_flags |= IN_NONBLOCK;
+	size_t new_cap = w->children_index_cap ? w->children_index_cap * 2 : 64;
+	uint32_t* new_index = (uint32_t*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( uint32_t ) * new_cap );
+	if( new_index == 0x0 )
+		return false;
+	memset( new_index, 0xFF, sizeof( uint32_t ) * new_cap );
 
-	w->notifierfd = inotify_init1( inotify_flags );
-	if( w->notifierfd < -1 )
-	{
-		fswatcher_free( allocator, w );
-		return 0x0;
-	}
+	for( size_t i = 0; i < w->children_index_cap; ++i )
+		if( w->children_index[i] != FSWATCHER_NO_NODE )
+			fswatcher_child_index_insert( w, new_index, new_cap, w->children_index[i] );
 
-	w->watches_cap = 16; // 256;
-	w->watches = (fswatcher_item*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof(fswatcher_item) * w->watches_cap );
+	fswatcher_free( w->allocator, w->children_index );
+	w->children_index     = new_index;
+	w->children_index_cap = new_cap;
+	return true;
+}
 
-	char path_buffer[4096];
-	strncpy( path_buffer, watch_dir, sizeof( path_buffer ) );
-	// TODO: make sure path fit ...
+/**
+ * Remove node from the children-index, must be called while parent and name of the node are still the ones it was
+ * inserted with.
+ */
+static void fswatcher_child_index_erase( fswatcher_t w, uint32_t node_index )
+{
+	size_t mask = w->children_index_cap - 1;
+	size_t hole = fswatcher_child_slot( w, node_index, w->children_index_cap );
+	while( w->children_index[hole] != node_index )
+		hole = ( hole + 1 ) & mask;
+	--w->children_index_cnt;
 
-	size_t path_len = strlen( path_buffer );
-	if( path_buffer[path_len-1] != '/' )
+	// ... backward shift deletion, same as for the watch-table ...
+	for( size_t i = ( hole + 1 ) & mask; w->children_index[i] != FSWATCHER_NO_NODE; i = ( i + 1 ) & mask )
 	{
-		path_buffer[path_len] = '/';
-		path_buffer[path_len+1] = '\0';
-		++path_len;
+		size_t home = fswatcher_child_slot( w, w->children_index[i], w->children_index_cap );
+		if( ( ( i - home ) & mask ) >= ( ( i - hole ) & mask ) )
+		{
+			w->children_index[hole] = w->children_index[i];
+			hole = i;
+		}
 	}
+	w->children_index[hole] = FSWATCHER_NO_NODE;
+}
 
-	fswatcher_recursive_add( w, path_buffer, path_len, sizeof( path_buffer ) );
-	return w;
+/**
+ * Find directory-node with name-component name below parent, name without trailing '/'.
+ */
+static uint32_t fswatcher_find_child( fswatcher_t w, uint32_t parent, const char* name, uint32_t name_len )
+{
+	if( w->children_index_cap == 0 )
+		return FSWATCHER_NO_NODE;
+
+	size_t mask = w->children_index_cap - 1;
+	for( size_t i = fswatcher_child_hash( parent, name, name_len ) & mask; w->children_index[i] != FSWATCHER_NO_NODE; i = ( i + 1 ) & mask )
+	{
+		fswatcher_node* node = &w->nodes[w->children_index[i]];
+		if( node->parent == parent && node->name_len == name_len + 1 && memcmp( w->names + node->name_offset, name, name_len ) == 0 )
+			return w->children_index[i];
+	}
+	return FSWATCHER_NO_NODE;
 }
 
-void fswatcher_destroy( fswatcher_t watcher )
+static bool fswatcher_reserve_names( fswatcher_t w, uint32_t len )
 {
-	close( watcher->notifierfd );
-	for( size_t i = 0; i < watcher->watches_cnt; ++i )
-		fswatcher_free( watcher->allocator, (void*)watcher->watches[i].path );
-	fswatcher_free( watcher->allocator, watcher->watches );
-	fswatcher_free( watcher->allocator, watcher );
+	if( w->names_size + len <= w->names_cap )
+		return true;
+
+	// ... grow and compact in one go, only names of nodes in use are copied to the new arena. Keep at least 25%
+	//     headroom after compaction so that a nearly full arena is not compacted over and over ...
+	uint32_t need = w->names_size - w->names_garbage + len;
+	uint32_t new_cap = w->names_cap;
+	while( new_cap < need + need / 4 )
+		new_cap *= 2;
+
+	char* new_names = (char*)fswatcher_realloc( w->allocator, 0x0, 0, new_cap );
+	if( new_names == 0x0 )
+		return false;
+
+	uint32_t new_size = 0;
+	for( uint32_t i = 0; i < w->nodes_cnt; ++i )
+	{
+		fswatcher_node* node = &w->nodes[i];
+		if( node->wd < 0 )
+			continue;
+		memcpy( new_names + new_size, w->names + node->name_offset, node->name_len );
+		node->name_offset = new_size;
+		new_size += node->name_len;
+	}
+
+	fswatcher_free( w->allocator, w->names );
+	w->names         = new_names;
+	w->names_cap     = new_cap;
+	w->names_size    = new_size;
+	w->names_garbage = 0;
+	return true;
 }
 
-static char* fswatcher_build_full_path( fswatcher_t watcher, fswatcher_allocator* allocator, int wd, const char* name, uint32_t name_len )
+static uint32_t fswatcher_alloc_node( fswatcher_t w )
 {
-	const char* dirpath = fswatcher_find_wd_path( watcher, wd );
-	size_t dirlen = strlen( dirpath );
-	size_t length = dirlen + 1 + name_len;
-	char* res = (char*)fswatcher_realloc( allocator, 0x0, 0, length );
-	if( res )
+	if( w->nodes_free != FSWATCHER_NO_NODE )
 	{
-		memcpy( res, dirpath, dirlen );
-		memcpy( res + dirlen, name, name_len );
-		res[length-1] = 0;
+		uint32_t res = w->nodes_free;
+		w->nodes_free = w->nodes[res].parent;
+		return res;
 	}
-	return res;
+
+	if( w->nodes_cnt >= w->nodes_cap )
+	{
+		fswatcher_node* new_nodes = (fswatcher_node*)fswatcher_realloc( w->allocator, w->nodes, sizeof(fswatcher_node) * w->nodes_cap, sizeof(fswatcher_node) * w->nodes_cap * 2 );
+		if( new_nodes == 0x0 )
+			return FSWATCHER_NO_NODE;
+		w->nodes = new_nodes;
+		w->nodes_cap *= 2;
+	}
+	return w->nodes_cnt++;
 }
 
-#define FS_MAKE_CALLBACK( type, src, dst ) handler->callback( handler, (type), (src), (dst) );
+/**
+ * Add node to the child-list of its parent.
+ */
+static void fswatcher_link_child( fswatcher_t w, uint32_t node_index )
+{
+	fswatcher_node* node   = &w->nodes[node_index];
+	fswatcher_node* parent = &w->nodes[node->parent];
+	node->prev_sibling = FSWATCHER_NO_NODE;
+	node->next_sibling = parent->first_child;
+	if( parent->first_child != FSWATCHER_NO_NODE )
+		w->nodes[parent->first_child].prev_sibling = node_index;
+	parent->first_child = node_index;
+	++parent->children;
+}
 
-static void fswatcher_make_callback_with_src_path( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_event_type type, inotify_event* ev )
+/**
+ * Remove node from the child-list of its parent.
+ */
+static void fswatcher_unlink_child( fswatcher_t w, uint32_t node_index )
 {
-	char* src = fswatcher_build_full_path( watcher, watcher->allocator, ev->wd, ev->name, ev->len );
-	FS_MAKE_CALLBACK( type, src, 0x0 );
-	fswatcher_free( watcher->allocator, src );
+	fswatcher_node* node = &w->nodes[node_index];
+	if( node->prev_sibling != FSWATCHER_NO_NODE )
+		w->nodes[node->prev_sibling].next_sibling = node->next_sibling;
+	else
+		w->nodes[node->parent].first_child = node->next_sibling;
+	if( node->next_sibling != FSWATCHER_NO_NODE )
+		w->nodes[node->next_sibling].prev_sibling = node->prev_sibling;
+	--w->nodes[node->parent].children;
 }
 
-static void fswatcher_make_callback_with_dst_path( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_event_type type, inotify_event* ev )
+static void fswatcher_release_node( fswatcher_t w, uint32_t node_index )
 {
-	char* dst = fswatcher_build_full_path( watcher, watcher->allocator, ev->wd, ev->name, ev->len );
-	FS_MAKE_CALLBACK( type, 0x0, dst );
-	fswatcher_free( watcher->allocator, dst );
+	// ... free node and all parents that was only kept alive by it ...
+	while( node_index != FSWATCHER_NO_NODE )
+	{
+		fswatcher_node* node = &w->nodes[node_index];
+		if( node->wd != 0 || node->children > 0 )
+			return;
+
+		uint32_t parent = node->parent;
+		if( parent == FSWATCHER_NO_NODE && w->roots[node->root].node == node_index )
+			w->roots[node->root].node = FSWATCHER_NO_NODE;
+
+		fswatcher_snap_clear( w, node_index );
+		fswatcher_child_index_erase( w, node_index );
+		if( parent != FSWATCHER_NO_NODE )
+			fswatcher_unlink_child( w, node_index );
+		w->names_garbage += node->name_len;
+		node->wd     = -1;
+		node->parent = w->nodes_free;
+		w->nodes_free = node_index;
+		node_index = parent;
+	}
 }
 
-void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator )
+/**
+ * Add directory-node watched by wd to the directory-tree as a child to parent with the name-component name.
+ * wd must not already be in the watch-table.
+ */
+static uint32_t fswatcher_insert_node( fswatcher_t w, uint32_t parent, uint32_t root, int wd, const char* name, size_t name_len )
 {
-	if( allocator == 0x0 )
-		allocator = &g_fswatcher_default_alloc;
+	// ... name is always stored with a trailing '/' so that a full path is just the concatenation of all names ...
+	bool add_sep = name_len == 0 || name[name_len - 1] != '/';
+	uint32_t stored_len = (uint32_t)name_len + ( add_sep ? 1u : 0u );
 
-	char*    move_src = 0x0;
-	uint32_t move_cookie = 0;
+	if( !fswatcher_grow_watches( w ) || !fswatcher_grow_children_index( w ) || !fswatcher_reserve_names( w, stored_len ) )
+		return FSWATCHER_NO_NODE;
 
-	while( true )
+	uint32_t node_index = fswatcher_alloc_node( w );
+	if( node_index == FSWATCHER_NO_NODE )
+		return FSWATCHER_NO_NODE;
+
+	fswatcher_node* node = &w->nodes[node_index];
+	node->wd          = wd;
+	node->parent      = parent;
+	node->children    = 0;
+	node->first_child = FSWATCHER_NO_NODE;
+	node->name_offset = w->names_size;
+	node->name_len    = stored_len;
+	node->root        = root;
+	memcpy( w->names + w->names_size, name, name_len );
+
+	// ... sub-directories inherit the depth-limit of their parent, one level less ...
+	if( parent == FSWATCHER_NO_NODE )
+		node->depth_left = w->max_depth == 0 ? FSWATCHER_DEPTH_ALL : w->max_depth - 1;
+	else
 	{
-		char read_buffer[4096];
-		ssize_t read_bytes = read( watcher->notifierfd, read_buffer, sizeof( read_buffer ) );
-		if( read_bytes <= 0 )
-			break;
+		uint32_t parent_left = w->nodes[parent].depth_left;
+		node->depth_left = parent_left == FSWATCHER_DEPTH_ALL ? FSWATCHER_DEPTH_ALL : ( parent_left > 0 ? parent_left - 1 : 0 );
+	}
+	if( add_sep )
+		w->names[w->names_size + name_len] = '/';
+	w->names_size += stored_len;
 
-		for( char* bufp = read_buffer; bufp < read_buffer + read_bytes; )
-		{
-			inotify_event* ev = (inotify_event*)bufp;
-			bool is_dir       = ( ev->mask & IN_ISDIR );
-			bool is_create    = ( ev->mask & IN_CREATE );
-			bool is_remove    = ( ev->mask & IN_DELETE );
-			bool is_modify    = ( ev->mask & IN_MODIFY );
-			bool is_move_from = ( ev->mask & IN_MOVED_FROM );
-			bool is_move_to   = ( ev->mask & IN_MOVED_TO );
-			bool is_del_self  = ( ev->mask & IN_DELETE_SELF );
+	if( parent != FSWATCHER_NO_NODE )
+		fswatcher_link_child( w, node_index );
 
-			if( is_dir )
-			{
-				if( is_create )
-				{
-					char* src = fswatcher_build_full_path( watcher, allocator, ev->wd, ev->name, ev->len );
-					fswatcher_add( watcher, src );
-					FS_MAKE_CALLBACK( FSWATCHER_EVENT_CREATE, src, 0x0 );
-					fswatcher_free( allocator, src );
-				}
-				else if( is_remove )
-					fswatcher_make_callback_with_src_path( watcher, handler, FSWATCHER_EVENT_REMOVE, ev );
-				else if( is_del_self )
-					fswatcher_remove( watcher, ev->wd );
-			}
-			else if( ev->mask & IN_Q_OVERFLOW )
-			{
-				FS_MAKE_CALLBACK( FSWATCHER_EVENT_BUFFER_OVERFLOW, 0x0, 0x0 );
-			}
-			else
-			{
-				if( is_create )
-					fswatcher_make_callback_with_src_path( watcher, handler, FSWATCHER_EVENT_CREATE, ev );
-				else if( is_remove )
-					fswatcher_make_callback_with_src_path( watcher, handler, FSWATCHER_EVENT_REMOVE, ev );
-				else if( is_modify )
-					fswatcher_make_callback_with_src_path( watcher, handler, FSWATCHER_EVENT_MODIFY, ev );
-				else if( is_move_from )
-				{
-					if( move_src != 0x0 )
-					{
-						// ... this is a new pair of a move, so the last one was move "outside" the current watch ...
-						FS_MAKE_CALLBACK( FSWATCHER_EVENT_MOVE, move_src, 0x0 );
-						fswatcher_free( allocator, move_src );
-					}
+	fswatcher_insert_wd( w->watches, w->watches_cap, wd, node_index );
+	++w->watches_cnt;
+	fswatcher_child_index_insert( w, w->children_index, w->children_index_cap, node_index );
+	++w->children_index_cnt;
+	return node_index;
+}
 
-					// ... this is the first potential pair of a move ...
-					move_src = fswatcher_build_full_path( watcher, allocator, ev->wd, ev->name, ev->len );
-					move_cookie = ev->cookie;
-				}
-				else if( is_move_to )
-				{
-					if( move_src && move_cookie == ev->cookie )
-					{
-						// ... this is the dst for a move ...
-						char* dst = fswatcher_build_full_path( watcher, allocator, ev->wd, ev->name, ev->len );
-						FS_MAKE_CALLBACK( FSWATCHER_EVENT_MOVE, move_src, dst );
-						fswatcher_free( watcher->allocator, dst );
-						fswatcher_free( watcher->allocator, move_src );
-						move_src = 0x0;
-						move_cookie = 0;
-					}
-					else if( move_src != 0x0 )
-					{
-						// ... this is a "move to outside of watch" ...
-						FS_MAKE_CALLBACK( FSWATCHER_EVENT_MOVE, move_src, 0x0 );
-						fswatcher_free( watcher->allocator, move_src );
-						move_src = 0x0;
-						move_cookie = 0;
-
-						// ...followed by a "move from outside to watch ...
-						fswatcher_make_callback_with_dst_path( watcher, handler, FSWATCHER_EVENT_MOVE, ev );
-					}
-					else
+/**
+ * Move directory-node to a new parent and name, all directories below it follow as their paths are built from the
+ * parents.
+ *
+ * @return false if the new name could not be stored, the node is left as is.
+ */
+static bool fswatcher_move_node( fswatcher_t w, uint32_t node_index, uint32_t parent, const char* name, size_t name_len )
+{
+	fswatcher_node* node = &w->nodes[node_index];
+	if( node->parent == parent && node->name_len == name_len + 1 && memcmp( w->names + node->name_offset, name, name_len ) == 0 )
+		return true; // ... already moved, the event was retried ...
+
+	if( !fswatcher_reserve_names( w, (uint32_t)name_len + 1 ) )
+		return false;
+
+	fswatcher_child_index_erase( w, node_index );
+	fswatcher_unlink_child( w, node_index );
+
+	w->names_garbage += node->name_len;
+	node->parent      = parent;
+	node->name_offset = w->names_size;
+	node->name_len    = (uint32_t)name_len + 1;
+	memcpy( w->names + w->names_size, name, name_len );
+	w->names[w->names_size + name_len] = '/';
+	w->names_size += (uint32_t)name_len + 1;
+
+	fswatcher_link_child( w, node_index );
+	fswatcher_child_index_insert( w, w->children_index, w->children_index_cap, node_index );
+	return true;
+}
+
+static void fswatcher_count_add_watch_failure( fswatcher_t w, int err )
+{
+	uint64_t* bucket;
+	switch( err )
+	{
+		case ENOSPC:
+		case ENOMEM:  bucket = &w->stats.add_watch_failures_limit;  break;
+		case EACCES:
+		case EPERM:   bucket = &w->stats.add_watch_failures_access; break;
+		case ENOENT:
+		case ENOTDIR: bucket = &w->stats.add_watch_failures_gone;   break;
+		default:      bucket = &w->stats.add_watch_failures_other;  break;
+	}
+	__atomic_fetch_add( bucket, 1, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &w->stats.add_watch_failures, 1, __ATOMIC_RELAXED );
+}
+
+/**
+ * Remove watch wd that could not be added to the directory-tree as it is out of memory, without a node the events for
+ * it could not be reported anyway.
+ */
+static void fswatcher_drop_watch( fswatcher_t w, int wd )
+{
+	if( w->backend == FSWATCHER_BACKEND_INOTIFY )
+		inotify_rm_watch( w->notifierfd, wd );
+	fswatcher_count_add_watch_failure( w, ENOMEM );
+}
+
+static int fswatcher_add_watch( fswatcher_t w, const char* path )
+{
+	if( w->backend == FSWATCHER_BACKEND_POLL )
+	{
+		// ... nothing to register with the os, only check that it is still a directory ...
+		struct stat st;
+		int err = stat( path, &st ) != 0 ? errno : ( S_ISDIR( st.st_mode ) ? 0 : ENOTDIR );
+		if( err != 0 )
+		{
+			fswatcher_count_add_watch_failure( w, err );
+			return -1;
+		}
+		return __atomic_add_fetch( &w->poll_next_wd, 1, __ATOMIC_RELAXED );
+	}
+
+	int wd = inotify_add_watch( w->notifierfd, path, w->watch_flags );
+	if( wd < 0 )
+		fswatcher_count_add_watch_failure( w, errno );
+	return wd;
+}
+
+/**
+ * Add watch for directory at path and add it to the directory-tree as a child to parent with the name-component name.
+ *
+ * @param added set to true if a new node was added, false if the directory was already watched or is below the
+ *              depth-limit of parent.
+ */
+static uint32_t fswatcher_add( fswatcher_t w, uint32_t parent, uint32_t root, const char* path, const char* name, size_t name_len, bool* added )
+{
+	*added = false;
+	if( parent != FSWATCHER_NO_NODE && w->nodes[parent].depth_left == 0 )
+		return FSWATCHER_NO_NODE;
+
+	int wd = fswatcher_add_watch( w, path );
+	if( wd < 0 )
+		return FSWATCHER_NO_NODE;
+
+	// ... the same directory reached via a symlink will give back an already registered wd, keep the first path ...
+	fswatcher_item* item = fswatcher_find_wd( w, wd );
+	if( item != 0x0 )
+		return item->node;
+
+	uint32_t node = fswatcher_insert_node( w, parent, root, wd, name, name_len );
+	if( node == FSWATCHER_NO_NODE )
+		fswatcher_drop_watch( w, wd );
+	*added = node != FSWATCHER_NO_NODE;
+	return node;
+}
+
+/**
+ * Length of the full path of a directory-node, including trailing '/'.
+ */
+static size_t fswatcher_node_path_len( fswatcher_t w, uint32_t node_index )
+{
+	size_t len = 0;
+	for( ; node_index != FSWATCHER_NO_NODE; node_index = w->nodes[node_index].parent )
+		len += w->nodes[node_index].name_len;
+	return len;
+}
+
+/**
+ * Write full path of a directory-node back to front ending at end, the path is built by walking up the tree.
+ */
+static void fswatcher_write_node_path( fswatcher_t w, uint32_t node_index, char* end )
+{
+	for( ; node_index != FSWATCHER_NO_NODE; node_index = w->nodes[node_index].parent )
+	{
+		fswatcher_node* node = &w->nodes[node_index];
+		end -= node->name_len;
+		memcpy( end, w->names + node->name_offset, node->name_len );
+	}
+}
+
+static void fswatcher_remove( fswatcher_t w, int wd )
+{
+	fswatcher_item* item = fswatcher_find_wd( w, wd );
+	if( item == 0x0 )
+		return;
+
+	uint32_t node_index = item->node;
+	fswatcher_erase_wd( w, item );
+	w->nodes[node_index].wd = 0;
+	fswatcher_snap_clear( w, node_index );
+	fswatcher_release_node( w, node_index );
+}
+
+static bool fswatcher_in_subtree( fswatcher_t w, uint32_t node, uint32_t top )
+{
+	for( ; node != FSWATCHER_NO_NODE; node = w->nodes[node].parent )
+		if( node == top )
+			return true;
+	return false;
+}
+
+/**
+ * Remove watches for directory-node top and all directories below it and release their nodes.
+ */
+static void fswatcher_remove_subtree( fswatcher_t w, uint32_t top )
+{
+	// ... remove all watches first, walking the subtree in pre-order through the child-lists ...
+	uint32_t i = top;
+	while( true )
+	{
+		fswatcher_node* node = &w->nodes[i];
+		if( node->wd > 0 )
+		{
+			if( w->backend == FSWATCHER_BACKEND_INOTIFY )
+				inotify_rm_watch( w->notifierfd, node->wd );
+			fswatcher_erase_wd( w, fswatcher_find_wd( w, node->wd ) );
+			node->wd = 0;
+			fswatcher_snap_clear( w, i );
+		}
+
+		if( node->first_child != FSWATCHER_NO_NODE )
+		{
+			i = node->first_child;
+			continue;
+		}
+		while( i != top && w->nodes[i].next_sibling == FSWATCHER_NO_NODE )
+			i = w->nodes[i].parent;
+		if( i == top )
+			break;
+		i = w->nodes[i].next_sibling;
+	}
+
+	// ... then release the nodes leaf first. Releasing the last child of a node cascades to the node itself so continue
+	// from the closest ancestor that is left with children ...
+	i = top;
+	while( true )
+	{
+		while( w->nodes[i].first_child != FSWATCHER_NO_NODE )
+			i = w->nodes[i].first_child;
+		if( i == top )
+		{
+			fswatcher_release_node( w, top );
+			break;
+		}
+
+		uint32_t next = w->nodes[i].parent;
+		while( next != top && w->nodes[next].children == 1 )
+			next = w->nodes[next].parent;
+		bool last = next == top && w->nodes[top].children == 1;
+		fswatcher_release_node( w, i );
+		if( last )
+			break;
+		i = next;
+	}
+}
+
+static uint32_t fswatcher_recursive_add( fswatcher_t w, uint32_t parent, uint32_t root, char* path_buffer, size_t name_start, size_t path_len, size_t path_max );
+
+/**
+ * Check if entry ent read from dirp is a directory that should be watched, symlinks to directories are followed
+ * except by the poll backend.
+ */
+static bool fswatcher_entry_is_dir( fswatcher_t w, DIR* dirp, const dirent* ent )
+{
+	if( ent->d_type == DT_DIR )
+		return true;
+	if( ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN )
+		return false;
+
+	// ... the poll backend has no watch descriptors to detect symlink-loops with, so links are never followed ...
+	struct stat statbuf;
+	return fstatat( dirfd( dirp ), ent->d_name, &statbuf, w->backend == FSWATCHER_BACKEND_POLL ? AT_SYMLINK_NOFOLLOW : 0 ) == 0 && S_ISDIR( statbuf.st_mode );
+}
+
+/**
+ * Add all sub-directories of the watched directory-node at path_buffer, down to the depth-limit of node. Sub-directories
+ * that are already watched get their depth-limit raised to that of node and are crawled again if it was.
+ */
+static void fswatcher_add_children( fswatcher_t w, uint32_t node, char* path_buffer, size_t path_len, size_t path_max )
+{
+	uint32_t depth_left = w->nodes[node].depth_left;
+	if( depth_left == 0 )
+		return;
+	uint32_t child_left = depth_left == FSWATCHER_DEPTH_ALL ? FSWATCHER_DEPTH_ALL : depth_left - 1;
+
+	DIR* dirp = opendir( path_buffer );
+	if( dirp == 0x0 )
+		return;
+	__atomic_fetch_add( &w->crawl_dirs_scanned, 1, __ATOMIC_RELAXED );
+
+	dirent* ent;
+	while( ( ent = readdir( dirp ) ) != 0x0 )
+	{
+		if( ( ent->d_type != DT_DIR && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN ) )
+			continue;
+
+		if( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+			continue;
+
+		size_t d_name_size = strlen( ent->d_name );
+		if( fswatcher_filtered( w, ent->d_name, d_name_size, true ) )
+			continue;
+		if( path_len + d_name_size + 2 >= path_max )
+		{
+			fswatcher_count_add_watch_failure( w, ENAMETOOLONG );
+			continue;
+		}
+
+		strcpy( path_buffer + path_len, ent->d_name );
+		path_buffer[ path_len + d_name_size ] = '/';
+		path_buffer[ path_len + d_name_size + 1 ] = '\0';
+
+		if( !fswatcher_entry_is_dir( w, dirp, ent ) )
+			continue;
+
+		uint32_t child = fswatcher_find_child( w, node, ent->d_name, (uint32_t)d_name_size );
+		if( child == FSWATCHER_NO_NODE )
+			fswatcher_recursive_add( w, node, w->nodes[node].root, path_buffer, path_len, path_len + d_name_size + 1, path_max );
+		else if( w->nodes[child].wd > 0 && w->nodes[child].depth_left < child_left )
+		{
+			w->nodes[child].depth_left = child_left;
+			fswatcher_add_children( w, child, path_buffer, path_len + d_name_size + 1, path_max );
+		}
+	}
+	path_buffer[path_len] = '\0';
+
+	closedir( dirp );
+}
+
+/**
+ * Add directory at path_buffer and all its sub-directories, down to the depth-limit.
+ *
+ * @return node of added directory or FSWATCHER_NO_NODE if it failed or was already watched.
+ */
+static uint32_t fswatcher_recursive_add( fswatcher_t w, uint32_t parent, uint32_t root, char* path_buffer, size_t name_start, size_t path_len, size_t path_max )
+{
+	bool added;
+	uint32_t node = fswatcher_add( w, parent, root, path_buffer, path_buffer + name_start, path_len - name_start, &added );
+	if( !added )
+		return FSWATCHER_NO_NODE; // ... failed, already watched, i.e. a symlink-loop, or below the depth-limit ...
+	__atomic_fetch_add( &w->crawl_watches_added, 1, __ATOMIC_RELAXED );
+
+	fswatcher_add_children( w, node, path_buffer, path_len, path_max );
+	return node;
+}
+
+/**
+ * Work-stealing crawl used when fswatcher_create_params::crawl_threads > 1. Each worker owns a deque of directory-nodes
+ * to scan, it pushes and pops sub-directories at the back, depth first, and steals from the front of other workers
+ * deques when its own is empty. readdir(), stat() and inotify_add_watch() are done without holding the lock, the
+ * lock is only held while the directory-tree, and with that the user allocator, is touched.
+ */
+struct fswatcher_crawl_queue
+{
+	uint32_t* items;
+	size_t    head;
+	size_t    count;
+	size_t    cap;
+};
+
+struct fswatcher_crawl
+{
+	fswatcher_t      w;
+	pthread_mutex_t  own_lock;
+	pthread_mutex_t* lock;     ///< own_lock or fswatcher::tree_lock when the crawl runs next to polls.
+	pthread_cond_t   cond;
+
+	unsigned int           workers;
+	fswatcher_crawl_queue* queues;
+	size_t                 pending; ///< number of nodes queued or being scanned.
+};
+
+struct fswatcher_crawl_worker
+{
+	fswatcher_crawl* crawl;
+	unsigned int     index;
+	pthread_t        thread;
+	bool             started;
+};
+
+static bool fswatcher_crawl_push( fswatcher_crawl* crawl, fswatcher_crawl_queue* q, uint32_t node )
+{
+	if( q->count == q->cap )
+	{
+		size_t new_cap = q->cap ? q->cap * 2 : 64;
+		uint32_t* items = (uint32_t*)fswatcher_realloc( crawl->w->allocator, 0x0, 0, sizeof( uint32_t ) * new_cap );
+		if( items == 0x0 )
+			return false;
+		for( size_t i = 0; i < q->count; ++i )
+			items[i] = q->items[( q->head + i ) % q->cap];
+		fswatcher_free( crawl->w->allocator, q->items );
+		q->items = items;
+		q->head  = 0;
+		q->cap   = new_cap;
+	}
+	q->items[( q->head + q->count ) % q->cap] = node;
+	++q->count;
+	++crawl->pending;
+	return true;
+}
+
+/**
+ * Pop work for worker, from the back of its own queue or the front of another workers queue. Called with lock held.
+ */
+static uint32_t fswatcher_crawl_pop( fswatcher_crawl* crawl, unsigned int worker )
+{
+	fswatcher_crawl_queue* own = &crawl->queues[worker];
+	if( own->count > 0 )
+	{
+		--own->count;
+		return own->items[( own->head + own->count ) % own->cap];
+	}
+
+	for( unsigned int i = 1; i < crawl->workers; ++i )
+	{
+		fswatcher_crawl_queue* victim = &crawl->queues[( worker + i ) % crawl->workers];
+		if( victim->count == 0 )
+			continue;
+		uint32_t node = victim->items[victim->head];
+		victim->head = ( victim->head + 1 ) % victim->cap;
+		--victim->count;
+		return node;
+	}
+	return FSWATCHER_NO_NODE;
+}
+
+static void fswatcher_crawl_scan( fswatcher_crawl* crawl, unsigned int worker, uint32_t dir_node )
+{
+	fswatcher_t w = crawl->w;
+	char path_buffer[4096];
+
+	// ... with an async crawl the node might have been removed by a poll since it was queued ...
+	pthread_mutex_lock( crawl->lock );
+	bool scan = w->nodes[dir_node].wd > 0 && w->nodes[dir_node].depth_left > 0 && !__atomic_load_n( &w->crawl_cancel, __ATOMIC_RELAXED );
+	size_t path_len = scan ? fswatcher_node_path_len( w, dir_node ) : 0;
+	bool fits = scan && path_len < sizeof( path_buffer );
+	if( fits )
+	{
+		fswatcher_write_node_path( w, dir_node, path_buffer + path_len );
+		path_buffer[path_len] = '\0';
+	}
+	pthread_mutex_unlock( crawl->lock );
+
+	if( !fits )
+		return;
+
+	DIR* dirp = opendir( path_buffer );
+	if( dirp == 0x0 )
+		return;
+	__atomic_fetch_add( &w->crawl_dirs_scanned, 1, __ATOMIC_RELAXED );
+
+	dirent* ent;
+	while( ( ent = readdir( dirp ) ) != 0x0 )
+	{
+		if( ( ent->d_type != DT_DIR && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN ) )
+			continue;
+
+		if( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+			continue;
+
+		size_t d_name_size = strlen( ent->d_name );
+		if( fswatcher_filtered( w, ent->d_name, d_name_size, true ) )
+			continue;
+		if( path_len + d_name_size + 2 >= sizeof( path_buffer ) )
+		{
+			fswatcher_count_add_watch_failure( w, ENAMETOOLONG );
+			continue;
+		}
+
+		memcpy( path_buffer + path_len, ent->d_name, d_name_size + 1 );
+
+		if( !fswatcher_entry_is_dir( w, dirp, ent ) )
+			continue;
+
+		int wd = fswatcher_add_watch( w, path_buffer );
+		if( wd < 0 )
+			continue;
+
+		pthread_mutex_lock( crawl->lock );
+		uint32_t node = FSWATCHER_NO_NODE;
+		bool queued = true;
+		if( fswatcher_find_wd( w, wd ) == 0x0 )
+		{
+			node = fswatcher_insert_node( w, dir_node, w->nodes[dir_node].root, wd, ent->d_name, d_name_size );
+			if( node == FSWATCHER_NO_NODE )
+				fswatcher_drop_watch( w, wd );
+			else
+			{
+				__atomic_fetch_add( &w->crawl_watches_added, 1, __ATOMIC_RELAXED );
+				queued = fswatcher_crawl_push( crawl, &crawl->queues[worker], node );
+				if( queued )
+					pthread_cond_signal( &crawl->cond );
+			}
+		}
+		pthread_mutex_unlock( crawl->lock );
+
+		// ... out of memory to queue it, scan it right away rather than leaving the subtree unwatched ...
+		if( !queued )
+			fswatcher_crawl_scan( crawl, worker, node );
+	}
+	closedir( dirp );
+}
+
+static void* fswatcher_crawl_worker_main( void* arg )
+{
+	fswatcher_crawl_worker* worker = (fswatcher_crawl_worker*)arg;
+	fswatcher_crawl* crawl = worker->crawl;
+
+	pthread_mutex_lock( crawl->lock );
+	while( true )
+	{
+		uint32_t node = fswatcher_crawl_pop( crawl, worker->index );
+		if( node != FSWATCHER_NO_NODE )
+		{
+			pthread_mutex_unlock( crawl->lock );
+			fswatcher_crawl_scan( crawl, worker->index, node );
+			pthread_mutex_lock( crawl->lock );
+			if( --crawl->pending == 0 )
+				pthread_cond_broadcast( &crawl->cond );
+			continue;
+		}
+
+		if( crawl->pending == 0 )
+			break;
+		pthread_cond_wait( &crawl->cond, crawl->lock );
+	}
+	pthread_mutex_unlock( crawl->lock );
+	return 0x0;
+}
+
+/**
+ * Crawl all directories below root with thread_count threads, the calling thread is one of them.
+ *
+ * @param tree_lock lock to hold while touching the directory-tree, 0x0 if nothing else touches it during the crawl.
+ */
+static void fswatcher_parallel_add( fswatcher_t w, uint32_t root, unsigned int thread_count, pthread_mutex_t* tree_lock )
+{
+	fswatcher_crawl crawl;
+	memset( &crawl, 0x0, sizeof( crawl ) );
+	crawl.w       = w;
+	crawl.lock    = tree_lock ? tree_lock : &crawl.own_lock;
+	crawl.workers = thread_count;
+	crawl.queues  = (fswatcher_crawl_queue*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( fswatcher_crawl_queue ) * thread_count );
+	fswatcher_crawl_worker* workers = (fswatcher_crawl_worker*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( fswatcher_crawl_worker ) * thread_count );
+	if( crawl.queues == 0x0 || workers == 0x0 )
+	{
+		fswatcher_free( w->allocator, crawl.queues );
+		fswatcher_free( w->allocator, workers );
+		return;
+	}
+	memset( crawl.queues, 0x0, sizeof( fswatcher_crawl_queue ) * thread_count );
+	pthread_mutex_init( &crawl.own_lock, 0x0 );
+	pthread_cond_init( &crawl.cond, 0x0 );
+
+	fswatcher_crawl_push( &crawl, &crawl.queues[0], root );
+
+	// ... if a thread fails to start its share of the work is stolen by the others ...
+	for( unsigned int i = 0; i < thread_count; ++i )
+	{
+		workers[i].crawl   = &crawl;
+		workers[i].index   = i;
+		workers[i].started = i > 0 && pthread_create( &workers[i].thread, 0x0, fswatcher_crawl_worker_main, &workers[i] ) == 0;
+	}
+
+	fswatcher_crawl_worker_main( &workers[0] );
+
+	for( unsigned int i = 1; i < thread_count; ++i )
+		if( workers[i].started )
+			pthread_join( workers[i].thread, 0x0 );
+
+	pthread_cond_destroy( &crawl.cond );
+	pthread_mutex_destroy( &crawl.own_lock );
+	for( unsigned int i = 0; i < thread_count; ++i )
+		fswatcher_free( w->allocator, crawl.queues[i].items );
+	fswatcher_free( w->allocator, crawl.queues );
+	fswatcher_free( w->allocator, workers );
+}
+
+/**
+ * Crawl of root 0 with FSWATCHER_CREATE_ASYNC_CRAWL, the work done by fswatcher_create_ex() after the crawl is done
+ * here once it is.
+ */
+static void* fswatcher_async_crawl_main( void* arg )
+{
+	fswatcher_t w = (fswatcher_t)arg;
+	pthread_mutex_lock( &w->tree_lock );
+	uint32_t root_node = w->roots[0].node;
+	pthread_mutex_unlock( &w->tree_lock );
+	fswatcher_parallel_add( w, root_node, w->crawl_threads > 1 ? w->crawl_threads : 1, &w->tree_lock );
+
+	pthread_mutex_lock( &w->tree_lock );
+	if( !__atomic_load_n( &w->crawl_cancel, __ATOMIC_RELAXED ) )
+	{
+		if( w->snapshot )
+			fswatcher_snap_build( w, 0 );
+		if( w->snapshot_file )
+			fswatcher_persist_load( w );
+		w->persist_ready = true;
+	}
+	pthread_mutex_unlock( &w->tree_lock );
+
+	__atomic_store_n( &w->crawl_done, true, __ATOMIC_RELEASE );
+	return 0x0;
+}
+
+static bool fswatcher_fan_init( fswatcher_t w, fswatcher_event_type types );
+static bool fswatcher_start_reader( fswatcher_t watcher, size_t ring_size );
+static void fswatcher_stop_reader( fswatcher_t watcher );
+static bool fswatcher_fan_add_root( fswatcher_t w, fswatcher_root* root, const char* watch_dir );
+static void fswatcher_fan_remove_root( fswatcher_t w, fswatcher_root* root );
+
+fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type types, const char* watch_dir, fswatcher_allocator* allocator )
+{
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags     = flags;
+	params.types     = types;
+	params.watch_dir = watch_dir;
+	params.allocator = allocator;
+	return fswatcher_create_ex( &params );
+}
+
+fswatcher_t fswatcher_create_ex( const fswatcher_create_params* params )
+{
+	fswatcher_create_flags flags = params->flags;
+	fswatcher_event_type   types = params->types;
+	const char*        watch_dir = params->watch_dir;
+	fswatcher_allocator* allocator = params->allocator;
+
+	if( allocator == 0x0 )
+		allocator = &g_fswatcher_default_alloc;
+
+	fswatcher* w = (fswatcher*)fswatcher_realloc( allocator, 0x0, 0, sizeof( fswatcher ) );
+	memset( w, 0x0, sizeof( fswatcher ) );
+	w->allocator = allocator;
+	pthread_mutex_init( &w->tree_lock, 0x0 );
+	w->watch_flags = 0;
+
+	if( types & FSWATCHER_EVENT_CREATE ) w->watch_flags |= IN_CREATE;
+	if( types & FSWATCHER_EVENT_REMOVE ) w->watch_flags |= IN_DELETE;
+	w->watch_flags |= IN_MOVE;
+	if( types & FSWATCHER_EVENT_MODIFY ) w->watch_flags |= IN_MODIFY;
+	if( types & FSWATCHER_EVENT_WRITE_DONE ) w->watch_flags |= IN_CLOSE_WRITE;
+	w->watch_flags |= IN_DELETE_SELF;
+	w->report_moves  = ( types & FSWATCHER_EVENT_MOVE ) != 0;
+	w->move_src_node = FSWATCHER_NO_NODE;
+	w->types         = types;
+
+	// ... the fd is always non-blocking, blocking polls wait for it to be readable before reading so that a poll can
+	//     return after the queue has been drained ...
+	w->blocking = ( flags & FSWATCHER_CREATE_BLOCKING ) != 0;
+	w->coalesce = ( flags & FSWATCHER_CREATE_COALESCE ) != 0;
+	w->snapshot = ( ( flags & FSWATCHER_CREATE_SNAPSHOT ) != 0 || params->snapshot_file != 0x0 ) && params->backend != FSWATCHER_BACKEND_FANOTIFY;
+	w->coalescer.sink.emit = fswatcher_coalesce_emit;
+	w->coalescer.watcher   = w;
+	w->coalescer.quiet_ms  = params->coalesce_ms ? params->coalesce_ms : 100;
+	w->settler.settle_ms   = params->write_settle_ms;
+	w->content_hash        = ( flags & FSWATCHER_CREATE_CONTENT_HASH ) != 0;
+	w->backend       = params->backend == FSWATCHER_BACKEND_DEFAULT ? FSWATCHER_BACKEND_INOTIFY : params->backend;
+	w->notifierfd    = -1;
+	w->wakeupfd      = -1;
+	w->crawl_threads = params->crawl_threads;
+	w->max_depth     = params->max_depth;
+	w->async_crawl   = ( flags & FSWATCHER_CREATE_ASYNC_CRAWL ) != 0 && params->backend != FSWATCHER_BACKEND_FANOTIFY;
+	w->reader_stopfd = -1;
+	w->ring_datafd   = -1;
+	w->ring_spacefd  = -1;
+	w->uring.fd      = -1;
+
+	// ... the poll backend finds changes by diffing a snapshot ...
+	if( w->backend == FSWATCHER_BACKEND_POLL )
+		w->snapshot = true;
+
+	if( !fswatcher_filter_compile( allocator, &w->exclude, params->exclude, params->exclude_cnt ) ||
+	    !fswatcher_filter_compile( allocator, &w->include, params->include, params->include_cnt ) )
+	{
+		fswatcher_destroy( w );
+		return 0x0;
+	}
+
+	w->read_fionread   = ( flags & FSWATCHER_CREATE_FIONREAD_BUFFER ) != 0;
+	w->read_buffer_cap = params->read_buffer_size > FSWATCHER_READ_BUFFER_MIN ? params->read_buffer_size : FSWATCHER_READ_BUFFER_MIN;
+	w->read_buffer     = (char*)fswatcher_realloc( allocator, 0x0, 0, w->read_buffer_cap );
+	if( w->read_buffer == 0x0 )
+	{
+		fswatcher_destroy( w );
+		return 0x0;
+	}
+
+	w->wakeupfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	if( w->wakeupfd < 0 )
+	{
+		fswatcher_destroy( w );
+		return 0x0;
+	}
+
+	switch( w->backend )
+	{
+		case FSWATCHER_BACKEND_FANOTIFY:
+			if( !fswatcher_fan_init( w, types ) )
+			{
+				fswatcher_destroy( w );
+				return 0x0;
+			}
+			break;
+		case FSWATCHER_BACKEND_INOTIFY:
+		case FSWATCHER_BACKEND_POLL:
+			if( w->backend == FSWATCHER_BACKEND_POLL )
+			{
+				unsigned int interval_ms = params->poll_interval_ms ? params->poll_interval_ms : 1000;
+				itimerspec interval;
+				interval.it_interval.tv_sec  = interval_ms / 1000;
+				interval.it_interval.tv_nsec = ( interval_ms % 1000 ) * 1000000L;
+				interval.it_value = interval.it_interval;
+				w->notifierfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+				if( w->notifierfd >= 0 && timerfd_settime( w->notifierfd, 0, &interval, 0x0 ) != 0 )
+				{
+					close( w->notifierfd );
+					w->notifierfd = -1;
+				}
+			}
+			else
+				w->notifierfd = inotify_init1( IN_NONBLOCK );
+			if( w->notifierfd < 0 )
+			{
+				fswatcher_destroy( w );
+				return 0x0;
+			}
+
+			w->watches_cap = 16; // 256;
+			w->watches = (fswatcher_item*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof(fswatcher_item) * w->watches_cap );
+			memset( w->watches, 0x0, sizeof(fswatcher_item) * w->watches_cap );
+
+			w->nodes_cap  = 16;
+			w->nodes_free = FSWATCHER_NO_NODE;
+			w->nodes = (fswatcher_node*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof(fswatcher_node) * w->nodes_cap );
+
+			w->names_cap = 256;
+			w->names = (char*)fswatcher_realloc( w->allocator, 0x0, 0, w->names_cap );
+			break;
+		default:
+			fswatcher_destroy( w );
+			return 0x0;
+	}
+
+	if( w->snapshot && params->snapshot_file != 0x0 )
+	{
+		size_t len = strlen( params->snapshot_file ) + 1;
+		w->snapshot_file = (char*)fswatcher_realloc( w->allocator, 0x0, 0, len );
+		if( w->snapshot_file == 0x0 )
+		{
+			fswatcher_destroy( w );
+			return 0x0;
+		}
+		memcpy( w->snapshot_file, params->snapshot_file, len );
+	}
+
+	// ... the first root always get id 0 ...
+	if( fswatcher_add_root( w, watch_dir ) == FSWATCHER_NO_ROOT )
+	{
+		fswatcher_destroy( w );
+		return 0x0;
+	}
+
+	// ... changes since the snapshot-file was saved are queued and delivered by the first poll, with an async crawl
+	//     once it is done ...
+	if( w->snapshot_file != 0x0 && !w->async_crawl )
+		fswatcher_persist_load( w );
+
+	if( ( flags & FSWATCHER_CREATE_READER_THREAD ) && w->backend != FSWATCHER_BACKEND_POLL && !fswatcher_start_reader( w, params->reader_ring_size ? params->reader_ring_size : 4 * 1024 * 1024 ) )
+	{
+		fswatcher_destroy( w );
+		return 0x0;
+	}
+	if( !w->async_crawl )
+		w->persist_ready = true;
+	return w;
+}
+
+/**
+ * Copy path to path_buffer with a trailing '/'.
+ */
+static size_t fswatcher_dir_path( const char* path, char* path_buffer, size_t path_max )
+{
+	size_t path_len = strlen( path );
+	if( path_len == 0 || path_len + 2 > path_max )
+		return 0;
+	memcpy( path_buffer, path, path_len + 1 );
+	if( path_buffer[path_len - 1] != '/' )
+	{
+		path_buffer[path_len]     = '/';
+		path_buffer[path_len + 1] = '\0';
+		++path_len;
+	}
+	return path_len;
+}
+
+static bool fswatcher_inotify_add_root( fswatcher_t w, uint32_t root_id, const char* watch_dir )
+{
+	char path_buffer[4096];
+	size_t path_len = fswatcher_dir_path( watch_dir, path_buffer, sizeof( path_buffer ) );
+	if( path_len == 0 )
+		return false;
+
+	// ... the root dir must not already be watched by another root, sub-directories that are stay with that root ...
+	uint32_t node;
+	bool async = w->async_crawl && root_id == 0 && !w->crawl_started;
+	if( w->crawl_threads > 1 || async )
+	{
+		bool added;
+		node = fswatcher_add( w, FSWATCHER_NO_NODE, root_id, path_buffer, path_buffer, path_len, &added );
+		if( added )
+		{
+			__atomic_fetch_add( &w->crawl_watches_added, 1, __ATOMIC_RELAXED );
+			w->roots[root_id].node = node;
+
+			// ... the crawl waits for tree_lock, held by fswatcher_add_root(), so it sees the root ...
+			if( async )
+				w->crawl_started = pthread_create( &w->crawl_thread, 0x0, fswatcher_async_crawl_main, w ) == 0;
+			if( !w->crawl_started )
+			{
+				w->async_crawl = false;
+				fswatcher_parallel_add( w, node, w->crawl_threads > 1 ? w->crawl_threads : 1, 0x0 );
+			}
+		}
+		else
+			node = FSWATCHER_NO_NODE;
+	}
+	else
+		node = fswatcher_recursive_add( w, FSWATCHER_NO_NODE, root_id, path_buffer, 0, path_len, sizeof( path_buffer ) );
+
+	w->roots[root_id].node = node;
+	return node != FSWATCHER_NO_NODE;
+}
+
+static void fswatcher_inotify_remove_root( fswatcher_t w, uint32_t root_id )
+{
+	if( w->roots[root_id].node != FSWATCHER_NO_NODE )
+		fswatcher_remove_subtree( w, w->roots[root_id].node );
+}
+
+static bool fswatcher_remove_root_locked( fswatcher_t watcher, uint32_t root );
+
+static uint32_t fswatcher_add_root_locked( fswatcher_t watcher, const char* watch_dir )
+{
+	uint32_t id = 0;
+	while( id < watcher->roots_cnt && watcher->roots[id].used )
+		++id;
+
+	if( id == watcher->roots_cnt )
+	{
+		if( watcher->roots_cnt == watcher->roots_cap )
+		{
+			uint32_t new_cap = watcher->roots_cap ? watcher->roots_cap * 2 : 4;
+			fswatcher_root* roots = (fswatcher_root*)fswatcher_realloc( watcher->allocator, watcher->roots, sizeof( fswatcher_root ) * watcher->roots_cap, sizeof( fswatcher_root ) * new_cap );
+			if( roots == 0x0 )
+				return FSWATCHER_NO_ROOT;
+			watcher->roots = roots;
+			watcher->roots_cap = new_cap;
+		}
+		++watcher->roots_cnt;
+	}
+
+	fswatcher_root* root = &watcher->roots[id];
+	memset( root, 0x0, sizeof( fswatcher_root ) );
+	root->used     = true;
+	root->node     = FSWATCHER_NO_NODE;
+	root->mount_fd = -1;
+
+	bool ok = watcher->backend == FSWATCHER_BACKEND_FANOTIFY ? fswatcher_fan_add_root( watcher, root, watch_dir )
+	                                                        : fswatcher_inotify_add_root( watcher, id, watch_dir );
+	if( !ok )
+	{
+		fswatcher_remove_root_locked( watcher, id );
+		return FSWATCHER_NO_ROOT;
+	}
+	// ... the async crawl builds the snapshot once done ...
+	if( watcher->snapshot && !( watcher->crawl_started && id == 0 ) )
+		fswatcher_snap_build( watcher, id );
+	return id;
+}
+
+uint32_t fswatcher_add_root( fswatcher_t watcher, const char* watch_dir )
+{
+	fswatcher_lock_tree( watcher );
+	uint32_t id = fswatcher_add_root_locked( watcher, watch_dir );
+	fswatcher_unlock_tree( watcher );
+	return id;
+}
+
+static bool fswatcher_remove_root_locked( fswatcher_t watcher, uint32_t root )
+{
+	if( root >= watcher->roots_cnt || !watcher->roots[root].used )
+		return false;
+
+	watcher->roots[root].used = false;
+	if( watcher->backend == FSWATCHER_BACKEND_FANOTIFY )
+		fswatcher_fan_remove_root( watcher, &watcher->roots[root] );
+	else
+		fswatcher_inotify_remove_root( watcher, root );
+
+	// ... events already read for the root are dropped as the root is gone ...
+	if( watcher->move_src_valid && watcher->move_src_root == root )
+	{
+		watcher->move_src_valid = false;
+		watcher->move_src_node  = FSWATCHER_NO_NODE;
+	}
+
+	while( watcher->roots_cnt > 0 && !watcher->roots[watcher->roots_cnt - 1].used )
+		--watcher->roots_cnt;
+	return true;
+}
+
+bool fswatcher_remove_root( fswatcher_t watcher, uint32_t root )
+{
+	fswatcher_lock_tree( watcher );
+	bool res = fswatcher_remove_root_locked( watcher, root );
+	fswatcher_unlock_tree( watcher );
+	return res;
+}
+
+/**
+ * Find the deepest directory-node whose path is path or a parent of path, path must end with '/'.
+ *
+ * @param matched set to the length of the part of path covered by the returned node.
+ *
+ * @return found node or FSWATCHER_NO_NODE if path is not inside any root.
+ */
+static uint32_t fswatcher_find_path_node( fswatcher_t w, const char* path, size_t path_len, size_t* matched )
+{
+	uint32_t node = FSWATCHER_NO_NODE;
+	*matched = 0;
+	for( uint32_t i = 0; i < w->roots_cnt; ++i )
+	{
+		uint32_t root_node = w->roots[i].node;
+		if( !w->roots[i].used || root_node == FSWATCHER_NO_NODE )
+			continue;
+		// ... nested roots, the innermost one owns the path ...
+		uint32_t len = w->nodes[root_node].name_len;
+		if( len <= path_len && len > *matched && memcmp( w->names + w->nodes[root_node].name_offset, path, len ) == 0 )
+		{
+			node     = root_node;
+			*matched = len;
+		}
+	}
+
+	while( node != FSWATCHER_NO_NODE && *matched < path_len )
+	{
+		const char* name = path + *matched;
+		const char* end  = (const char*)memchr( name, '/', path_len - *matched );
+		uint32_t child = fswatcher_find_child( w, node, name, (uint32_t)( end - name ) );
+		if( child == FSWATCHER_NO_NODE )
+			break;
+		node = child;
+		*matched += (size_t)( end - name ) + 1;
+	}
+	return node;
+}
+
+static bool fswatcher_watch_subtree_locked( fswatcher_t watcher, const char* path, unsigned int max_depth )
+{
+	if( watcher->backend == FSWATCHER_BACKEND_FANOTIFY )
+		return false;
+
+	char path_buffer[4096];
+	size_t path_len = fswatcher_dir_path( path, path_buffer, sizeof( path_buffer ) );
+	size_t matched;
+	uint32_t node = path_len > 0 ? fswatcher_find_path_node( watcher, path_buffer, path_len, &matched ) : FSWATCHER_NO_NODE;
+	if( node == FSWATCHER_NO_NODE || watcher->nodes[node].wd <= 0 )
+		return false;
+	uint32_t root = watcher->nodes[node].root;
+
+	// ... all components are checked against the filter before any watch is added so that a filtered path changes
+	//     nothing ...
+	for( size_t start = matched; start < path_len; )
+	{
+		const char* name = path_buffer + start;
+		size_t name_len = (size_t)( (const char*)memchr( name, '/', path_len - start ) - name );
+		if( fswatcher_filtered( watcher, name, name_len, true ) )
+			return false;
+		start += name_len + 1;
+	}
+
+	// ... directories between the closest watched one and path are watched as well, they keep their depth-limit so
+	//     none of their other sub-directories are added. On failure all nodes added here are removed again ...
+	uint32_t first_added = FSWATCHER_NO_NODE;
+	while( matched < path_len )
+	{
+		const char* name = path_buffer + matched;
+		size_t name_len = (size_t)( (const char*)memchr( name, '/', path_len - matched ) - name );
+
+		char next = path_buffer[matched + name_len + 1];
+		path_buffer[matched + name_len + 1] = '\0';
+		int wd = fswatcher_add_watch( watcher, path_buffer );
+		path_buffer[matched + name_len + 1] = next;
+
+		// ... a wd already in the watch-table is the same directory watched at another path, i.e. via a symlink. It
+		//     belongs to that node and is left alone ...
+		uint32_t added = FSWATCHER_NO_NODE;
+		if( wd >= 0 && fswatcher_find_wd( watcher, wd ) == 0x0 )
+		{
+			added = fswatcher_insert_node( watcher, node, root, wd, name, name_len );
+			if( added == FSWATCHER_NO_NODE )
+				fswatcher_drop_watch( watcher, wd );
+		}
+
+		if( added == FSWATCHER_NO_NODE )
+		{
+			if( first_added != FSWATCHER_NO_NODE )
+				fswatcher_remove_subtree( watcher, first_added );
+			return false;
+		}
+		if( first_added == FSWATCHER_NO_NODE )
+			first_added = added;
+		node = added;
+		matched += name_len + 1;
+	}
+
+	uint32_t depth_left = max_depth == 0 ? FSWATCHER_DEPTH_ALL : max_depth - 1;
+	if( watcher->nodes[node].depth_left < depth_left )
+		watcher->nodes[node].depth_left = depth_left;
+	fswatcher_add_children( watcher, node, path_buffer, path_len, sizeof( path_buffer ) );
+
+	if( watcher->snapshot )
+		fswatcher_snap_build( watcher, root );
+	return true;
+}
+
+bool fswatcher_watch_subtree( fswatcher_t watcher, const char* path, unsigned int max_depth )
+{
+	fswatcher_lock_tree( watcher );
+	bool res = fswatcher_watch_subtree_locked( watcher, path, max_depth );
+	fswatcher_unlock_tree( watcher );
+	return res;
+}
+
+static bool fswatcher_unwatch_subtree_locked( fswatcher_t watcher, const char* path )
+{
+	if( watcher->backend == FSWATCHER_BACKEND_FANOTIFY )
+		return false;
+
+	char path_buffer[4096];
+	size_t path_len = fswatcher_dir_path( path, path_buffer, sizeof( path_buffer ) );
+	size_t matched;
+	uint32_t node = path_len > 0 ? fswatcher_find_path_node( watcher, path_buffer, path_len, &matched ) : FSWATCHER_NO_NODE;
+
+	// ... roots are removed with fswatcher_remove_root() ...
+	if( node == FSWATCHER_NO_NODE || matched != path_len || watcher->nodes[node].parent == FSWATCHER_NO_NODE )
+		return false;
+
+	if( watcher->move_src_node != FSWATCHER_NO_NODE && fswatcher_in_subtree( watcher, watcher->move_src_node, node ) )
+		watcher->move_src_node = FSWATCHER_NO_NODE;
+	fswatcher_remove_subtree( watcher, node );
+	return true;
+}
+
+bool fswatcher_unwatch_subtree( fswatcher_t watcher, const char* path )
+{
+	fswatcher_lock_tree( watcher );
+	bool res = fswatcher_unwatch_subtree_locked( watcher, path );
+	fswatcher_unlock_tree( watcher );
+	return res;
+}
+
+void fswatcher_crawl_progress( fswatcher_t watcher, fswatcher_progress* progress )
+{
+	progress->dirs_scanned  = __atomic_load_n( &watcher->crawl_dirs_scanned, __ATOMIC_RELAXED );
+	progress->watches_added = __atomic_load_n( &watcher->crawl_watches_added, __ATOMIC_RELAXED );
+	progress->done          = fswatcher_crawl_complete( watcher );
+}
+
+void fswatcher_destroy( fswatcher_t watcher )
+{
+	// ... the crawl touches everything, it is stopped first ...
+	if( watcher->crawl_started )
+	{
+		__atomic_store_n( &watcher->crawl_cancel, true, __ATOMIC_RELAXED );
+		pthread_join( watcher->crawl_thread, 0x0 );
+	}
+
+	// ... the reader thread must be stopped before any fd it waits on is closed ...
+	fswatcher_stop_reader( watcher );
+	fswatcher_persist_save( watcher );
+	if( watcher->notifierfd >= 0 )
+		close( watcher->notifierfd );
+	if( watcher->wakeupfd >= 0 )
+		close( watcher->wakeupfd );
+	for( uint32_t i = 0; i < watcher->roots_cnt; ++i )
+	{
+		if( watcher->roots[i].mount_fd >= 0 )
+			close( watcher->roots[i].mount_fd );
+		fswatcher_free( watcher->allocator, watcher->roots[i].real );
+		fswatcher_free( watcher->allocator, watcher->roots[i].user );
+	}
+	fswatcher_free( watcher->allocator, watcher->roots );
+	for( uint32_t i = 0; i < watcher->snaps_cap; ++i )
+		fswatcher_snap_free( watcher, &watcher->snaps[i] );
+	fswatcher_snap_free( watcher, &watcher->snap_scratch );
+	fswatcher_free( watcher->allocator, watcher->snaps );
+	fswatcher_free( watcher->allocator, watcher->stat_batch.names );
+	fswatcher_free( watcher->allocator, watcher->stat_batch.items );
+	fswatcher_uring_free( watcher );
+	fswatcher_free( watcher->allocator, watcher->snapshot_file );
+	fswatcher_free( watcher->allocator, watcher->read_buffer );
+	fswatcher_filter_free( watcher->allocator, &watcher->exclude );
+	fswatcher_filter_free( watcher->allocator, &watcher->include );
+	fswatcher_free( watcher->allocator, watcher->queue.events );
+	fswatcher_free( watcher->allocator, watcher->queue.arena );
+	fswatcher_free( watcher->allocator, watcher->fid_cache.slots );
+	fswatcher_free( watcher->allocator, watcher->fid_cache.arena );
+	fswatcher_free( watcher->allocator, watcher->path.ptr );
+	fswatcher_free( watcher->allocator, watcher->move_src.ptr );
+	fswatcher_free( watcher->allocator, watcher->coalescer.entries );
+	fswatcher_free( watcher->allocator, watcher->coalescer.arena );
+	fswatcher_free( watcher->allocator, watcher->coalescer.index );
+	fswatcher_free( watcher->allocator, watcher->settler.entries );
+	fswatcher_free( watcher->allocator, watcher->settler.arena );
+	fswatcher_free( watcher->allocator, watcher->settler.index );
+	fswatcher_free( watcher->allocator, watcher->new_dirs );
+	if( watcher->new_dir_stream )
+		closedir( watcher->new_dir_stream );
+	fswatcher_free( watcher->allocator, watcher->content );
+	fswatcher_free( watcher->allocator, watcher->content_buf );
+	fswatcher_free( watcher->allocator, watcher->content_arena );
+	fswatcher_free( watcher->allocator, watcher->children_index );
+	fswatcher_free( watcher->allocator, watcher->names );
+	fswatcher_free( watcher->allocator, watcher->nodes );
+	fswatcher_free( watcher->allocator, watcher->watches );
+	pthread_mutex_destroy( &watcher->tree_lock );
+	fswatcher_free( watcher->allocator, watcher );
+}
+
+/**
+ * Bytes held through the watcher allocator, counts the same buffers as fswatcher_destroy() frees.
+ */
+static size_t fswatcher_memory_held( fswatcher_t w )
+{
+	size_t bytes = sizeof( fswatcher );
+	for( uint32_t i = 0; i < w->roots_cnt; ++i )
+	{
+		if( w->roots[i].real ) bytes += w->roots[i].real_len + 1;
+		if( w->roots[i].user ) bytes += w->roots[i].user_len + 1;
+	}
+	bytes += sizeof( fswatcher_root ) * w->roots_cap;
+	for( uint32_t i = 0; i < w->snaps_cap; ++i )
+		bytes += sizeof( fswatcher_snap_entry ) * w->snaps[i].entries_cap + w->snaps[i].names_cap;
+	bytes += sizeof( fswatcher_snap_entry ) * w->snap_scratch.entries_cap + w->snap_scratch.names_cap;
+	bytes += sizeof( fswatcher_snap_dir ) * w->snaps_cap;
+	bytes += w->stat_batch.names_cap + sizeof( fswatcher_stat_item ) * w->stat_batch.items_cap;
+	if( w->uring.results )
+		bytes += sizeof( struct statx ) * FSWATCHER_STAT_BATCH;
+	if( w->snapshot_file )
+		bytes += strlen( w->snapshot_file ) + 1;
+	bytes += w->read_buffer_cap;
+	bytes += sizeof( fswatcher_filter_rule ) * w->exclude.rules_cnt + w->exclude.text_size;
+	bytes += sizeof( fswatcher_filter_rule ) * w->include.rules_cnt + w->include.text_size;
+	bytes += sizeof( fswatcher_event ) * w->queue.events_cap + w->queue.arena_cap;
+	bytes += sizeof( fswatcher_fid_slot ) * w->fid_cache.slots_cap + w->fid_cache.arena_cap;
+	bytes += w->path.cap + w->move_src.cap;
+	bytes += sizeof( fswatcher_coalesce_entry ) * w->coalescer.entries_cap + w->coalescer.arena_cap + sizeof( uint32_t ) * w->coalescer.index_cap;
+	bytes += sizeof( fswatcher_settle_entry ) * w->settler.entries_cap + w->settler.arena_cap + sizeof( uint32_t ) * w->settler.index_cap;
+	bytes += sizeof( fswatcher_new_dir ) * w->new_dirs_cap;
+	bytes += sizeof( fswatcher_content_entry ) * w->content_cap + w->content_arena_cap;
+	if( w->content_buf )
+		bytes += FSWATCHER_CONTENT_CHUNK;
+	bytes += w->names_cap + sizeof( fswatcher_node ) * w->nodes_cap + sizeof( fswatcher_item ) * w->watches_cap;
+	bytes += sizeof( uint32_t ) * w->children_index_cap;
+	if( w->reader_buffer )
+		bytes += FSWATCHER_READER_BUFFER_SIZE;
+	if( w->ring )
+		bytes += w->ring_cap;
+	return bytes;
+}
+
+void fswatcher_get_stats( fswatcher_t watcher, fswatcher_stats* stats )
+{
+	stats->events_create             = watcher->stats.events_create;
+	stats->events_remove             = watcher->stats.events_remove;
+	stats->events_modify             = watcher->stats.events_modify;
+	stats->events_move               = watcher->stats.events_move;
+	stats->events_write_done         = watcher->stats.events_write_done;
+	stats->events_modify_dropped     = watcher->stats.events_modify_dropped;
+	stats->overflows                 = watcher->stats.overflows;
+	stats->max_poll_ns               = watcher->stats.max_poll_ns;
+	stats->read_syscalls             = __atomic_load_n( &watcher->stats.read_syscalls, __ATOMIC_RELAXED );
+	stats->add_watch_failures        = __atomic_load_n( &watcher->stats.add_watch_failures, __ATOMIC_RELAXED );
+	stats->add_watch_failures_limit  = __atomic_load_n( &watcher->stats.add_watch_failures_limit, __ATOMIC_RELAXED );
+	stats->add_watch_failures_access = __atomic_load_n( &watcher->stats.add_watch_failures_access, __ATOMIC_RELAXED );
+	stats->add_watch_failures_gone   = __atomic_load_n( &watcher->stats.add_watch_failures_gone, __ATOMIC_RELAXED );
+	stats->add_watch_failures_other  = __atomic_load_n( &watcher->stats.add_watch_failures_other, __ATOMIC_RELAXED );
+	fswatcher_lock_tree( watcher );
+	stats->memory = fswatcher_memory_held( watcher );
+
+	if( watcher->backend != FSWATCHER_BACKEND_FANOTIFY )
+		stats->watches = watcher->watches_cnt;
+	else
+	{
+		// ... roots on the same filesystem share one mark ...
+		stats->watches = 0;
+		for( uint32_t i = 0; i < watcher->roots_cnt; ++i )
+		{
+			bool shared = false;
+			for( uint32_t j = 0; j < i && !shared; ++j )
+				shared = watcher->roots[j].used && memcmp( &watcher->roots[j].fsid, &watcher->roots[i].fsid, sizeof( fsid_t ) ) == 0;
+			if( watcher->roots[i].used && !shared )
+				++stats->watches;
+		}
+	}
+	fswatcher_unlock_tree( watcher );
+}
+
+/**
+ * Make sure that buffer can hold at least size bytes, growing with the watcher allocator if needed. Buffers are
+ * never shrunk so once the longest path seen has been built no more allocations are made.
+ */
+static char* fswatcher_reserve_path_buffer( fswatcher_t watcher, fswatcher_path_buffer* buffer, size_t size )
+{
+	if( size <= buffer->cap )
+		return buffer->ptr;
+
+	size_t new_cap = buffer->cap ? buffer->cap : 256;
+	while( new_cap < size )
+		new_cap *= 2;
+
+	char* new_ptr = (char*)fswatcher_realloc( watcher->allocator, buffer->ptr, buffer->cap, new_cap );
+	if( new_ptr == 0x0 )
+		return 0x0;
+	buffer->ptr = new_ptr;
+	buffer->cap = new_cap;
+	return new_ptr;
+}
+
+/**
+ * Build full path of item name in directory watched by wd into buffer.
+ *
+ * @param root set to id of root the directory belongs to.
+ *
+ * @return pointer to path in buffer or 0x0 if wd is not watched.
+ */
+static const char* fswatcher_build_full_path( fswatcher_t watcher, fswatcher_path_buffer* buffer, int wd, const char* name, uint32_t name_len, uint32_t* root )
+{
+	fswatcher_item* dir = fswatcher_find_wd( watcher, wd );
+	if( dir == 0x0 )
+		return 0x0;
+	*root = watcher->nodes[dir->node].root;
+
+	// ... name is zero-padded by inotify ...
+	name_len = (uint32_t)strnlen( name, name_len );
+
+	size_t dirlen = fswatcher_node_path_len( watcher, dir->node );
+	size_t length = dirlen + name_len + 1;
+	char* res = fswatcher_reserve_path_buffer( watcher, buffer, length );
+	if( res == 0x0 )
+		return 0x0;
+
+	fswatcher_write_node_path( watcher, dir->node, res + dirlen );
+	memcpy( res + dirlen, name, name_len );
+	res[length-1] = 0;
+	return res;
+}
+
+static bool fswatcher_sink_emit( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst )
+{
+	if( !sink->emit( sink, root, type, src, dst ) )
+		return false;
+	++sink->delivered;
+	return true;
+}
+
+static bool fswatcher_emit_src( fswatcher_t watcher, fswatcher_sink* sink, fswatcher_event_type type, inotify_event* ev )
+{
+	uint32_t root;
+	const char* src = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+	return src == 0x0 || fswatcher_sink_emit( sink, root, type, src, 0x0 );
+}
+
+static bool fswatcher_emit_dst( fswatcher_t watcher, fswatcher_sink* sink, fswatcher_event_type type, inotify_event* ev )
+{
+	uint32_t root;
+	const char* dst = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+	return dst == 0x0 || fswatcher_sink_emit( sink, root, type, 0x0, dst );
+}
+
+/**
+ * Queue of events synthesized by the watcher itself, i.e. from an overflow recovery, delivered before any more events
+ * are read from the os. Paths are stored in arena and src/dst are offsets into it.
+ */
+static bool fswatcher_queue_push( fswatcher_t w, uint32_t root, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_event_queue* q = &w->queue;
+	if( q->events_cnt == q->events_cap )
+	{
+		size_t new_cap = q->events_cap ? q->events_cap * 2 : 64;
+		fswatcher_event* events = (fswatcher_event*)fswatcher_realloc( w->allocator, q->events, sizeof( fswatcher_event ) * q->events_cap, sizeof( fswatcher_event ) * new_cap );
+		if( events == 0x0 )
+			return false;
+		q->events = events;
+		q->events_cap = new_cap;
+	}
+
+	size_t src_len = src ? strlen( src ) + 1 : 0;
+	size_t dst_len = dst ? strlen( dst ) + 1 : 0;
+	if( q->arena_size + src_len + dst_len > q->arena_cap )
+	{
+		size_t new_cap = q->arena_cap ? q->arena_cap : 4096;
+		while( new_cap < q->arena_size + src_len + dst_len )
+			new_cap *= 2;
+		if( new_cap > FSWATCHER_NO_PATH )
+			return false;
+		char* arena = (char*)fswatcher_realloc( w->allocator, q->arena, q->arena_cap, new_cap );
+		if( arena == 0x0 )
+			return false;
+		q->arena = arena;
+		q->arena_cap = new_cap;
+	}
+
+	fswatcher_event* ev = &q->events[q->events_cnt++];
+	ev->type = type;
+	ev->root = root;
+	ev->src  = src ? (uint32_t)q->arena_size : FSWATCHER_NO_PATH;
+	if( src )
+		memcpy( q->arena + q->arena_size, src, src_len );
+	q->arena_size += src_len;
+	ev->dst  = dst ? (uint32_t)q->arena_size : FSWATCHER_NO_PATH;
+	if( dst )
+		memcpy( q->arena + q->arena_size, dst, dst_len );
+	q->arena_size += dst_len;
+	return true;
+}
+
+/**
+ * Deliver queued events to sink.
+ *
+ * @return false if sink could not consume all events, the rest are kept until next call.
+ */
+static bool fswatcher_queue_flush( fswatcher_t w, fswatcher_sink* sink )
+{
+	fswatcher_event_queue* q = &w->queue;
+	while( q->events_head < q->events_cnt )
+	{
+		if( sink->stop )
+			return false;
+		fswatcher_event* ev = &q->events[q->events_head];
+		if( ev->type != FSWATCHER_EVENT_BUFFER_OVERFLOW && ( ev->type & w->types ) == 0 )
+		{
+			// ... not requested or dropped, i.e. the remove-half of a move ...
+			++q->events_head;
+			continue;
+		}
+		const char* src = ev->src == FSWATCHER_NO_PATH ? 0x0 : q->arena + ev->src;
+		const char* dst = ev->dst == FSWATCHER_NO_PATH ? 0x0 : q->arena + ev->dst;
+		if( !fswatcher_sink_emit( sink, ev->root, ev->type, src, dst ) )
+			return false;
+		++q->events_head;
+	}
+	q->events_head = 0;
+	q->events_cnt  = 0;
+	q->arena_size  = 0;
+	return true;
+}
+
+/**
+ * Snapshot used by FSWATCHER_CREATE_SNAPSHOT, each watched directory-node has a list of its entries sorted by name
+ * with the inode, size and mtime last seen. The snapshot is updated as events are processed and on an overflow all
+ * directories are rescanned and diffed against it to synthesize the events that was lost.
+ */
+static fswatcher_snap_dir* fswatcher_snap_get( fswatcher_t w, uint32_t node )
+{
+	if( node >= w->snaps_cap )
+	{
+		uint32_t new_cap = w->nodes_cap > node ? w->nodes_cap : node + 1;
+		fswatcher_snap_dir* snaps = (fswatcher_snap_dir*)fswatcher_realloc( w->allocator, w->snaps, sizeof( fswatcher_snap_dir ) * w->snaps_cap, sizeof( fswatcher_snap_dir ) * new_cap );
+		if( snaps == 0x0 )
+			return 0x0;
+		memset( snaps + w->snaps_cap, 0x0, sizeof( fswatcher_snap_dir ) * ( new_cap - w->snaps_cap ) );
+		w->snaps = snaps;
+		w->snaps_cap = new_cap;
+	}
+	return &w->snaps[node];
+}
+
+static void fswatcher_snap_free( fswatcher_t w, fswatcher_snap_dir* dir )
+{
+	fswatcher_free( w->allocator, dir->entries );
+	fswatcher_free( w->allocator, dir->names );
+	memset( dir, 0x0, sizeof( fswatcher_snap_dir ) );
+}
+
+static void fswatcher_snap_clear( fswatcher_t w, uint32_t node )
+{
+	if( node < w->snaps_cap )
+		fswatcher_snap_free( w, &w->snaps[node] );
+}
+
+static int fswatcher_snap_compare( const fswatcher_snap_dir* dir, const fswatcher_snap_entry* e, const char* name, uint32_t name_len )
+{
+	uint32_t len = e->name_len < name_len ? e->name_len : name_len;
+	int res = memcmp( dir->names + e->name_offset, name, len );
+	if( res != 0 )
+		return res;
+	return e->name_len < name_len ? -1 : ( e->name_len > name_len ? 1 : 0 );
+}
+
+/**
+ * Find entry with name in dir, returns true if found. pos is set to the index of the entry or where it should be inserted.
+ */
+static bool fswatcher_snap_find( const fswatcher_snap_dir* dir, const char* name, uint32_t name_len, uint32_t* pos )
+{
+	uint32_t lo = 0;
+	uint32_t hi = dir->entries_cnt;
+	while( lo < hi )
+	{
+		uint32_t mid = lo + ( hi - lo ) / 2;
+		int cmp = fswatcher_snap_compare( dir, &dir->entries[mid], name, name_len );
+		if( cmp == 0 )
+		{
+			*pos = mid;
+			return true;
+		}
+		if( cmp < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*pos = lo;
+	return false;
+}
+
+static void fswatcher_snap_set_stat( fswatcher_snap_entry* e, const struct stat* st )
+{
+	e->inode  = (uint64_t)st->st_ino;
+	e->size   = (uint64_t)st->st_size;
+	e->mtime  = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+	e->is_dir = S_ISDIR( st->st_mode ) ? 1u : 0u;
+}
+
+/**
+ * Insert entry at pos, or append if pos is entries_cnt.
+ */
+static bool fswatcher_snap_insert( fswatcher_t w, fswatcher_snap_dir* dir, uint32_t pos, const char* name, uint32_t name_len, const struct stat* st )
+{
+	if( dir->entries_cnt == dir->entries_cap )
+	{
+		uint32_t new_cap = dir->entries_cap ? dir->entries_cap * 2 : 8;
+		fswatcher_snap_entry* entries = (fswatcher_snap_entry*)fswatcher_realloc( w->allocator, dir->entries, sizeof( fswatcher_snap_entry ) * dir->entries_cap, sizeof( fswatcher_snap_entry ) * new_cap );
+		if( entries == 0x0 )
+			return false;
+		dir->entries = entries;
+		dir->entries_cap = new_cap;
+	}
+
+	if( dir->names_size + name_len > dir->names_cap )
+	{
+		// ... reclaim names of erased entries before growing ...
+		if( dir->names_garbage > dir->names_size / 2 )
+		{
+			uint32_t size = 0;
+			for( uint32_t i = 0; i < dir->entries_cnt; ++i )
+			{
+				fswatcher_snap_entry* e = &dir->entries[i];
+				memmove( dir->names + size, dir->names + e->name_offset, e->name_len );
+				e->name_offset = size;
+				size += e->name_len;
+			}
+			dir->names_size = size;
+			dir->names_garbage = 0;
+		}
+
+		uint32_t new_cap = dir->names_cap ? dir->names_cap : 256;
+		while( new_cap < dir->names_size + name_len )
+			new_cap *= 2;
+		if( new_cap != dir->names_cap )
+		{
+			char* names = (char*)fswatcher_realloc( w->allocator, dir->names, dir->names_cap, new_cap );
+			if( names == 0x0 )
+				return false;
+			dir->names = names;
+			dir->names_cap = new_cap;
+		}
+	}
+
+	memmove( dir->entries + pos + 1, dir->entries + pos, sizeof( fswatcher_snap_entry ) * ( dir->entries_cnt - pos ) );
+	++dir->entries_cnt;
+
+	fswatcher_snap_entry* e = &dir->entries[pos];
+	e->name_offset = dir->names_size;
+	e->name_len    = name_len;
+	fswatcher_snap_set_stat( e, st );
+	memcpy( dir->names + dir->names_size, name, name_len );
+	dir->names_size += name_len;
+	return true;
+}
+
+static void fswatcher_snap_erase( fswatcher_snap_dir* dir, uint32_t pos )
+{
+	dir->names_garbage += dir->entries[pos].name_len;
+	memmove( dir->entries + pos, dir->entries + pos + 1, sizeof( fswatcher_snap_entry ) * ( dir->entries_cnt - pos - 1 ) );
+	--dir->entries_cnt;
+}
+
+/**
+ * Update the snapshot of the item at path, named name in directory-node, from disk.
+ */
+static void fswatcher_snap_touch( fswatcher_t w, uint32_t node, const char* path, const char* name, uint32_t name_len )
+{
+	fswatcher_snap_dir* dir = fswatcher_snap_get( w, node );
+	if( dir == 0x0 )
+		return;
+
+	struct stat st;
+	bool exists = lstat( path, &st ) == 0;
+	uint32_t pos;
+	bool found = fswatcher_snap_find( dir, name, name_len, &pos );
+	if( exists && found )
+		fswatcher_snap_set_stat( &dir->entries[pos], &st );
+	else if( exists )
+		fswatcher_snap_insert( w, dir, pos, name, name_len, &st );
+	else if( found )
+		fswatcher_snap_erase( dir, pos );
+}
+
+static bool fswatcher_snap_less( const fswatcher_snap_dir* dir, uint32_t a, uint32_t b )
+{
+	const fswatcher_snap_entry* eb = &dir->entries[b];
+	return fswatcher_snap_compare( dir, &dir->entries[a], dir->names + eb->name_offset, eb->name_len ) < 0;
+}
+
+static void fswatcher_snap_sift( fswatcher_snap_dir* dir, uint32_t root, uint32_t end )
+{
+	while( true )
+	{
+		uint32_t child = root * 2 + 1;
+		if( child >= end )
+			return;
+		if( child + 1 < end && fswatcher_snap_less( dir, child, child + 1 ) )
+			++child;
+		if( !fswatcher_snap_less( dir, root, child ) )
+			return;
+		fswatcher_snap_entry tmp = dir->entries[root];
+		dir->entries[root]  = dir->entries[child];
+		dir->entries[child] = tmp;
+		root = child;
+	}
+}
+
+/**
+ * Sort entries by name, heapsort as the compare need the names in dir and the sort must not allocate.
+ */
+static void fswatcher_snap_sort( fswatcher_snap_dir* dir )
+{
+	uint32_t n = dir->entries_cnt;
+	for( uint32_t i = n / 2; i-- > 0; )
+		fswatcher_snap_sift( dir, i, n );
+	for( uint32_t end = n; end-- > 1; )
+	{
+		fswatcher_snap_entry tmp = dir->entries[0];
+		dir->entries[0]   = dir->entries[end];
+		dir->entries[end] = tmp;
+		fswatcher_snap_sift( dir, 0, end );
+	}
+}
+
+static bool fswatcher_stat_batch_push( fswatcher_t w, const char* name, size_t name_len )
+{
+	fswatcher_stat_batch* b = &w->stat_batch;
+	if( b->items_cnt == b->items_cap )
+	{
+		size_t new_cap = b->items_cap ? b->items_cap * 2 : 64;
+		fswatcher_stat_item* items = (fswatcher_stat_item*)fswatcher_realloc( w->allocator, b->items, sizeof( fswatcher_stat_item ) * b->items_cap, sizeof( fswatcher_stat_item ) * new_cap );
+		if( items == 0x0 )
+			return false;
+		b->items = items;
+		b->items_cap = new_cap;
+	}
+
+	if( b->names_size + name_len + 1 > b->names_cap )
+	{
+		size_t new_cap = b->names_cap ? b->names_cap : 4096;
+		while( new_cap < b->names_size + name_len + 1 )
+			new_cap *= 2;
+		char* names = (char*)fswatcher_realloc( w->allocator, b->names, b->names_cap, new_cap );
+		if( names == 0x0 )
+			return false;
+		b->names = names;
+		b->names_cap = new_cap;
+	}
+
+	fswatcher_stat_item* item = &b->items[b->items_cnt++];
+	item->name     = (uint32_t)b->names_size;
+	item->name_len = (uint32_t)name_len;
+	item->ok       = false;
+	memcpy( b->names + b->names_size, name, name_len );
+	b->names[b->names_size + name_len] = '\0';
+	b->names_size += name_len + 1;
+	return true;
+}
+
+static void fswatcher_uring_free( fswatcher_t w )
+{
+	fswatcher_uring* u = &w->uring;
+	if( u->sqes != 0x0 && u->sqes != MAP_FAILED )
+		munmap( u->sqes, u->sqes_size );
+	if( u->cq_ring != 0x0 && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring )
+		munmap( u->cq_ring, u->cq_ring_size );
+	if( u->sq_ring != 0x0 && u->sq_ring != MAP_FAILED )
+		munmap( u->sq_ring, u->sq_ring_size );
+	if( u->fd >= 0 )
+		close( u->fd );
+	fswatcher_free( w->allocator, u->results );
+	memset( u, 0x0, sizeof( fswatcher_uring ) );
+	u->fd    = -1;
+	u->tried = true;
+}
+
+static void fswatcher_uring_init( fswatcher_t w )
+{
+	fswatcher_uring* u = &w->uring;
+	u->tried = true;
+
+	io_uring_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	u->fd = (int)syscall( __NR_io_uring_setup, FSWATCHER_STAT_BATCH, &params );
+	if( u->fd < 0 )
+		return;
+
+	u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+	u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+	u->sqes_size    = params.sq_entries * sizeof( io_uring_sqe );
+	bool single_mmap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+	if( single_mmap && u->cq_ring_size > u->sq_ring_size )
+		u->sq_ring_size = u->cq_ring_size;
+
+	u->sq_ring = mmap( 0x0, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING );
+	u->cq_ring = single_mmap ? u->sq_ring : mmap( 0x0, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING );
+	u->sqes    = (io_uring_sqe*)mmap( 0x0, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES );
+	u->results = (struct statx*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( struct statx ) * FSWATCHER_STAT_BATCH );
+	if( u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED || u->results == 0x0 )
+	{
+		fswatcher_uring_free( w );
+		return;
+	}
+
+	char* sq = (char*)u->sq_ring;
+	char* cq = (char*)u->cq_ring;
+	u->sq_entries = params.sq_entries;
+	u->sq_tail    = (unsigned*)( sq + params.sq_off.tail );
+	u->sq_mask    = (unsigned*)( sq + params.sq_off.ring_mask );
+	u->sq_array   = (unsigned*)( sq + params.sq_off.array );
+	u->cq_head    = (unsigned*)( cq + params.cq_off.head );
+	u->cq_tail    = (unsigned*)( cq + params.cq_off.tail );
+	u->cq_mask    = (unsigned*)( cq + params.cq_off.ring_mask );
+	u->cqes       = (io_uring_cqe*)( cq + params.cq_off.cqes );
+}
+
+static void fswatcher_statx_to_stat( const struct statx* sx, struct stat* st )
+{
+	memset( st, 0x0, sizeof( struct stat ) );
+	st->st_ino  = (ino_t)sx->stx_ino;
+	st->st_size = (off_t)sx->stx_size;
+	st->st_mode = (mode_t)sx->stx_mode;
+	st->st_mtim.tv_sec  = (time_t)sx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = (long)sx->stx_mtime.tv_nsec;
+}
+
+/**
+ * Stat all items in the stat-batch relative to dirfd through io_uring, FSWATCHER_STAT_BATCH at a time with one
+ * syscall per batch in the common case.
+ *
+ * @return number of items stat:ed, if less than all io_uring failed and has been torn down.
+ */
+static size_t fswatcher_uring_stat( fswatcher_t w, int dirfd )
+{
+	fswatcher_uring* u = &w->uring;
+	fswatcher_stat_batch* b = &w->stat_batch;
+	size_t batch_max = u->sq_entries < FSWATCHER_STAT_BATCH ? u->sq_entries : FSWATCHER_STAT_BATCH;
+	for( size_t base = 0; base < b->items_cnt; base += batch_max )
+	{
+		unsigned cnt = (unsigned)( b->items_cnt - base < batch_max ? b->items_cnt - base : batch_max );
+		unsigned tail = *u->sq_tail;
+		for( unsigned i = 0; i < cnt; ++i, ++tail )
+		{
+			unsigned index = tail & *u->sq_mask;
+			io_uring_sqe* sqe = &u->sqes[index];
+			memset( sqe, 0x0, sizeof( io_uring_sqe ) );
+			sqe->opcode      = IORING_OP_STATX;
+			sqe->fd          = dirfd;
+			sqe->addr        = (uint64_t)(uintptr_t)( b->names + b->items[base + i].name );
+			sqe->len         = STATX_BASIC_STATS;
+			sqe->off         = (uint64_t)(uintptr_t)&u->results[i];
+			sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+			sqe->user_data   = i;
+			u->sq_array[index] = index;
+		}
+		__atomic_store_n( u->sq_tail, tail, __ATOMIC_RELEASE );
+
+		unsigned to_submit = cnt;
+		unsigned reaped    = 0;
+		unsigned retries   = 0;
+		bool unsupported   = false;
+		while( reaped < cnt )
+		{
+			unsigned reaped_before = reaped;
+			bool submitted = false;
+			int res = (int)syscall( __NR_io_uring_enter, u->fd, to_submit, 1, IORING_ENTER_GETEVENTS, 0x0, 0 );
+			if( res < 0 )
+			{
+				// ... EBUSY means the completion queue is full and has to be reaped before the kernel takes more, so
+				//     fall through and reap what is there before retrying ...
+				bool retry = errno == EINTR || errno == EAGAIN || errno == EBUSY;
+				if( !retry || retries >= FSWATCHER_URING_RETRIES )
+				{
+					fswatcher_uring_free( w );
+					return base;
+				}
+			}
+			else
+			{
+				to_submit -= (unsigned)res < to_submit ? (unsigned)res : to_submit;
+				submitted  = res > 0;
+			}
+
+			unsigned head = *u->cq_head;
+			unsigned cq_tail = __atomic_load_n( u->cq_tail, __ATOMIC_ACQUIRE );
+			for( ; head != cq_tail; ++head, ++reaped )
+			{
+				io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+				fswatcher_stat_item* item = &b->items[base + cqe->user_data];
+				item->ok = cqe->res == 0;
+				if( item->ok )
+					fswatcher_statx_to_stat( &u->results[cqe->user_data], &item->st );
+				unsupported |= cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP;
+			}
+			__atomic_store_n( u->cq_head, head, __ATOMIC_RELEASE );
+			retries = submitted || reaped != reaped_before ? 0 : retries + 1;
+		}
+
+		// ... IORING_OP_STATX needs linux 5.6, fall back to fstatat() from this batch on ...
+		if( unsupported )
+		{
+			fswatcher_uring_free( w );
+			return base;
+		}
+	}
+	return b->items_cnt;
+}
+
+/**
+ * Stat all items in the stat-batch relative to dirfd, without following symlinks.
+ */
+static void fswatcher_stat_batch_run( fswatcher_t w, int dirfd )
+{
+	fswatcher_stat_batch* b = &w->stat_batch;
+	if( !w->uring.tried )
+		fswatcher_uring_init( w );
+
+	size_t done = w->uring.fd >= 0 ? fswatcher_uring_stat( w, dirfd ) : 0;
+	for( size_t i = done; i < b->items_cnt; ++i )
+		b->items[i].ok = fstatat( dirfd, b->names + b->items[i].name, &b->items[i].st, AT_SYMLINK_NOFOLLOW ) == 0;
+}
+
+/**
+ * Read directory at path into dir, replacing its content, sorted by name. The items are stat:ed in batches.
+ *
+ * If old is set and the directory has not been modified since old was listed the names are taken from old instead of
+ * listing the directory again, the items are still stat:ed to find modified files.
+ */
+static bool fswatcher_snap_scan( fswatcher_t w, const char* path, const fswatcher_snap_dir* old, fswatcher_snap_dir* dir )
+{
+	dir->entries_cnt   = 0;
+	dir->names_size    = 0;
+	dir->names_garbage = 0;
+	dir->mtime         = 0;
+
+	int fd = open( path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	if( fd < 0 )
+		return false;
+
+	struct stat dir_st;
+	if( fstat( fd, &dir_st ) != 0 )
+	{
+		close( fd );
+		return false;
+	}
+	int64_t mtime = (int64_t)dir_st.st_mtim.tv_sec * 1000000000 + dir_st.st_mtim.tv_nsec;
+
+	fswatcher_stat_batch* b = &w->stat_batch;
+	b->names_size = 0;
+	b->items_cnt  = 0;
+
+	bool ok = true;
+	bool list = old == 0x0 || old->mtime == 0 || old->mtime != mtime;
+	DIR* dirp = 0x0;
+	if( list )
+	{
+		// ... dirp takes over fd, it stays open until closedir() ...
+		dirp = fdopendir( fd );
+		if( dirp == 0x0 )
+		{
+			close( fd );
+			return false;
+		}
+
+		dirent* ent;
+		while( ok && ( ent = readdir( dirp ) ) != 0x0 )
+			if( strcmp( ent->d_name, "." ) != 0 && strcmp( ent->d_name, ".." ) != 0 )
+				ok = fswatcher_stat_batch_push( w, ent->d_name, strlen( ent->d_name ) );
+	}
+	else
+	{
+		for( uint32_t i = 0; ok && i < old->entries_cnt; ++i )
+			ok = fswatcher_stat_batch_push( w, old->names + old->entries[i].name_offset, old->entries[i].name_len );
+	}
+
+	if( ok )
+	{
+		fswatcher_stat_batch_run( w, fd );
+		for( size_t i = 0; i < b->items_cnt; ++i )
+		{
+			fswatcher_stat_item* item = &b->items[i];
+			const char* name = b->names + item->name;
+			if( !item->ok || fswatcher_filtered( w, name, item->name_len, S_ISDIR( item->st.st_mode ) ) )
+				continue;
+			fswatcher_snap_insert( w, dir, dir->entries_cnt, name, item->name_len, &item->st );
+		}
+	}
+
+	if( dirp )
+		closedir( dirp );
+	else
+		close( fd );
+	if( !ok )
+		return false;
+
+	// ... names from old are already sorted ...
+	if( list )
+		fswatcher_snap_sort( dir );
+
+	// ... a directory modified within the timestamp granularity of the filesystem might be modified again without
+	//     its mtime changing, it is listed again until its mtime is old enough to be trusted ...
+	timespec now;
+	clock_gettime( CLOCK_REALTIME, &now );
+	if( (int64_t)now.tv_sec * 1000000000 + now.tv_nsec - mtime > FSWATCHER_MTIME_SLACK_NS )
+		dir->mtime = mtime;
+	dir->scanned = true;
+	return true;
+}
+
+/**
+ * Take the initial snapshot of all directories in root that has not been scanned yet.
+ */
+static void fswatcher_snap_build( fswatcher_t w, uint32_t root )
+{
+	for( uint32_t i = 0; i < w->nodes_cnt; ++i )
+	{
+		if( w->nodes[i].wd <= 0 || w->nodes[i].root != root || ( i < w->snaps_cap && w->snaps[i].scanned ) )
+			continue;
+		uint32_t node_root;
+		const char* path = fswatcher_build_full_path( w, &w->path, w->nodes[i].wd, "", 0, &node_root );
+		fswatcher_snap_dir* dir = fswatcher_snap_get( w, i );
+		if( path != 0x0 && dir != 0x0 )
+			fswatcher_snap_scan( w, path, 0x0, dir );
+	}
+}
+
+/**
+ * Item found removed or created by a rescan, one half of a move if the other half with the same inode is found in
+ * the same pass.
+ */
+struct fswatcher_snap_change
+{
+	size_t   event;   ///< index of the queued REMOVE or CREATE event.
+	uint64_t inode;
+	uint64_t size;
+	int64_t  mtime;
+	uint32_t parent;  ///< directory-node the item was found in.
+	uint32_t node;    ///< directory-node of a removed directory, FSWATCHER_NO_NODE otherwise.
+	bool     is_dir;
+	bool     created;
+	bool     matched;
+};
+
+struct fswatcher_snap_nodes
+{
+	uint32_t* nodes;
+	uint32_t  cnt;
+	uint32_t  cap;
+};
+
+/**
+ * State of one rescan-pass, directory-nodes left to rescan and changes found so far.
+ */
+struct fswatcher_snap_work
+{
+	fswatcher_snap_nodes todo;
+	fswatcher_snap_nodes gone; ///< nodes that could not be opened, retried if a directory above them was moved.
+
+	fswatcher_snap_change* changes;
+	size_t changes_cnt;
+	size_t changes_cap;
+};
+
+static bool fswatcher_snap_nodes_push( fswatcher_t w, fswatcher_snap_nodes* list, uint32_t node )
+{
+	if( list->cnt == list->cap )
+	{
+		uint32_t new_cap = list->cap ? list->cap * 2 : 64;
+		uint32_t* nodes = (uint32_t*)fswatcher_realloc( w->allocator, list->nodes, sizeof( uint32_t ) * list->cap, sizeof( uint32_t ) * new_cap );
+		if( nodes == 0x0 )
+			return false;
+		list->nodes = nodes;
+		list->cap   = new_cap;
+	}
+	list->nodes[list->cnt++] = node;
+	return true;
+}
+
+/**
+ * Queue REMOVE or CREATE event for item e at path and remember it as a change so that it can be matched to a move.
+ */
+static bool fswatcher_snap_change_push( fswatcher_t w, fswatcher_snap_work* work, uint32_t root, const char* path, uint32_t parent, const fswatcher_snap_entry* e, uint32_t node, bool created )
+{
+	if( work->changes_cnt == work->changes_cap )
+	{
+		size_t new_cap = work->changes_cap ? work->changes_cap * 2 : 64;
+		fswatcher_snap_change* changes = (fswatcher_snap_change*)fswatcher_realloc( w->allocator, work->changes, sizeof( fswatcher_snap_change ) * work->changes_cap, sizeof( fswatcher_snap_change ) * new_cap );
+		if( changes == 0x0 )
+			return false;
+		work->changes = changes;
+		work->changes_cap = new_cap;
+	}
+	if( !fswatcher_queue_push( w, root, created ? FSWATCHER_EVENT_CREATE : FSWATCHER_EVENT_REMOVE, path, 0x0 ) )
+		return false;
+
+	fswatcher_snap_change* c = &work->changes[work->changes_cnt++];
+	c->event   = w->queue.events_cnt - 1;
+	c->inode   = e->inode;
+	c->size    = e->size;
+	c->mtime   = e->mtime;
+	c->parent  = parent;
+	c->node    = node;
+	c->is_dir  = e->is_dir;
+	c->created = created;
+	c->matched = false;
+	return true;
+}
+
+/**
+ * Build path of entry e in snapshot dir into w->path, after the directory path of length dir_len already in it.
+ */
+static const char* fswatcher_snap_entry_path( fswatcher_t w, size_t dir_len, const fswatcher_snap_dir* dir, const fswatcher_snap_entry* e )
+{
+	char* path = fswatcher_reserve_path_buffer( w, &w->path, dir_len + e->name_len + 1 );
+	if( path == 0x0 )
+		return 0x0;
+	memcpy( path + dir_len, dir->names + e->name_offset, e->name_len );
+	path[dir_len + e->name_len] = '\0';
+	return path;
+}
+
+/**
+ * Rescan directory-node and queue events for all differences against its snapshot. Removed and created items are
+ * also added to the changes of work, the directory-tree is updated for them once the whole pass is done.
+ */
+static bool fswatcher_snap_rescan( fswatcher_t w, uint32_t node, fswatcher_snap_work* work )
+{
+	if( w->nodes[node].wd <= 0 )
+		return true;
+
+	uint32_t root;
+	if( fswatcher_build_full_path( w, &w->path, w->nodes[node].wd, "", 0, &root ) == 0x0 )
+		return false;
+	size_t dir_len = strlen( w->path.ptr );
+
+	fswatcher_snap_dir* old = fswatcher_snap_get( w, node );
+	if( old == 0x0 )
+		return false;
+
+	fswatcher_snap_dir* scan = &w->snap_scratch;
+	// ... directory is gone or was moved along with a directory above it, the parent reports the removal ...
+	if( !fswatcher_snap_scan( w, w->path.ptr, old, scan ) )
+		return fswatcher_snap_nodes_push( w, &work->gone, node );
+
+	uint32_t i = 0;
+	uint32_t j = 0;
+	while( i < old->entries_cnt || j < scan->entries_cnt )
+	{
+		fswatcher_snap_entry* o = i < old->entries_cnt  ? &old->entries[i]  : 0x0;
+		fswatcher_snap_entry* n = j < scan->entries_cnt ? &scan->entries[j] : 0x0;
+		int cmp = o == 0x0 ? 1 : ( n == 0x0 ? -1 : fswatcher_snap_compare( old, o, scan->names + n->name_offset, n->name_len ) );
+
+		bool removed = cmp < 0 || ( cmp == 0 && ( o->inode != n->inode || o->is_dir != n->is_dir ) );
+		bool created = cmp > 0 || ( cmp == 0 && removed );
+		bool modified = cmp == 0 && !removed && !n->is_dir && ( o->size != n->size || o->mtime != n->mtime );
+
+		if( removed )
+		{
+			const char* path = fswatcher_snap_entry_path( w, dir_len, old, o );
+			uint32_t child = o->is_dir ? fswatcher_find_child( w, node, old->names + o->name_offset, o->name_len ) : FSWATCHER_NO_NODE;
+			if( path == 0x0 || !fswatcher_snap_change_push( w, work, root, path, node, o, child, false ) )
+				return false;
+		}
+		if( created )
+		{
+			const char* path = fswatcher_snap_entry_path( w, dir_len, scan, n );
+			if( path == 0x0 || !fswatcher_snap_change_push( w, work, root, path, node, n, FSWATCHER_NO_NODE, true ) )
+				return false;
+		}
+		if( modified )
+		{
+			const char* path = fswatcher_snap_entry_path( w, dir_len, scan, n );
+			if( path == 0x0 || !fswatcher_queue_push( w, root, FSWATCHER_EVENT_MODIFY, path, 0x0 ) )
+				return false;
+		}
+
+		if( cmp <= 0 ) ++i;
+		if( cmp >= 0 ) ++j;
+	}
+
+	// ... the scan is the new snapshot, keep the old buffers as scratch for the next scan ...
+	fswatcher_snap_dir tmp = *old;
+	*old = *scan;
+	*scan = tmp;
+	return true;
+}
+
+struct fswatcher_snap_inode
+{
+	uint64_t inode;
+	size_t   change;
+};
+
+static int fswatcher_snap_inode_cmp( const void* a, const void* b )
+{
+	uint64_t ia = ( (const fswatcher_snap_inode*)a )->inode;
+	uint64_t ib = ( (const fswatcher_snap_inode*)b )->inode;
+	return ia < ib ? -1 : ( ia > ib ? 1 : 0 );
+}
+
+/**
+ * Match items created since change first_created against items removed during the pass by inode and turn each pair
+ * into one MOVE event, at the position of the create. Files must also have the same size and mtime as a move does not
+ * touch them. A moved directory keeps its node, only the node is moved.
+ */
+static bool fswatcher_snap_match_moves( fswatcher_t w, fswatcher_snap_work* work, size_t first_created, bool* dir_moved )
+{
+	size_t removed_cnt = 0;
+	for( size_t i = 0; i < work->changes_cnt; ++i )
+		if( !work->changes[i].created && !work->changes[i].matched )
+			++removed_cnt;
+	if( removed_cnt == 0 )
+		return true;
+
+	fswatcher_snap_inode* removed = (fswatcher_snap_inode*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( fswatcher_snap_inode ) * removed_cnt );
+	if( removed == 0x0 )
+		return false;
+	removed_cnt = 0;
+	for( size_t i = 0; i < work->changes_cnt; ++i )
+	{
+		if( work->changes[i].created || work->changes[i].matched )
+			continue;
+		removed[removed_cnt].inode  = work->changes[i].inode;
+		removed[removed_cnt].change = i;
+		++removed_cnt;
+	}
+	qsort( removed, removed_cnt, sizeof( fswatcher_snap_inode ), fswatcher_snap_inode_cmp );
+
+	fswatcher_event_queue* q = &w->queue;
+	for( size_t i = first_created; i < work->changes_cnt; ++i )
+	{
+		fswatcher_snap_change* c = &work->changes[i];
+		if( !c->created || c->matched )
+			continue;
+
+		size_t lo = 0;
+		size_t hi = removed_cnt;
+		while( lo < hi )
+		{
+			size_t mid = lo + ( hi - lo ) / 2;
+			if( removed[mid].inode < c->inode )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for( ; lo < removed_cnt && removed[lo].inode == c->inode; ++lo )
+		{
+			fswatcher_snap_change* r = &work->changes[removed[lo].change];
+			fswatcher_event* create = &q->events[c->event];
+			fswatcher_event* remove = &q->events[r->event];
+			if( r->matched || r->is_dir != c->is_dir || remove->root != create->root )
+				continue;
+			if( !c->is_dir && ( r->size != c->size || r->mtime != c->mtime ) )
+				continue;
+
+			if( c->is_dir )
+			{
+				if( r->node == FSWATCHER_NO_NODE )
+					continue;
+				const char* dst  = q->arena + create->src;
+				const char* name = strrchr( dst, '/' );
+				name = name ? name + 1 : dst;
+				if( !fswatcher_move_node( w, r->node, c->parent, name, strlen( name ) ) )
+					continue;
+			}
+
+			create->type = FSWATCHER_EVENT_MOVE;
+			create->dst  = create->src;
+			create->src  = remove->src;
+			remove->type = (fswatcher_event_type)0;
+			r->matched = true;
+			c->matched = true;
+			*dir_moved |= c->is_dir;
+			break;
+		}
+	}
+
+	fswatcher_free( w->allocator, removed );
+	return true;
+}
+
+/**
+ * Rescan all directory-nodes in work and queue events for all differences against the snapshot. Moves within the
+ * watched dirs are matched by inode, new directories are watched and rescanned in turn so that their content is
+ * reported and directories that are gone are dropped with everything below them at the end.
+ */
+static bool fswatcher_snap_pass( fswatcher_t w, fswatcher_snap_work* work )
+{
+	bool ok = true;
+	while( ok && work->todo.cnt > 0 )
+	{
+		size_t first_created = work->changes_cnt;
+		while( ok && work->todo.cnt > 0 )
+			ok = fswatcher_snap_rescan( w, work->todo.nodes[--work->todo.cnt], work );
+
+		bool dir_moved = false;
+		ok = ok && fswatcher_snap_match_moves( w, work, first_created, &dir_moved );
+
+		// ... nodes below a moved directory failed to open at their old path, rescan them at the new one. A round
+		//     without directory-moves leaves them failed so this terminates ...
+		if( ok && dir_moved )
+		{
+			fswatcher_snap_nodes tmp = work->todo;
+			work->todo = work->gone;
+			work->gone = tmp;
+		}
+
+		for( size_t i = first_created; ok && i < work->changes_cnt; ++i )
+		{
+			fswatcher_snap_change* c = &work->changes[i];
+			if( !c->created || c->matched || !c->is_dir )
+				continue;
+
+			const char* path = w->queue.arena + w->queue.events[c->event].src;
+			const char* name = strrchr( path, '/' );
+			name = name ? name + 1 : path;
+			bool added;
+			uint32_t child = fswatcher_add( w, c->parent, w->nodes[c->parent].root, path, name, strlen( name ), &added );
+			if( added )
+				ok = fswatcher_snap_nodes_push( w, &work->todo, child );
+		}
+	}
+
+	for( size_t i = 0; i < work->changes_cnt; ++i )
+	{
+		fswatcher_snap_change* c = &work->changes[i];
+		if( !c->created && !c->matched && c->node != FSWATCHER_NO_NODE )
+			fswatcher_remove_subtree( w, c->node );
+	}
+	return ok;
+}
+
+/**
+ * Rescan all watched directories and queue the differences against the snapshot, used to recover from an overflow and
+ * by the poll backend for each scan.
+ *
+ * @return false if the rescan failed, some events might have been queued.
+ */
+static bool fswatcher_snap_rescan_all( fswatcher_t w )
+{
+	fswatcher_snap_work work;
+	memset( &work, 0x0, sizeof( work ) );
+	bool ok = true;
+	for( uint32_t i = 0; i < w->nodes_cnt && ok; ++i )
+		if( w->nodes[i].wd > 0 )
+			ok = fswatcher_snap_nodes_push( w, &work.todo, i );
+
+	ok = ok && fswatcher_snap_pass( w, &work );
+
+	fswatcher_free( w->allocator, work.todo.nodes );
+	fswatcher_free( w->allocator, work.gone.nodes );
+	fswatcher_free( w->allocator, work.changes );
+	return ok;
+}
+
+/**
+ * Header of a snapshot-file written with fswatcher_create_params::snapshot_file. The file is laid out to be mapped
+ * and used as is, native byte-order:
+ *
+ * fswatcher_persist_header
+ * fswatcher_persist_entry[entries_cnt], sorted by path with strcmp().
+ * char names[names_size], zero-terminated paths relative to the root.
+ */
+struct fswatcher_persist_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entries_cnt;
+	uint32_t names_size;
+};
+
+struct fswatcher_persist_entry
+{
+	uint64_t inode;
+	uint64_t size;
+	int64_t  mtime;
+	uint32_t path_offset; ///< offset of path in names.
+	uint32_t path_len;    ///< length of path, excluding the terminating zero.
+	uint32_t is_dir;
+	uint32_t reserved;
+};
+
+#define FSWATCHER_PERSIST_MAGIC   0x53575346u // "FSWS"
+#define FSWATCHER_PERSIST_VERSION 1u
+
+/**
+ * Live state of one root in the same layout as the snapshot-file.
+ */
+struct fswatcher_persist_state
+{
+	fswatcher_persist_entry* entries;
+	uint32_t entries_cnt;
+	uint32_t entries_cap;
+
+	char*    names;
+	uint32_t names_size;
+	uint32_t names_cap;
+};
+
+static void fswatcher_persist_state_free( fswatcher_t w, fswatcher_persist_state* st )
+{
+	fswatcher_free( w->allocator, st->entries );
+	fswatcher_free( w->allocator, st->names );
+}
+
+static bool fswatcher_persist_append( fswatcher_t w, fswatcher_persist_state* st, const char* dir, size_t dir_len, const char* name, uint32_t name_len, const fswatcher_snap_entry* e )
+{
+	size_t path_len = dir_len + name_len;
+	size_t names_size = st->names_size + path_len + 1;
+	if( names_size > 0xFFFFFFFFu )
+		return false;
+	if( names_size > st->names_cap )
+	{
+		uint32_t new_cap = st->names_cap ? st->names_cap : 4096;
+		while( new_cap < names_size )
+			new_cap *= 2;
+		char* names = (char*)fswatcher_realloc( w->allocator, st->names, st->names_cap, new_cap );
+		if( names == 0x0 )
+			return false;
+		st->names     = names;
+		st->names_cap = new_cap;
+	}
+	if( st->entries_cnt == st->entries_cap )
+	{
+		uint32_t new_cap = st->entries_cap ? st->entries_cap * 2 : 256;
+		fswatcher_persist_entry* entries = (fswatcher_persist_entry*)fswatcher_realloc( w->allocator, st->entries, sizeof( fswatcher_persist_entry ) * st->entries_cap, sizeof( fswatcher_persist_entry ) * new_cap );
+		if( entries == 0x0 )
+			return false;
+		st->entries     = entries;
+		st->entries_cap = new_cap;
+	}
+
+	fswatcher_persist_entry* pe = &st->entries[st->entries_cnt++];
+	memset( pe, 0x0, sizeof( fswatcher_persist_entry ) );
+	pe->inode       = e->inode;
+	pe->size        = e->size;
+	pe->mtime       = e->mtime;
+	pe->is_dir      = e->is_dir;
+	pe->path_offset = st->names_size;
+	pe->path_len    = (uint32_t)path_len;
+
+	char* out = st->names + st->names_size;
+	memcpy( out, dir, dir_len );
+	memcpy( out + dir_len, name, name_len );
+	out[path_len] = '\0';
+	st->names_size = (uint32_t)names_size;
+	return true;
+}
+
+static bool fswatcher_persist_less( const fswatcher_persist_state* st, uint32_t a, uint32_t b )
+{
+	return strcmp( st->names + st->entries[a].path_offset, st->names + st->entries[b].path_offset ) < 0;
+}
+
+static void fswatcher_persist_sift( fswatcher_persist_state* st, uint32_t root, uint32_t end )
+{
+	while( true )
+	{
+		uint32_t child = root * 2 + 1;
+		if( child >= end )
+			return;
+		if( child + 1 < end && fswatcher_persist_less( st, child, child + 1 ) )
+			++child;
+		if( !fswatcher_persist_less( st, root, child ) )
+			return;
+		fswatcher_persist_entry tmp = st->entries[root];
+		st->entries[root]  = st->entries[child];
+		st->entries[child] = tmp;
+		root = child;
+	}
+}
+
+/**
+ * Collect the in-memory snapshot of all directories in root into st, sorted by path relative to the root.
+ */
+static bool fswatcher_persist_collect( fswatcher_t w, uint32_t root, fswatcher_persist_state* st )
+{
+	uint32_t top = w->roots[root].node;
+	if( top == FSWATCHER_NO_NODE )
+		return true;
+	size_t prefix_len = fswatcher_node_path_len( w, top );
+
+	for( uint32_t i = 0; i < w->nodes_cnt && i < w->snaps_cap; ++i )
+	{
+		if( w->nodes[i].wd <= 0 || w->nodes[i].root != root )
+			continue;
+
+		size_t dir_len = fswatcher_node_path_len( w, i );
+		char* dir = fswatcher_reserve_path_buffer( w, &w->path, dir_len );
+		if( dir == 0x0 )
+			return false;
+		fswatcher_write_node_path( w, i, dir + dir_len );
+
+		const fswatcher_snap_dir* snap = &w->snaps[i];
+		for( uint32_t e = 0; e < snap->entries_cnt; ++e )
+		{
+			const fswatcher_snap_entry* entry = &snap->entries[e];
+			if( !fswatcher_persist_append( w, st, w->path.ptr + prefix_len, dir_len - prefix_len, snap->names + entry->name_offset, entry->name_len, entry ) )
+				return false;
+		}
+	}
+
+	// ... heapsort, no extra memory and no comparison-context needed ...
+	for( uint32_t i = st->entries_cnt / 2; i > 0; --i )
+		fswatcher_persist_sift( st, i - 1, st->entries_cnt );
+	for( uint32_t end = st->entries_cnt; end > 1; --end )
+	{
+		fswatcher_persist_entry tmp = st->entries[0];
+		st->entries[0]       = st->entries[end - 1];
+		st->entries[end - 1] = tmp;
+		fswatcher_persist_sift( st, 0, end - 1 );
+	}
+	return true;
+}
+
+static bool fswatcher_write_all( int fd, const void* data, size_t size )
+{
+	const char* ptr = (const char*)data;
+	while( size > 0 )
+	{
+		ssize_t written = write( fd, ptr, size );
+		if( written < 0 )
+		{
+			if( errno == EINTR )
+				continue;
+			return false;
+		}
+		ptr  += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+/**
+ * Write the state of root 0 to the snapshot-file, via a temporary file so that a crash never leaves a half written
+ * snapshot behind.
+ */
+static void fswatcher_persist_save( fswatcher_t w )
+{
+	if( w->snapshot_file == 0x0 || !w->persist_ready || !w->roots[0].used )
+		return;
+
+	fswatcher_persist_state st;
+	memset( &st, 0x0, sizeof( st ) );
+	size_t file_len = strlen( w->snapshot_file );
+	char* tmp_file = (char*)fswatcher_realloc( w->allocator, 0x0, 0, file_len + 5 );
+	if( tmp_file != 0x0 && fswatcher_persist_collect( w, 0, &st ) )
+	{
+		memcpy( tmp_file, w->snapshot_file, file_len );
+		memcpy( tmp_file + file_len, ".tmp", 5 );
+
+		fswatcher_persist_header header;
+		header.magic       = FSWATCHER_PERSIST_MAGIC;
+		header.version     = FSWATCHER_PERSIST_VERSION;
+		header.entries_cnt = st.entries_cnt;
+		header.names_size  = st.names_size;
+
+		int fd = open( tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+		if( fd >= 0 )
+		{
+			bool ok = fswatcher_write_all( fd, &header, sizeof( header ) ) &&
+			          fswatcher_write_all( fd, st.entries, sizeof( fswatcher_persist_entry ) * st.entries_cnt ) &&
+			          fswatcher_write_all( fd, st.names, st.names_size );
+			ok = close( fd ) == 0 && ok;
+			if( !ok || rename( tmp_file, w->snapshot_file ) != 0 )
+				unlink( tmp_file );
+		}
+	}
+	fswatcher_free( w->allocator, tmp_file );
+	fswatcher_persist_state_free( w, &st );
+}
+
+static bool fswatcher_persist_queue( fswatcher_t w, const char* root_path, size_t root_len, fswatcher_event_type type, const char* path, uint32_t path_len )
+{
+	char* full = fswatcher_reserve_path_buffer( w, &w->path, root_len + path_len + 1 );
+	if( full == 0x0 )
+		return false;
+	memmove( full, root_path, root_len );
+	memcpy( full + root_len, path, path_len + 1 );
+	return fswatcher_queue_push( w, 0, type, full, 0x0 );
+}
+
+/**
+ * Diff root 0 against the snapshot-file and queue events for all changes, a missing or invalid file queues nothing.
+ */
+static bool fswatcher_persist_load( fswatcher_t w )
+{
+	int fd = open( w->snapshot_file, O_RDONLY | O_CLOEXEC );
+	if( fd < 0 )
+		return true;
+
+	struct stat fst;
+	void* map = MAP_FAILED;
+	if( fstat( fd, &fst ) == 0 && (size_t)fst.st_size >= sizeof( fswatcher_persist_header ) )
+		map = mmap( 0x0, (size_t)fst.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( map == MAP_FAILED )
+		return true;
+
+	size_t map_size = (size_t)fst.st_size;
+	const fswatcher_persist_header* header = (const fswatcher_persist_header*)map;
+	const fswatcher_persist_entry* old = (const fswatcher_persist_entry*)( header + 1 );
+	bool valid = header->magic == FSWATCHER_PERSIST_MAGIC && header->version == FSWATCHER_PERSIST_VERSION &&
+	             map_size == sizeof( fswatcher_persist_header ) + sizeof( fswatcher_persist_entry ) * header->entries_cnt + header->names_size;
+	const char* old_names = valid ? (const char*)( old + header->entries_cnt ) : 0x0;
+	for( uint32_t i = 0; valid && i < header->entries_cnt; ++i )
+		valid = (uint64_t)old[i].path_offset + old[i].path_len < header->names_size && old_names[old[i].path_offset + old[i].path_len] == '\0';
+
+	fswatcher_persist_state st;
+	memset( &st, 0x0, sizeof( st ) );
+	bool ok = !valid || fswatcher_persist_collect( w, 0, &st );
+
+	// ... root path is copied out as w->path is used to build the paths of events ...
+	char* root_path = 0x0;
+	size_t root_len = 0;
+	if( ok && valid && w->roots[0].node != FSWATCHER_NO_NODE )
+	{
+		root_len  = fswatcher_node_path_len( w, w->roots[0].node );
+		root_path = (char*)fswatcher_realloc( w->allocator, 0x0, 0, root_len );
+		ok = root_path != 0x0;
+		if( ok )
+			fswatcher_write_node_path( w, w->roots[0].node, root_path + root_len );
+	}
+
+	// ... both sides are sorted by path, a single merge finds all changes ...
+	uint32_t i = 0;
+	uint32_t j = 0;
+	while( ok && root_path != 0x0 && ( i < header->entries_cnt || j < st.entries_cnt ) )
+	{
+		const fswatcher_persist_entry* o = i < header->entries_cnt ? &old[i] : 0x0;
+		const fswatcher_persist_entry* n = j < st.entries_cnt ? &st.entries[j] : 0x0;
+		int cmp = o == 0x0 ? 1 : ( n == 0x0 ? -1 : strcmp( old_names + o->path_offset, st.names + n->path_offset ) );
+
+		bool removed  = cmp < 0 || ( cmp == 0 && ( o->inode != n->inode || o->is_dir != n->is_dir ) );
+		bool created  = cmp > 0 || ( cmp == 0 && removed );
+		bool modified = cmp == 0 && !removed && !n->is_dir && ( o->size != n->size || o->mtime != n->mtime );
+
+		if( removed )
+			ok = fswatcher_persist_queue( w, root_path, root_len, FSWATCHER_EVENT_REMOVE, old_names + o->path_offset, o->path_len );
+		if( ok && created )
+			ok = fswatcher_persist_queue( w, root_path, root_len, FSWATCHER_EVENT_CREATE, st.names + n->path_offset, n->path_len );
+		if( ok && modified )
+			ok = fswatcher_persist_queue( w, root_path, root_len, FSWATCHER_EVENT_MODIFY, st.names + n->path_offset, n->path_len );
+
+		if( cmp <= 0 ) ++i;
+		if( cmp >= 0 ) ++j;
+	}
+
+	fswatcher_free( w->allocator, root_path );
+	fswatcher_persist_state_free( w, &st );
+	munmap( map, map_size );
+	return ok;
+}
+
+/**
+ * Report a IN_MOVED_FROM that never got a pair as a move out of the watched dirs, a moved directory has its subtree
+ * dropped.
+ *
+ * @return false if sink could not consume the event.
+ */
+static bool fswatcher_flush_move_src( fswatcher_t watcher, fswatcher_sink* sink )
+{
+	if( !watcher->move_src_valid )
+		return true;
+	if( watcher->report_moves && !fswatcher_sink_emit( sink, watcher->move_src_root, FSWATCHER_EVENT_MOVE, watcher->move_src.ptr, 0x0 ) )
+		return false;
+	if( watcher->move_src_node != FSWATCHER_NO_NODE )
+		fswatcher_remove_subtree( watcher, watcher->move_src_node );
+	watcher->move_src_valid = false;
+	watcher->move_cookie    = 0;
+	watcher->move_src_node  = FSWATCHER_NO_NODE;
+	return true;
+}
+
+/**
+ * Watch directory name, moved into directory-node parent watched by wd, and everything below it.
+ */
+static void fswatcher_add_moved_dir( fswatcher_t watcher, uint32_t parent, uint32_t root, int wd, const char* name, uint32_t name_len )
+{
+	uint32_t path_root;
+	const char* dir = fswatcher_build_full_path( watcher, &watcher->path, wd, "", 0, &path_root );
+	if( dir == 0x0 )
+		return;
+
+	char path_buffer[4096];
+	size_t dir_len  = strlen( dir );
+	size_t name_size = strnlen( name, name_len );
+	if( dir_len + name_size + 2 > sizeof( path_buffer ) )
+		return;
+	memcpy( path_buffer, dir, dir_len );
+	memcpy( path_buffer + dir_len, name, name_size );
+	path_buffer[dir_len + name_size]     = '/';
+	path_buffer[dir_len + name_size + 1] = '\0';
+	fswatcher_recursive_add( watcher, parent, root, path_buffer, dir_len, dir_len + name_size + 1, sizeof( path_buffer ) );
+}
+
+static void fswatcher_new_dir_push( fswatcher_t w, uint32_t node )
+{
+	if( w->new_dirs_cnt == w->new_dirs_cap )
+	{
+		size_t new_cap = w->new_dirs_cap ? w->new_dirs_cap * 2 : 16;
+		fswatcher_new_dir* dirs = (fswatcher_new_dir*)fswatcher_realloc( w->allocator, w->new_dirs, sizeof( fswatcher_new_dir ) * w->new_dirs_cap, sizeof( fswatcher_new_dir ) * new_cap );
+		if( dirs == 0x0 )
+			return;
+		w->new_dirs     = dirs;
+		w->new_dirs_cap = new_cap;
+	}
+	w->new_dirs[w->new_dirs_cnt].node = node;
+	w->new_dirs[w->new_dirs_cnt].wd   = w->nodes[node].wd;
+	++w->new_dirs_cnt;
+}
+
+static bool fswatcher_new_dirs_pending( fswatcher_t w )
+{
+	return w->new_dirs_cnt > 0 || w->new_dir_stream != 0x0;
+}
+
+/**
+ * List directories created after their parent was watched and queue a CREATE event for each item found, up to budget
+ * items. Items were created before the watch was added or while listing, so nothing created in a new directory is
+ * missed, sub-directories are watched and listed in turn.
+ *
+ * @note Items created after the watch was added and before they were listed are reported twice.
+ */
+static void fswatcher_list_new_dirs( fswatcher_t w, size_t* budget )
+{
+	while( *budget > 0 )
+	{
+		fswatcher_new_dir* dir = &w->new_dir;
+		if( w->new_dir_stream == 0x0 )
+		{
+			if( w->new_dirs_cnt == 0 )
+				return;
+			*dir = w->new_dirs[--w->new_dirs_cnt];
+
+			// ... removed or unwatched since ...
+			if( w->nodes[dir->node].wd != dir->wd )
+				continue;
+
+			uint32_t root;
+			const char* path = fswatcher_build_full_path( w, &w->path, dir->wd, "", 0, &root );
+			w->new_dir_stream = path ? opendir( path ) : 0x0;
+			continue;
+		}
+
+		dirent* ent = w->nodes[dir->node].wd == dir->wd ? readdir( w->new_dir_stream ) : 0x0;
+		if( ent == 0x0 )
+		{
+			closedir( w->new_dir_stream );
+			w->new_dir_stream = 0x0;
+			continue;
+		}
+		if( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+			continue;
+
+		size_t name_len = strlen( ent->d_name );
+		bool is_dir = fswatcher_entry_is_dir( w, w->new_dir_stream, ent );
+		if( fswatcher_filtered( w, ent->d_name, name_len, is_dir ) )
+			continue;
+
+		uint32_t root;
+		const char* path = fswatcher_build_full_path( w, &w->path, dir->wd, ent->d_name, (uint32_t)name_len, &root );
+		if( path == 0x0 )
+			continue;
+		if( is_dir )
+		{
+			bool added;
+			uint32_t child = fswatcher_add( w, dir->node, root, path, ent->d_name, name_len, &added );
+			if( added )
+				fswatcher_new_dir_push( w, child );
+		}
+		if( w->snapshot )
+			fswatcher_snap_touch( w, dir->node, path, ent->d_name, (uint32_t)name_len );
+		fswatcher_queue_push( w, root, FSWATCHER_EVENT_CREATE, path, 0x0 );
+		--*budget;
+	}
+}
+
+/**
+ * Handle one inotify event.
+ *
+ * @return false if sink could not consume the event, in that case all state is left so that the event can be handled again.
+ */
+static bool fswatcher_process_event( fswatcher_t watcher, fswatcher_sink* sink, inotify_event* ev )
+{
+	bool is_dir       = ( ev->mask & IN_ISDIR );
+	bool is_create    = ( ev->mask & IN_CREATE );
+	bool is_remove    = ( ev->mask & IN_DELETE );
+	bool is_modify    = ( ev->mask & IN_MODIFY );
+	bool is_move_from = ( ev->mask & IN_MOVED_FROM );
+	bool is_move_to   = ( ev->mask & IN_MOVED_TO );
+	bool is_del_self  = ( ev->mask & IN_DELETE_SELF );
+
+	// ... filtered directories are never watched, so this only drops events for the items themselves ...
+	if( ev->len > 0 && fswatcher_filtered( watcher, ev->name, strnlen( ev->name, ev->len ), is_dir ) )
+		return true;
+
+	if( watcher->snapshot && ev->len > 0 )
+	{
+		// ... stat the item as it is now, touching it again if the event is retried does no harm ...
+		uint32_t root;
+		fswatcher_item* item = fswatcher_find_wd( watcher, ev->wd );
+		const char* path = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+		if( item != 0x0 && path != 0x0 )
+			fswatcher_snap_touch( watcher, item->node, path, ev->name, (uint32_t)strlen( ev->name ) );
+	}
+
+	if( is_dir && !is_move_from && !is_move_to )
+	{
+		if( is_create )
+		{
+			uint32_t root;
+			const char* src = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+			fswatcher_item* parent = fswatcher_find_wd( watcher, ev->wd );
+			if( src == 0x0 || parent == 0x0 )
+				return true;
+
+			// ... adding the same dir again if the event is retried will give back the already registered node ...
+			bool added;
+			uint32_t node = fswatcher_add( watcher, parent->node, root, src, ev->name, strlen( ev->name ), &added );
+			if( added )
+				fswatcher_new_dir_push( watcher, node );
+			return fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_CREATE, src, 0x0 );
+		}
+		else if( is_remove )
+			return fswatcher_emit_src( watcher, sink, FSWATCHER_EVENT_REMOVE, ev );
+		else if( is_del_self )
+			fswatcher_remove( watcher, ev->wd );
+		return true;
+	}
+
+	// ... an overflow affects all roots, it is reported for root 0 unless the lost events could be recovered from the
+	//     snapshot ...
+	if( ev->mask & IN_Q_OVERFLOW )
+	{
+		if( watcher->snapshot && fswatcher_crawl_complete( watcher ) && fswatcher_snap_rescan_all( watcher ) )
+		{
+			++watcher->stats.overflows;
+			return true;
+		}
+		if( !fswatcher_sink_emit( sink, 0, FSWATCHER_EVENT_BUFFER_OVERFLOW, 0x0, 0x0 ) )
+			return false;
+		++watcher->stats.overflows;
+		return true;
+	}
+
+	if( is_create )
+		return fswatcher_emit_src( watcher, sink, FSWATCHER_EVENT_CREATE, ev );
+	if( is_remove || is_modify )
+	{
+		uint32_t root;
+		const char* src = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+		if( src == 0x0 )
+			return true;
+		if( is_modify )
+			return fswatcher_emit_modify( watcher, sink, root, src );
+		fswatcher_content_forget( watcher, src );
+		return fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_REMOVE, src, 0x0 );
+	}
+	if( ev->mask & IN_CLOSE_WRITE )
+	{
+		uint32_t root;
+		const char* src = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+		return src == 0x0 || fswatcher_write_done( watcher, sink, root, src );
+	}
+
+	if( ( is_move_from || is_move_to ) && !is_dir && !watcher->report_moves )
+		return true;
+
+	if( is_move_from )
+	{
+		// ... this is a new pair of a move, so the last one was move "outside" the current watch ...
+		if( !fswatcher_flush_move_src( watcher, sink ) )
+			return false;
+
+		// ... this is the first potential pair of a move ...
+		fswatcher_item* src_dir = fswatcher_find_wd( watcher, ev->wd );
+		watcher->move_src_valid = fswatcher_build_full_path( watcher, &watcher->move_src, ev->wd, ev->name, ev->len, &watcher->move_src_root ) != 0x0;
+		if( watcher->move_src_valid && !is_dir )
+			fswatcher_content_forget( watcher, watcher->move_src.ptr );
+		watcher->move_cookie    = ev->cookie;
+		watcher->move_src_node  = is_dir && src_dir ? fswatcher_find_child( watcher, src_dir->node, ev->name, (uint32_t)strlen( ev->name ) ) : FSWATCHER_NO_NODE;
+	}
+	else if( is_move_to )
+	{
+		uint32_t dst_root = FSWATCHER_NO_ROOT;
+		fswatcher_item* dst_dir = fswatcher_find_wd( watcher, ev->wd );
+		if( dst_dir == 0x0 )
+			return true;
+		dst_root = watcher->nodes[dst_dir->node].root;
+
+		// ... a move between roots is reported as a move out of the src root and a move into the dst root ...
+		if( watcher->move_src_valid && watcher->move_cookie == ev->cookie && watcher->move_src_root == dst_root )
+		{
+			// ... this is the dst for a move, a moved directory keeps its watches and only its node is moved ...
+			uint32_t root;
+			const char* dst = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+			if( dst == 0x0 )
+				return true;
+			if( watcher->move_src_node != FSWATCHER_NO_NODE && !fswatcher_move_node( watcher, watcher->move_src_node, dst_dir->node, ev->name, strlen( ev->name ) ) )
+			{
+				// ... out of memory, fall back to dropping the subtree and watching it again from dst ...
+				fswatcher_remove_subtree( watcher, watcher->move_src_node );
+				fswatcher_add_moved_dir( watcher, dst_dir->node, root, ev->wd, ev->name, ev->len );
+				dst = fswatcher_build_full_path( watcher, &watcher->path, ev->wd, ev->name, ev->len, &root );
+				watcher->move_src_node = FSWATCHER_NO_NODE;
+			}
+			if( watcher->report_moves && !fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_MOVE, watcher->move_src.ptr, dst ) )
+				return false;
+			watcher->move_src_valid = false;
+			watcher->move_cookie    = 0;
+			watcher->move_src_node  = FSWATCHER_NO_NODE;
+		}
+		else
+		{
+			// ... this is a "move to outside of watch" ...
+			if( !fswatcher_flush_move_src( watcher, sink ) )
+				return false;
+
+			// ... this is a "move from outside to watch", a directory is watched as if it was created ...
+			if( is_dir )
+				fswatcher_add_moved_dir( watcher, dst_dir->node, dst_root, ev->wd, ev->name, ev->len );
+			return !watcher->report_moves || fswatcher_emit_dst( watcher, sink, FSWATCHER_EVENT_MOVE, ev );
+		}
+	}
+	return true;
+}
+
+static uint64_t fswatcher_time_ms()
+{
+	timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t fswatcher_time_ns()
+{
+	timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t fswatcher_hash_path( const char* path )
+{
+	// ... FNV-1a ...
+	uint64_t hash = 14695981039346656037ull;
+	for( ; *path; ++path )
+		hash = ( hash ^ (uint8_t)*path ) * 1099511628211ull;
+	return hash;
+}
+
+static const char* fswatcher_coalesce_path( fswatcher_coalescer* c, uint32_t offset )
+{
+	return offset == FSWATCHER_NO_PATH ? 0x0 : c->arena + offset;
+}
+
+static void fswatcher_coalesce_index_insert( fswatcher_coalescer* c, uint32_t entry )
+{
+	size_t mask = c->index_cap - 1;
+	size_t i = (size_t)c->entries[entry].hash & mask;
+	while( c->index[i] != FSWATCHER_NO_NODE )
+		i = ( i + 1 ) & mask;
+	c->index[i] = entry;
+	c->entries[entry].indexed = true;
+	++c->index_cnt;
+}
+
+static void fswatcher_coalesce_index_rebuild( fswatcher_coalescer* c )
+{
+	memset( c->index, 0xFF, sizeof( uint32_t ) * c->index_cap );
+	c->index_cnt = 0;
+	for( size_t i = 0; i < c->entries_cnt; ++i )
+		if( c->entries[i].indexed )
+			fswatcher_coalesce_index_insert( c, (uint32_t)i );
+}
+
+static size_t fswatcher_coalesce_index_find( fswatcher_coalescer* c, uint64_t hash, const char* path )
+{
+	size_t mask = c->index_cap - 1;
+	for( size_t i = (size_t)hash & mask; c->index[i] != FSWATCHER_NO_NODE; i = ( i + 1 ) & mask )
+	{
+		fswatcher_coalesce_entry* e = &c->entries[c->index[i]];
+		if( e->hash == hash && strcmp( fswatcher_coalesce_path( c, e->src ), path ) == 0 )
+			return i;
+	}
+	return (size_t)-1;
+}
+
+static void fswatcher_coalesce_index_erase( fswatcher_coalescer* c, size_t slot )
+{
+	c->entries[c->index[slot]].indexed = false;
+	--c->index_cnt;
+
+	// ... backward shift deletion, same as for the watch-table ...
+	size_t mask = c->index_cap - 1;
+	size_t hole = slot;
+	for( size_t i = ( hole + 1 ) & mask; c->index[i] != FSWATCHER_NO_NODE; i = ( i + 1 ) & mask )
+	{
+		size_t home = (size_t)c->entries[c->index[i]].hash & mask;
+		if( ( ( i - home ) & mask ) >= ( ( i - hole ) & mask ) )
+		{
+			c->index[hole] = c->index[i];
+			hole = i;
+		}
+	}
+	c->index[hole] = FSWATCHER_NO_NODE;
+}
+
+static bool fswatcher_coalesce_reserve( fswatcher_coalescer* c, size_t path_bytes )
+{
+	fswatcher_allocator* allocator = c->watcher->allocator;
+	if( c->entries_cnt + 1 > c->entries_cap )
+	{
+		size_t new_cap = c->entries_cap ? c->entries_cap * 2 : 64;
+		fswatcher_coalesce_entry* entries = (fswatcher_coalesce_entry*)fswatcher_realloc( allocator, c->entries, sizeof( fswatcher_coalesce_entry ) * c->entries_cap, sizeof( fswatcher_coalesce_entry ) * new_cap );
+		if( entries == 0x0 )
+			return false;
+		c->entries = entries;
+		c->entries_cap = new_cap;
+	}
+
+	if( c->arena_size + path_bytes > c->arena_cap )
+	{
+		size_t new_cap = c->arena_cap ? c->arena_cap : 4096;
+		while( new_cap < c->arena_size + path_bytes )
+			new_cap *= 2;
+		if( new_cap > FSWATCHER_NO_PATH )
+			return false;
+		char* arena = (char*)fswatcher_realloc( allocator, c->arena, c->arena_cap, new_cap );
+		if( arena == 0x0 )
+			return false;
+		c->arena = arena;
+		c->arena_cap = new_cap;
+	}
+
+	if( ( c->index_cnt + 1 ) * 2 > c->index_cap )
+	{
+		size_t new_cap = c->index_cap ? c->index_cap * 2 : 128;
+		uint32_t* index = (uint32_t*)fswatcher_realloc( allocator, 0x0, 0, sizeof( uint32_t ) * new_cap );
+		if( index == 0x0 )
+			return false;
+		fswatcher_free( allocator, c->index );
+		c->index = index;
+		c->index_cap = new_cap;
+		fswatcher_coalesce_index_rebuild( c );
+	}
+	return true;
+}
+
+static uint32_t fswatcher_coalesce_push_path( fswatcher_coalescer* c, const char* path )
+{
+	if( path == 0x0 )
+		return FSWATCHER_NO_PATH;
+	size_t len = strlen( path ) + 1;
+	uint32_t offset = (uint32_t)c->arena_size;
+	memcpy( c->arena + c->arena_size, path, len );
+	c->arena_size += len;
+	return offset;
+}
+
+static void fswatcher_coalesce_append( fswatcher_coalescer* c, uint32_t root, fswatcher_event_type type, const char* src, const char* dst, uint64_t hash, uint64_t deadline )
+{
+	fswatcher_coalesce_entry* e = &c->entries[c->entries_cnt++];
+	e->type     = type;
+	e->root     = root;
+	e->indexed  = false;
+	e->released = false;
+	e->hash     = hash;
+	e->deadline = deadline;
+	e->src      = fswatcher_coalesce_push_path( c, src );
+	e->dst      = fswatcher_coalesce_push_path( c, dst );
+}
+
+/**
+ * Release pending entry for path right away and stop later events from merging into it, used to keep the order of
+ * events for a path that is part of a move.
+ */
+static void fswatcher_coalesce_flush_path( fswatcher_coalescer* c, const char* path )
+{
+	if( path == 0x0 )
+		return;
+	size_t slot = fswatcher_coalesce_index_find( c, fswatcher_hash_path( path ), path );
+	if( slot == (size_t)-1 )
+		return;
+	c->entries[c->index[slot]].deadline = 0;
+	fswatcher_coalesce_index_erase( c, slot );
+}
+
+static bool fswatcher_coalesce_emit( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_coalescer* c = (fswatcher_coalescer*)sink;
+
+	size_t path_bytes = ( src ? strlen( src ) + 1 : 0 ) + ( dst ? strlen( dst ) + 1 : 0 );
+	if( !fswatcher_coalesce_reserve( c, path_bytes ) )
+	{
+		// ... out of memory, pass the event straight through rather than dropping it ...
+		return fswatcher_sink_emit( c->target, root, type, src, dst );
+	}
+
+	if( type == FSWATCHER_EVENT_MOVE || type == FSWATCHER_EVENT_BUFFER_OVERFLOW )
+	{
+		// ... moves and overflows are never merged, release everything that touches the same paths before them ...
+		if( type == FSWATCHER_EVENT_BUFFER_OVERFLOW )
+		{
+			for( size_t i = 0; i < c->entries_cnt; ++i )
+				c->entries[i].deadline = 0;
+			memset( c->index, 0xFF, sizeof( uint32_t ) * c->index_cap );
+			for( size_t i = 0; i < c->entries_cnt; ++i )
+				c->entries[i].indexed = false;
+			c->index_cnt = 0;
+		}
+		fswatcher_coalesce_flush_path( c, src );
+		fswatcher_coalesce_flush_path( c, dst );
+		fswatcher_coalesce_append( c, root, type, src, dst, 0, 0 );
+		return true;
+	}
+
+	uint64_t hash     = fswatcher_hash_path( src );
+	uint64_t deadline = fswatcher_time_ms() + c->quiet_ms;
+	size_t   slot     = fswatcher_coalesce_index_find( c, hash, src );
+	if( slot != (size_t)-1 )
+	{
+		fswatcher_coalesce_entry* e = &c->entries[c->index[slot]];
+		fswatcher_event_type prev = e->type;
+		if( ( prev == FSWATCHER_EVENT_CREATE || prev == FSWATCHER_EVENT_MODIFY ) && ( type == FSWATCHER_EVENT_MODIFY || type == prev ) )
+		{
+			// ... modify + modify -> modify, create + modify -> create ...
+			e->deadline = deadline;
+			return true;
+		}
+		if( prev == FSWATCHER_EVENT_CREATE && type == FSWATCHER_EVENT_REMOVE )
+		{
+			// ... created and removed within the quiet period, nothing to report ...
+			e->released = true;
+			fswatcher_coalesce_index_erase( c, slot );
+			return true;
+		}
+		if( prev == FSWATCHER_EVENT_MODIFY && type == FSWATCHER_EVENT_REMOVE )
+		{
+			e->type = FSWATCHER_EVENT_REMOVE;
+			e->deadline = deadline;
+			return true;
+		}
+
+		// ... no merge possible, i.e. remove + create, keep both in order ...
+		fswatcher_coalesce_index_erase( c, slot );
+	}
+
+	fswatcher_coalesce_append( c, root, type, src, dst, hash, deadline );
+	fswatcher_coalesce_index_insert( c, (uint32_t)( c->entries_cnt - 1 ) );
+	return true;
+}
+
+/**
+ * Deliver all entries that has been quiet long enough to target, in the order they were first seen.
+ */
+static void fswatcher_coalesce_release( fswatcher_coalescer* c, fswatcher_sink* target )
+{
+	uint64_t now = fswatcher_time_ms();
+	bool released_any = false;
+	for( size_t i = 0; i < c->entries_cnt && !target->stop; ++i )
+	{
+		fswatcher_coalesce_entry* e = &c->entries[i];
+		if( e->released )
+		{
+			// ... dropped by a merge, compact it away ...
+			released_any = true;
+			continue;
+		}
+		if( e->deadline > now )
+			continue;
+
+		if( !fswatcher_sink_emit( target, e->root, e->type, fswatcher_coalesce_path( c, e->src ), fswatcher_coalesce_path( c, e->dst ) ) )
+			break;
+
+		if( e->indexed )
+		{
+			size_t slot = fswatcher_coalesce_index_find( c, e->hash, fswatcher_coalesce_path( c, e->src ) );
+			fswatcher_coalesce_index_erase( c, slot );
+		}
+		e->released = true;
+		released_any = true;
+	}
+
+	if( !released_any )
+		return;
+
+	// ... compact entries and arena, keeping order ...
+	size_t entries_cnt = 0;
+	size_t arena_size  = 0;
+	for( size_t i = 0; i < c->entries_cnt; ++i )
+	{
+		fswatcher_coalesce_entry e = c->entries[i];
+		if( e.released )
+			continue;
+
+		uint32_t* paths[2] = { &e.src, &e.dst };
+		for( int p = 0; p < 2; ++p )
+		{
+			if( *paths[p] == FSWATCHER_NO_PATH )
+				continue;
+			size_t len = strlen( c->arena + *paths[p] ) + 1;
+			memmove( c->arena + arena_size, c->arena + *paths[p], len );
+			*paths[p] = (uint32_t)arena_size;
+			arena_size += len;
+		}
+		c->entries[entries_cnt++] = e;
+	}
+	c->entries_cnt = entries_cnt;
+	c->arena_size  = arena_size;
+	fswatcher_coalesce_index_rebuild( c );
+}
+
+/**
+ * Time in ms until the next pending entry is due, -1 if there is no pending entries.
+ */
+static int fswatcher_coalesce_timeout( fswatcher_coalescer* c )
+{
+	uint64_t next = (uint64_t)-1;
+	for( size_t i = 0; i < c->entries_cnt; ++i )
+		if( !c->entries[i].released && c->entries[i].deadline < next )
+			next = c->entries[i].deadline;
+
+	if( next == (uint64_t)-1 )
+		return -1;
+
+	uint64_t now = fswatcher_time_ms();
+	return next <= now ? 0 : (int)( next - now );
+}
+
+/**
+ * Size of regular file at path, -1 if it is gone or not a regular file.
+ */
+static int64_t fswatcher_file_size( const char* path )
+{
+	struct stat st;
+	if( stat( path, &st ) != 0 || !S_ISREG( st.st_mode ) )
+		return -1;
+	return (int64_t)st.st_size;
+}
+
+static void fswatcher_settle_index_insert( fswatcher_settler* s, uint32_t entry )
+{
+	size_t mask = s->index_cap - 1;
+	size_t i = (size_t)s->entries[entry].hash & mask;
+	while( s->index[i] != FSWATCHER_NO_NODE )
+		i = ( i + 1 ) & mask;
+	s->index[i] = entry;
+	++s->index_cnt;
+}
+
+static void fswatcher_settle_index_rebuild( fswatcher_settler* s )
+{
+	memset( s->index, 0xFF, sizeof( uint32_t ) * s->index_cap );
+	s->index_cnt = 0;
+	for( size_t i = 0; i < s->entries_cnt; ++i )
+		if( !s->entries[i].released )
+			fswatcher_settle_index_insert( s, (uint32_t)i );
+}
+
+/**
+ * Find pending entry for path, (size_t)-1 if there is none.
+ */
+static size_t fswatcher_settle_index_find( fswatcher_settler* s, uint64_t hash, const char* path )
+{
+	if( s->index_cap == 0 )
+		return (size_t)-1;
+	size_t mask = s->index_cap - 1;
+	for( size_t i = (size_t)hash & mask; s->index[i] != FSWATCHER_NO_NODE; i = ( i + 1 ) & mask )
+	{
+		fswatcher_settle_entry* e = &s->entries[s->index[i]];
+		if( e->hash == hash && strcmp( s->arena + e->path, path ) == 0 )
+			return s->index[i];
+	}
+	return (size_t)-1;
+}
+
+static bool fswatcher_settle_reserve( fswatcher_t w, size_t path_bytes )
+{
+	fswatcher_settler* s = &w->settler;
+	if( s->entries_cnt + 1 > s->entries_cap )
+	{
+		size_t new_cap = s->entries_cap ? s->entries_cap * 2 : 16;
+		fswatcher_settle_entry* entries = (fswatcher_settle_entry*)fswatcher_realloc( w->allocator, s->entries, sizeof( fswatcher_settle_entry ) * s->entries_cap, sizeof( fswatcher_settle_entry ) * new_cap );
+		if( entries == 0x0 )
+			return false;
+		s->entries = entries;
+		s->entries_cap = new_cap;
+	}
+
+	if( s->arena_size + path_bytes > s->arena_cap )
+	{
+		size_t new_cap = s->arena_cap ? s->arena_cap : 4096;
+		while( new_cap < s->arena_size + path_bytes )
+			new_cap *= 2;
+		if( new_cap > FSWATCHER_NO_PATH )
+			return false;
+		char* arena = (char*)fswatcher_realloc( w->allocator, s->arena, s->arena_cap, new_cap );
+		if( arena == 0x0 )
+			return false;
+		s->arena = arena;
+		s->arena_cap = new_cap;
+	}
+
+	if( ( s->index_cnt + 1 ) * 2 > s->index_cap )
+	{
+		size_t new_cap = s->index_cap ? s->index_cap * 2 : 32;
+		uint32_t* index = (uint32_t*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( uint32_t ) * new_cap );
+		if( index == 0x0 )
+			return false;
+		fswatcher_free( w->allocator, s->index );
+		s->index = index;
+		s->index_cap = new_cap;
+		fswatcher_settle_index_rebuild( s );
+	}
+	return true;
+}
+
+/**
+ * Handle a file at path being closed after writing, reported right away or held until its size has settled.
+ *
+ * @return false if sink could not consume the event.
+ */
+static bool fswatcher_write_done( fswatcher_t w, fswatcher_sink* sink, uint32_t root, const char* path )
+{
+	fswatcher_settler* s = &w->settler;
+	if( s->settle_ms == 0 )
+		return fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_WRITE_DONE, path, 0x0 );
+
+	int64_t size = fswatcher_file_size( path );
+	if( size < 0 )
+		return true; // ... already gone, nothing to wait for ...
+
+	uint64_t hash     = fswatcher_hash_path( path );
+	uint64_t deadline = fswatcher_time_ms() + s->settle_ms;
+	size_t   pending  = fswatcher_settle_index_find( s, hash, path );
+	if( pending != (size_t)-1 )
+	{
+		// ... closed again, restart the period ...
+		s->entries[pending].size     = size;
+		s->entries[pending].deadline = deadline;
+		return true;
+	}
+
+	size_t path_bytes = strlen( path ) + 1;
+	if( !fswatcher_settle_reserve( w, path_bytes ) )
+	{
+		// ... out of memory, report it unsettled rather than dropping it ...
+		return fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_WRITE_DONE, path, 0x0 );
+	}
+
+	fswatcher_settle_entry* e = &s->entries[s->entries_cnt++];
+	e->root     = root;
+	e->released = false;
+	e->hash     = hash;
+	e->deadline = deadline;
+	e->size     = size;
+	e->path     = (uint32_t)s->arena_size;
+	memcpy( s->arena + s->arena_size, path, path_bytes );
+	s->arena_size += path_bytes;
+	fswatcher_settle_index_insert( s, (uint32_t)( s->entries_cnt - 1 ) );
+	return true;
+}
+
+/**
+ * Check all files whose period is over, files that kept their size are reported to sink and the others are checked
+ * again after another period.
+ *
+ * @return false if sink could not consume all settled files.
+ */
+static bool fswatcher_settle_release( fswatcher_t w, fswatcher_sink* sink )
+{
+	fswatcher_settler* s = &w->settler;
+	uint64_t now = fswatcher_time_ms();
+	bool released_any = false;
+	bool done = true;
+	for( size_t i = 0; i < s->entries_cnt; ++i )
+	{
+		fswatcher_settle_entry* e = &s->entries[i];
+		if( e->released )
+			continue;
+		if( e->deadline > now )
+			continue;
+
+		int64_t size = fswatcher_file_size( s->arena + e->path );
+		if( size >= 0 && size != e->size )
+		{
+			// ... still being written ...
+			e->size     = size;
+			e->deadline = now + s->settle_ms;
+			continue;
+		}
+
+		if( size >= 0 && ( sink->stop || !fswatcher_sink_emit( sink, e->root, FSWATCHER_EVENT_WRITE_DONE, s->arena + e->path, 0x0 ) ) )
+		{
+			done = false;
+			break;
+		}
+		e->released  = true;
+		released_any = true;
+	}
+
+	if( !released_any )
+		return done;
+
+	// ... compact entries and arena, keeping order ...
+	size_t entries_cnt = 0;
+	size_t arena_size  = 0;
+	for( size_t i = 0; i < s->entries_cnt; ++i )
+	{
+		fswatcher_settle_entry e = s->entries[i];
+		if( e.released )
+			continue;
+		size_t len = strlen( s->arena + e.path ) + 1;
+		memmove( s->arena + arena_size, s->arena + e.path, len );
+		e.path = (uint32_t)arena_size;
+		arena_size += len;
+		s->entries[entries_cnt++] = e;
+	}
+	s->entries_cnt = entries_cnt;
+	s->arena_size  = arena_size;
+	fswatcher_settle_index_rebuild( s );
+	return done;
+}
+
+/**
+ * Time in ms until the next file is due to be checked, -1 if no files are waiting to settle.
+ */
+static int fswatcher_settle_timeout( fswatcher_t w )
+{
+	fswatcher_settler* s = &w->settler;
+	uint64_t next = (uint64_t)-1;
+	for( size_t i = 0; i < s->entries_cnt; ++i )
+		if( !s->entries[i].released && s->entries[i].deadline < next )
+			next = s->entries[i].deadline;
+
+	if( next == (uint64_t)-1 )
+		return -1;
+
+	uint64_t now = fswatcher_time_ms();
+	return next <= now ? 0 : (int)( next - now );
+}
+
+#define FSWATCHER_HASH_P1 11400714785074694791ull
+#define FSWATCHER_HASH_P2 14029467366897019727ull
+#define FSWATCHER_HASH_P3 1609587929392839161ull
+#define FSWATCHER_HASH_P4 9650029242287828579ull
+#define FSWATCHER_HASH_P5 2870177450012600261ull
+#define FSWATCHER_ROTL64( x, r ) ( ( ( x ) << ( r ) ) | ( ( x ) >> ( 64 - ( r ) ) ) )
+
+/**
+ * Hash of the content of a file, fed in pieces as it is read. 4 independent lanes over 32 byte stripes so that the
+ * multiplies of the lanes can run in parallel, same structure and constants as xxh64 with seed 0.
+ */
+struct fswatcher_content_hasher
+{
+	uint64_t v[4];
+	uint64_t len; ///< bytes fed to the lanes so far.
+};
+
+static void fswatcher_hash_content_begin( fswatcher_content_hasher* h )
+{
+	h->v[0] = FSWATCHER_HASH_P1 + FSWATCHER_HASH_P2;
+	h->v[1] = FSWATCHER_HASH_P2;
+	h->v[2] = 0;
+	h->v[3] = 0 - FSWATCHER_HASH_P1;
+	h->len  = 0;
+}
+
+/**
+ * Feed len bytes at data to the lanes, len must be a multiple of 32.
+ */
+static void fswatcher_hash_content_stripes( fswatcher_content_hasher* h, const uint8_t* data, size_t len )
+{
+	for( const uint8_t* p = data; p < data + len; p += 32 )
+	{
+		for( int i = 0; i < 4; ++i )
+		{
+			uint64_t k;
+			memcpy( &k, p + i * 8, sizeof( k ) );
+			h->v[i] += k * FSWATCHER_HASH_P2;
+			h->v[i]  = FSWATCHER_ROTL64( h->v[i], 31 ) * FSWATCHER_HASH_P1;
+		}
+	}
+	h->len += (uint64_t)len;
+}
+
+/**
+ * Finish the hash with the last len bytes at data, len must be less than 32.
+ */
+static uint64_t fswatcher_hash_content_end( const fswatcher_content_hasher* hasher, const uint8_t* data, size_t len )
+{
+	uint64_t h;
+	if( hasher->len > 0 )
+	{
+		const uint64_t* v = hasher->v;
+		h = FSWATCHER_ROTL64( v[0], 1 ) + FSWATCHER_ROTL64( v[1], 7 ) + FSWATCHER_ROTL64( v[2], 12 ) + FSWATCHER_ROTL64( v[3], 18 );
+		for( int i = 0; i < 4; ++i )
+		{
+			uint64_t k = FSWATCHER_ROTL64( v[i] * FSWATCHER_HASH_P2, 31 ) * FSWATCHER_HASH_P1;
+			h = ( h ^ k ) * FSWATCHER_HASH_P1 + FSWATCHER_HASH_P4;
+		}
+	}
+	else
+		h = FSWATCHER_HASH_P5;
+
+	const uint8_t* p   = data;
+	const uint8_t* end = data + len;
+	h += hasher->len + (uint64_t)len;
+	for( ; p + 8 <= end; p += 8 )
+	{
+		uint64_t k;
+		memcpy( &k, p, sizeof( k ) );
+		k  = FSWATCHER_ROTL64( k * FSWATCHER_HASH_P2, 31 ) * FSWATCHER_HASH_P1;
+		h ^= k;
+		h  = FSWATCHER_ROTL64( h, 27 ) * FSWATCHER_HASH_P1 + FSWATCHER_HASH_P4;
+	}
+	if( p + 4 <= end )
+	{
+		uint32_t k;
+		memcpy( &k, p, sizeof( k ) );
+		h ^= (uint64_t)k * FSWATCHER_HASH_P1;
+		h  = FSWATCHER_ROTL64( h, 23 ) * FSWATCHER_HASH_P2 + FSWATCHER_HASH_P3;
+		p += 4;
+	}
+	for( ; p < end; ++p )
+	{
+		h ^= *p * FSWATCHER_HASH_P5;
+		h  = FSWATCHER_ROTL64( h, 11 ) * FSWATCHER_HASH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= FSWATCHER_HASH_P2;
+	h ^= h >> 29;
+	h *= FSWATCHER_HASH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+#undef FSWATCHER_ROTL64
+#undef FSWATCHER_HASH_P1
+#undef FSWATCHER_HASH_P2
+#undef FSWATCHER_HASH_P3
+#undef FSWATCHER_HASH_P4
+#undef FSWATCHER_HASH_P5
+
+static uint64_t fswatcher_content_path_hash( const char* path )
+{
+	uint64_t hash = fswatcher_hash_path( path );
+	return hash == 0 ? 1 : hash;
+}
+
+static size_t fswatcher_content_find( fswatcher_t w, uint64_t path_hash, const char* path )
+{
+	if( w->content_cap == 0 )
+		return (size_t)-1;
+	size_t mask = w->content_cap - 1;
+	for( size_t i = (size_t)path_hash & mask; w->content[i].path_hash != 0; i = ( i + 1 ) & mask )
+		if( w->content[i].path_hash == path_hash && strcmp( w->content_arena + w->content[i].path, path ) == 0 )
+			return i;
+	return (size_t)-1;
+}
+
+/**
+ * Read the current state of file at path into state. The content is only hashed if there is no prev or if only the mtime
+ * differs from prev, a file that was replaced or changed size has changed anyway and is not read, as a file being
+ * appended to is reported over and over and each read would be of the whole file.
+ *
+ * The file is read in chunks into buf with pread() rather than mapped as it might be truncated by its writer while it
+ * is hashed, the hash is then of what could be read.
+ *
+ * @return false if the file could not be read.
+ */
+static bool fswatcher_content_read( const char* path, uint8_t* buf, const fswatcher_content_entry* prev, fswatcher_content_entry* state )
+{
+	int fd = open( path, O_RDONLY | O_CLOEXEC );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) )
+	{
+		close( fd );
+		return false;
+	}
+	state->inode = (uint64_t)st.st_ino;
+	state->size  = (uint64_t)st.st_size;
+	state->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+	if( prev != 0x0 && prev->inode == state->inode && prev->size == state->size && prev->mtime == state->mtime )
+	{
+		close( fd );
+		state->content = prev->content;
+		state->hashed  = prev->hashed;
+		return true;
+	}
+
+	if( prev != 0x0 && ( prev->inode != state->inode || prev->size != state->size ) )
+	{
+		close( fd );
+		state->content = 0;
+		state->hashed  = false;
+		return true;
+	}
+
+	posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+	fswatcher_content_hasher hasher;
+	fswatcher_hash_content_begin( &hasher );
+	uint64_t offset = 0;
+	while( true )
+	{
+		// ... fill buf, a short read is either the end of the file or an interrupted read ...
+		size_t want = (size_t)( state->size - offset < FSWATCHER_CONTENT_CHUNK ? state->size - offset : FSWATCHER_CONTENT_CHUNK );
+		size_t fill = 0;
+		while( fill < want )
+		{
+			ssize_t res = pread( fd, buf + fill, want - fill, (off_t)( offset + fill ) );
+			if( res < 0 && errno == EINTR )
+				continue;
+			if( res < 0 )
+			{
+				close( fd );
+				return false;
+			}
+			if( res == 0 )
+				break;
+			fill += (size_t)res;
+		}
+		offset += fill;
+
+		if( fill == FSWATCHER_CONTENT_CHUNK && offset < state->size )
+		{
+			fswatcher_hash_content_stripes( &hasher, buf, fill );
+			continue;
+		}
+
+		size_t stripes = fill & ~(size_t)31;
+		fswatcher_hash_content_stripes( &hasher, buf, stripes );
+		state->content = fswatcher_hash_content_end( &hasher, buf + stripes, fill - stripes );
+		state->hashed  = true;
+		break;
+	}
+	close( fd );
+	return true;
+}
+
+static void fswatcher_content_erase( fswatcher_t w, size_t slot )
+{
+	--w->content_cnt;
+	w->content_arena_garbage += strlen( w->content_arena + w->content[slot].path ) + 1;
+
+	// ... backward shift deletion, same as for the watch-table ...
+	size_t mask = w->content_cap - 1;
+	size_t hole = slot;
+	for( size_t i = ( hole + 1 ) & mask; w->content[i].path_hash != 0; i = ( i + 1 ) & mask )
+	{
+		size_t home = (size_t)w->content[i].path_hash & mask;
+		if( ( ( i - home ) & mask ) >= ( ( i - hole ) & mask ) )
+		{
+			w->content[hole] = w->content[i];
+			hole = i;
+		}
+	}
+	w->content[hole].path_hash = 0;
+}
+
+static void fswatcher_content_forget( fswatcher_t w, const char* path )
+{
+	if( !w->content_hash )
+		return;
+	size_t slot = fswatcher_content_find( w, fswatcher_content_path_hash( path ), path );
+	if( slot != (size_t)-1 )
+		fswatcher_content_erase( w, slot );
+}
+
+/**
+ * Make room for path_bytes more in content_arena. The arena is rebuilt with only the paths still in the table when it
+ * is full, paths of erased entries are left behind until then.
+ */
+static bool fswatcher_content_reserve_path( fswatcher_t w, size_t path_bytes )
+{
+	if( w->content_arena_size + path_bytes <= w->content_arena_cap )
+		return true;
+
+	size_t live    = w->content_arena_size - w->content_arena_garbage + path_bytes;
+	size_t new_cap = 4096;
+	while( new_cap < live * 2 )
+		new_cap *= 2;
+	if( new_cap > FSWATCHER_NO_PATH )
+		return false;
+	char* arena = (char*)fswatcher_realloc( w->allocator, 0x0, 0, new_cap );
+	if( arena == 0x0 )
+		return false;
+
+	size_t arena_size = 0;
+	for( size_t i = 0; i < w->content_cap; ++i )
+	{
+		fswatcher_content_entry* e = &w->content[i];
+		if( e->path_hash == 0 )
+			continue;
+		size_t len = strlen( w->content_arena + e->path ) + 1;
+		memcpy( arena + arena_size, w->content_arena + e->path, len );
+		e->path = (uint32_t)arena_size;
+		arena_size += len;
+	}
+	fswatcher_free( w->allocator, w->content_arena );
+	w->content_arena         = arena;
+	w->content_arena_size    = arena_size;
+	w->content_arena_cap     = new_cap;
+	w->content_arena_garbage = 0;
+	return true;
+}
+
+/**
+ * Store state of file at path in slot, or in a new entry if slot is (size_t)-1.
+ */
+static void fswatcher_content_store( fswatcher_t w, size_t slot, fswatcher_content_entry* state, const char* path )
+{
+	if( slot != (size_t)-1 )
+	{
+		state->path = w->content[slot].path;
+		w->content[slot] = *state;
+		return;
+	}
+
+	size_t path_bytes = strlen( path ) + 1;
+	if( !fswatcher_content_reserve_path( w, path_bytes ) )
+		return; // ... out of memory, the file will just be reported next time ...
+
+	if( ( w->content_cnt + 1 ) * 2 > w->content_cap )
+	{
+		size_t new_cap = w->content_cap ? w->content_cap * 2 : 256;
+		fswatcher_content_entry* content = (fswatcher_content_entry*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( fswatcher_content_entry ) * new_cap );
+		if( content == 0x0 )
+			return; // ... out of memory, the file will just be reported next time ...
+		memset( content, 0x0, sizeof( fswatcher_content_entry ) * new_cap );
+		for( size_t i = 0; i < w->content_cap; ++i )
+		{
+			if( w->content[i].path_hash == 0 )
+				continue;
+			size_t j = (size_t)w->content[i].path_hash & ( new_cap - 1 );
+			while( content[j].path_hash != 0 )
+				j = ( j + 1 ) & ( new_cap - 1 );
+			content[j] = w->content[i];
+		}
+		fswatcher_free( w->allocator, w->content );
+		w->content     = content;
+		w->content_cap = new_cap;
+	}
+
+	state->path = (uint32_t)w->content_arena_size;
+	memcpy( w->content_arena + w->content_arena_size, path, path_bytes );
+	w->content_arena_size += path_bytes;
+
+	size_t mask = w->content_cap - 1;
+	size_t i = (size_t)state->path_hash & mask;
+	while( w->content[i].path_hash != 0 )
+		i = ( i + 1 ) & mask;
+	w->content[i] = *state;
+	++w->content_cnt;
+}
+
+/**
+ * Report a modify of file at path, with FSWATCHER_CREATE_CONTENT_HASH the event is dropped if the content is the same
+ * as last time the file was seen. The hash is only stored once the event has been consumed so that a retried event is
+ * compared against the same state.
+ *
+ * @return false if sink could not consume the event.
+ */
+static bool fswatcher_emit_modify( fswatcher_t w, fswatcher_sink* sink, uint32_t root, const char* path )
+{
+	if( !w->content_hash )
+		return fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_MODIFY, path, 0x0 );
+
+	if( w->content_buf == 0x0 )
+		w->content_buf = (uint8_t*)fswatcher_realloc( w->allocator, 0x0, 0, FSWATCHER_CONTENT_CHUNK );
+
+	fswatcher_content_entry state;
+	state.path_hash = fswatcher_content_path_hash( path );
+	size_t slot = fswatcher_content_find( w, state.path_hash, path );
+	const fswatcher_content_entry* prev = slot == (size_t)-1 ? 0x0 : &w->content[slot];
+	if( w->content_buf == 0x0 || !fswatcher_content_read( path, w->content_buf, prev, &state ) )
+	{
+		// ... can't tell, report it and forget what was known ...
+		if( !fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_MODIFY, path, 0x0 ) )
+			return false;
+		if( slot != (size_t)-1 )
+			fswatcher_content_erase( w, slot );
+		return true;
+	}
+
+	// ... unchanged since last seen, or the same content after a rewrite ...
+	bool unchanged = prev != 0x0 && prev->inode == state.inode && prev->size == state.size &&
+	                 ( prev->mtime == state.mtime || ( prev->hashed && state.hashed && prev->content == state.content ) );
+	if( unchanged )
+		++w->stats.events_modify_dropped;
+	else if( !fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_MODIFY, path, 0x0 ) )
+		return false;
+	fswatcher_content_store( w, slot, &state, path );
+	return true;
+}
+
+/**
+ * fanotify backend, the filesystem containing each root is marked with FAN_MARK_FILESYSTEM and events are reported
+ * as directory file handle + name. Directory handles are resolved to paths with open_by_handle_at() + /proc/self/fd and
+ * cached, events for directories outside all roots are dropped.
+ */
+static bool fswatcher_fan_init( fswatcher_t w, fswatcher_event_type types )
+{
+	w->fan_mask = FAN_ONDIR;
+	if( types & FSWATCHER_EVENT_CREATE ) w->fan_mask |= FAN_CREATE;
+	if( types & FSWATCHER_EVENT_REMOVE ) w->fan_mask |= FAN_DELETE;
+	if( types & FSWATCHER_EVENT_MOVE   ) w->fan_mask |= FAN_MOVED_FROM | FAN_MOVED_TO;
+	if( types & FSWATCHER_EVENT_MODIFY ) w->fan_mask |= FAN_MODIFY;
+	if( types & FSWATCHER_EVENT_WRITE_DONE ) w->fan_mask |= FAN_CLOSE_WRITE;
+
+	w->notifierfd = fanotify_init( FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY );
+	return w->notifierfd >= 0;
+}
+
+static void fswatcher_fid_cache_clear( fswatcher_fid_cache* cache )
+{
+	if( cache->slots )
+		memset( cache->slots, 0x0, sizeof( fswatcher_fid_slot ) * cache->slots_cap );
+	cache->slots_cnt  = 0;
+	cache->arena_size = 0;
+}
+
+static bool fswatcher_fan_add_root( fswatcher_t w, fswatcher_root* root, const char* watch_dir )
+{
+	if( fanotify_mark( w->notifierfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, w->fan_mask, AT_FDCWD, watch_dir ) < 0 )
+	{
+		fswatcher_count_add_watch_failure( w, errno );
+		return false;
+	}
+
+	root->mount_fd = open( watch_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	if( root->mount_fd < 0 )
+		return false;
+
+	struct statfs fs;
+	char real[PATH_MAX];
+	if( fstatfs( root->mount_fd, &fs ) < 0 || realpath( watch_dir, real ) == 0x0 )
+		return false;
+	memcpy( &root->fsid, &fs.f_fsid, sizeof( root->fsid ) );
+
+	root->real_len = strlen( real );
+	root->real = (char*)fswatcher_realloc( w->allocator, 0x0, 0, root->real_len + 1 );
+	size_t user_len = strlen( watch_dir );
+	bool add_sep = user_len == 0 || watch_dir[user_len - 1] != '/';
+	root->user_len = user_len + ( add_sep ? 1 : 0 );
+	root->user = (char*)fswatcher_realloc( w->allocator, 0x0, 0, root->user_len + 1 );
+	if( root->real == 0x0 || root->user == 0x0 )
+		return false;
+
+	memcpy( root->real, real, root->real_len + 1 );
+	memcpy( root->user, watch_dir, user_len );
+	if( add_sep )
+		root->user[user_len] = '/';
+	root->user[root->user_len] = '\0';
+
+	// ... cached handles might resolve to the new root now ...
+	fswatcher_fid_cache_clear( &w->fid_cache );
+	return true;
+}
+
+static void fswatcher_fan_remove_root( fswatcher_t w, fswatcher_root* root )
+{
+	// ... the filesystem-mark is shared by all roots on the same filesystem ...
+	bool shared = false;
+	for( uint32_t i = 0; i < w->roots_cnt; ++i )
+		if( w->roots[i].used && &w->roots[i] != root && memcmp( &w->roots[i].fsid, &root->fsid, sizeof( root->fsid ) ) == 0 )
+			shared = true;
+	if( !shared && root->real != 0x0 && w->notifierfd >= 0 )
+		fanotify_mark( w->notifierfd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, w->fan_mask, AT_FDCWD, root->real );
+
+	if( root->mount_fd >= 0 )
+		close( root->mount_fd );
+	fswatcher_free( w->allocator, root->real );
+	fswatcher_free( w->allocator, root->user );
+	root->mount_fd = -1;
+	root->real = 0x0;
+	root->user = 0x0;
+	fswatcher_fid_cache_clear( &w->fid_cache );
+}
+
+static uint64_t fswatcher_hash_bytes( const void* data, size_t size )
+{
+	// ... FNV-1a, never 0 as that marks empty slots ...
+	uint64_t hash = 14695981039346656037ull;
+	for( size_t i = 0; i < size; ++i )
+		hash = ( hash ^ ( (const uint8_t*)data )[i] ) * 1099511628211ull;
+	return hash ? hash : 1;
+}
+
+/**
+ * Find cached entry for key, returns offset of path_len in arena or FSWATCHER_NO_PATH if not cached.
+ */
+static uint32_t fswatcher_fid_cache_find( fswatcher_fid_cache* cache, uint64_t hash, const char* key, uint32_t key_len )
+{
+	if( cache->slots_cap == 0 )
+		return FSWATCHER_NO_PATH;
+
+	size_t mask = cache->slots_cap - 1;
+	for( size_t i = (size_t)hash & mask; cache->slots[i].hash != 0; i = ( i + 1 ) & mask )
+	{
+		if( cache->slots[i].hash != hash )
+			continue;
+		const char* entry = cache->arena + cache->slots[i].offset;
+		uint32_t entry_key_len;
+		memcpy( &entry_key_len, entry, sizeof( uint32_t ) );
+		if( entry_key_len == key_len && memcmp( entry + sizeof( uint32_t ), key, key_len ) == 0 )
+			return cache->slots[i].offset + (uint32_t)sizeof( uint32_t ) + key_len;
+	}
+	return FSWATCHER_NO_PATH;
+}
+
+static uint32_t fswatcher_fid_cache_insert( fswatcher_t w, uint64_t hash, const char* key, uint32_t key_len, uint32_t root, const char* path, uint32_t path_len )
+{
+	fswatcher_fid_cache* cache = &w->fid_cache;
+
+	// ... the cache is dropped as a whole when it gets too big, it only holds directories that has seen events ...
+	static const size_t FSWATCHER_FID_CACHE_MAX = 1024 * 1024;
+	size_t entry_size = sizeof( uint32_t ) * 3 + key_len + ( path_len == FSWATCHER_NO_PATH ? 0 : path_len ) + 1;
+	if( cache->arena_size + entry_size > FSWATCHER_FID_CACHE_MAX )
+		fswatcher_fid_cache_clear( cache );
+
+	if( ( cache->slots_cnt + 1 ) * 2 > cache->slots_cap )
+	{
+		size_t new_cap = cache->slots_cap ? cache->slots_cap * 2 : 64;
+		fswatcher_fid_slot* slots = (fswatcher_fid_slot*)fswatcher_realloc( w->allocator, 0x0, 0, sizeof( fswatcher_fid_slot ) * new_cap );
+		if( slots == 0x0 )
+			return FSWATCHER_NO_PATH;
+		memset( slots, 0x0, sizeof( fswatcher_fid_slot ) * new_cap );
+		for( size_t i = 0; i < cache->slots_cap; ++i )
+		{
+			if( cache->slots[i].hash == 0 )
+				continue;
+			size_t j = (size_t)cache->slots[i].hash & ( new_cap - 1 );
+			while( slots[j].hash != 0 )
+				j = ( j + 1 ) & ( new_cap - 1 );
+			slots[j] = cache->slots[i];
+		}
+		fswatcher_free( w->allocator, cache->slots );
+		cache->slots = slots;
+		cache->slots_cap = new_cap;
+	}
+
+	if( cache->arena_size + entry_size > cache->arena_cap )
+	{
+		size_t new_cap = cache->arena_cap ? cache->arena_cap : 4096;
+		while( new_cap < cache->arena_size + entry_size )
+			new_cap *= 2;
+		char* arena = (char*)fswatcher_realloc( w->allocator, cache->arena, cache->arena_cap, new_cap );
+		if( arena == 0x0 )
+			return FSWATCHER_NO_PATH;
+		cache->arena = arena;
+		cache->arena_cap = new_cap;
+	}
+
+	uint32_t offset = (uint32_t)cache->arena_size;
+	char* out = cache->arena + offset;
+	memcpy( out, &key_len, sizeof( uint32_t ) );               out += sizeof( uint32_t );
+	memcpy( out, key, key_len );                               out += key_len;
+	memcpy( out, &path_len, sizeof( uint32_t ) );              out += sizeof( uint32_t );
+	memcpy( out, &root, sizeof( uint32_t ) );                  out += sizeof( uint32_t );
+	if( path_len != FSWATCHER_NO_PATH )
+	{
+		memcpy( out, path, path_len );
+		out += path_len;
+	}
+	*out = '\0';
+	cache->arena_size += entry_size;
+
+	size_t mask = cache->slots_cap - 1;
+	size_t i = (size_t)hash & mask;
+	while( cache->slots[i].hash != 0 )
+		i = ( i + 1 ) & mask;
+	cache->slots[i].hash   = hash;
+	cache->slots[i].offset = offset;
+	++cache->slots_cnt;
+	return offset + (uint32_t)sizeof( uint32_t ) + key_len;
+}
+
+/**
+ * Resolve directory file handle to the directory path as reported to the user, with trailing '/'.
+ *
+ * @param root set to the id of the root the directory belongs to, the innermost if roots are nested.
+ *
+ * @return path or 0x0 if directory is outside of all roots or could not be resolved.
+ */
+static const char* fswatcher_fan_dir_path( fswatcher_t w, fanotify_event_info_fid* fid, size_t* len, uint32_t* root )
+{
+	file_handle* fh = (file_handle*)fid->handle;
+	if( fh->handle_bytes > MAX_HANDLE_SZ )
+		return 0x0;
+
+	// ... key is fsid, handle_type and the handle bytes ...
+	char key[sizeof( fid->fsid ) + sizeof( int ) + MAX_HANDLE_SZ];
+	uint32_t key_len = (uint32_t)( sizeof( fid->fsid ) + sizeof( int ) + fh->handle_bytes );
+	memcpy( key, &fid->fsid, sizeof( fid->fsid ) );
+	memcpy( key + sizeof( fid->fsid ), &fh->handle_type, sizeof( int ) );
+	memcpy( key + sizeof( fid->fsid ) + sizeof( int ), fh->f_handle, fh->handle_bytes );
+	uint64_t hash = fswatcher_hash_bytes( key, key_len );
+
+	uint32_t entry = fswatcher_fid_cache_find( &w->fid_cache, hash, key, key_len );
+	if( entry == FSWATCHER_NO_PATH )
+	{
+		// ... the handle can only be opened via an fd on the same filesystem ...
+		int mount_fd = -1;
+		for( uint32_t i = 0; i < w->roots_cnt && mount_fd < 0; ++i )
+			if( w->roots[i].used && memcmp( &w->roots[i].fsid, &fid->fsid, sizeof( fid->fsid ) ) == 0 )
+				mount_fd = w->roots[i].mount_fd;
+		if( mount_fd < 0 )
+			return 0x0;
+
+		int fd = open_by_handle_at( mount_fd, fh, O_PATH | O_CLOEXEC );
+		if( fd < 0 )
+			return 0x0; // ... directory is gone, don't cache as the handle might be valid again later ...
+
+		char proc_path[64];
+		char real[PATH_MAX];
+		snprintf( proc_path, sizeof( proc_path ), "/proc/self/fd/%d", fd );
+		ssize_t real_len = readlink( proc_path, real, sizeof( real ) - 1 );
+		close( fd );
+		if( real_len < 0 )
+			return 0x0;
+		real[real_len] = '\0';
+
+		// ... map real path to the path below the innermost root containing it, as passed by the user ...
+		uint32_t dir_root = FSWATCHER_NO_ROOT;
+		for( uint32_t i = 0; i < w->roots_cnt; ++i )
+		{
+			fswatcher_root* r = &w->roots[i];
+			size_t rl = r->real_len;
+			if( !r->used || strncmp( real, r->real, rl ) != 0 || ( real[rl] != '\0' && real[rl] != '/' && rl != 1 ) )
+				continue;
+			if( dir_root == FSWATCHER_NO_ROOT || rl > w->roots[dir_root].real_len )
+				dir_root = i;
+		}
+
+		char user[PATH_MAX * 2];
+		uint32_t user_len = FSWATCHER_NO_PATH;
+		if( dir_root != FSWATCHER_NO_ROOT )
+		{
+			fswatcher_root* r = &w->roots[dir_root];
+			const char* rest = real + r->real_len;
+			while( *rest == '/' )
+				++rest;
+
+			// ... a directory inside an excluded directory is treated as outside of all roots ...
+			bool excluded = false;
+			for( const char* comp = rest; *comp && !excluded; )
+			{
+				const char* end = strchr( comp, '/' );
+				size_t comp_len = end ? (size_t)( end - comp ) : strlen( comp );
+				excluded = fswatcher_filter_match( &w->exclude, comp, comp_len );
+				comp += comp_len;
+				while( *comp == '/' )
+					++comp;
+			}
+
+			if( !excluded )
+			{
+				size_t rest_len = strlen( rest );
+				memcpy( user, r->user, r->user_len );
+				memcpy( user + r->user_len, rest, rest_len );
+				user_len = (uint32_t)( r->user_len + rest_len );
+				if( rest_len > 0 )
+					user[user_len++] = '/';
+				user[user_len] = '\0';
+			}
+		}
+
+		entry = fswatcher_fid_cache_insert( w, hash, key, key_len, dir_root, user, user_len );
+		if( entry == FSWATCHER_NO_PATH )
+			return 0x0;
+	}
+
+	uint32_t path_len;
+	memcpy( &path_len, w->fid_cache.arena + entry, sizeof( uint32_t ) );
+	memcpy( root, w->fid_cache.arena + entry + sizeof( uint32_t ), sizeof( uint32_t ) );
+	if( path_len == FSWATCHER_NO_PATH )
+		return 0x0;
+	*len = path_len;
+	return w->fid_cache.arena + entry + sizeof( uint32_t ) * 2;
+}
+
+static const char* fswatcher_fan_build_path( fswatcher_t w, fswatcher_path_buffer* buffer, const char* dir, size_t dir_len, const char* name )
+{
+	size_t name_len = strlen( name );
+	// ... events on the watched dir itself is reported with name "." ...
+	if( name_len == 1 && name[0] == '.' )
+		name_len = 0;
+	char* res = fswatcher_reserve_path_buffer( w, buffer, dir_len + name_len + 1 );
+	if( res == 0x0 )
+		return 0x0;
+	memcpy( res, dir, dir_len );
+	memcpy( res + dir_len, name, name_len );
+	res[dir_len + name_len] = '\0';
+	return res;
+}
+
+/**
+ * Handle one fanotify event record, the kernel might have merged several events for the same dir + name into one
+ * record, these are delivered in the order create, modify, move, remove. Delivered bits are tracked in fan_done so
+ * that a record can be retried if the sink is full.
+ *
+ * @return false if sink could not consume the event.
+ */
+static bool fswatcher_fan_process_event( fswatcher_t w, fswatcher_sink* sink, fanotify_event_metadata* meta )
+{
+	// ... an overflow affects all roots, it is reported for root 0 ...
+	if( meta->mask & FAN_Q_OVERFLOW )
+	{
+		if( !fswatcher_sink_emit( sink, 0, FSWATCHER_EVENT_BUFFER_OVERFLOW, 0x0, 0x0 ) )
+			return false;
+		++w->stats.overflows;
+		return true;
+	}
+
+	// ... find the directory-fid + name info record ...
+	fanotify_event_info_fid* fid = 0x0;
+	for( char* info = (char*)meta + meta->metadata_len; info < (char*)meta + meta->event_len; )
+	{
+		fanotify_event_info_header* hdr = (fanotify_event_info_header*)info;
+		if( hdr->len == 0 )
+			break;
+		if( hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME )
+		{
+			fid = (fanotify_event_info_fid*)info;
+			break;
+		}
+		info += hdr->len;
+	}
+	if( fid == 0x0 )
+		return true;
+
+	file_handle* fh = (file_handle*)fid->handle;
+	const char* name = (const char*)( fh->f_handle + fh->handle_bytes );
+
+	size_t dir_len = 0;
+	uint32_t root = FSWATCHER_NO_ROOT;
+	const char* dir = fswatcher_fan_dir_path( w, fid, &dir_len, &root );
+	bool is_dir = ( meta->mask & FAN_ONDIR ) != 0;
+
+	// ... the filesystem-mark can't skip excluded directories, events in them are dropped by the dir cache instead ...
+	if( fswatcher_filtered( w, name, strlen( name ), is_dir ) )
+		dir = 0x0;
+
+	static const uint64_t ORDER[] = { FAN_CREATE, FAN_MODIFY, FAN_CLOSE_WRITE, FAN_MOVED_FROM, FAN_MOVED_TO, FAN_DELETE };
+	for( size_t i = 0; i < sizeof( ORDER ) / sizeof( ORDER[0] ); ++i )
+	{
+		uint64_t bit = ORDER[i];
+		if( ( meta->mask & bit ) == 0 || ( w->fan_done & bit ) != 0 )
+			continue;
+
+		// ... a move between roots is reported as a move out of the src root and a move into the dst root ...
+		if( bit == FAN_MOVED_TO && w->move_src_valid && ( dir == 0x0 || w->move_src_root != root ) )
+		{
+			if( !fswatcher_sink_emit( sink, w->move_src_root, FSWATCHER_EVENT_MOVE, w->move_src.ptr, 0x0 ) )
+				return false;
+			w->move_src_valid = false;
+		}
+
+		if( dir != 0x0 )
+		{
+			if( bit == FAN_MOVED_FROM )
+			{
+				if( w->move_src_valid )
+				{
+					// ... the last move never got a pair, it was moved outside the watched dir ...
+					if( !fswatcher_sink_emit( sink, w->move_src_root, FSWATCHER_EVENT_MOVE, w->move_src.ptr, 0x0 ) )
+						return false;
+					w->move_src_valid = false;
+				}
+				w->move_src_valid = fswatcher_fan_build_path( w, &w->move_src, dir, dir_len, name ) != 0x0;
+				w->move_src_root  = root;
+			}
+			else
+			{
+				const char* path = fswatcher_fan_build_path( w, &w->path, dir, dir_len, name );
+				if( path != 0x0 )
+				{
+					bool ok = true;
+					switch( bit )
 					{
-						// ... this is a "move from outside to watch" ...
-						fswatcher_make_callback_with_dst_path( watcher, handler, FSWATCHER_EVENT_MOVE, ev );
+						case FAN_CREATE: ok = fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_CREATE, path, 0x0 ); break;
+						case FAN_MODIFY: ok = is_dir || fswatcher_emit_modify( w, sink, root, path ); break;
+						case FAN_DELETE:
+							fswatcher_content_forget( w, path );
+							ok = fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_REMOVE, path, 0x0 );
+							break;
+						case FAN_CLOSE_WRITE: ok = is_dir || fswatcher_write_done( w, sink, root, path ); break;
+						case FAN_MOVED_TO:
+							ok = fswatcher_sink_emit( sink, root, FSWATCHER_EVENT_MOVE, w->move_src_valid ? w->move_src.ptr : 0x0, path );
+							if( ok )
+								w->move_src_valid = false;
+							break;
 					}
+					if( !ok )
+						return false;
 				}
 			}
+		}
+		w->fan_done |= bit;
+	}
+
+	// ... paths of cached directories below a moved or removed directory are no longer valid ...
+	if( is_dir && ( meta->mask & ( FAN_MOVED_FROM | FAN_MOVED_TO | FAN_DELETE ) ) )
+		fswatcher_fid_cache_clear( &w->fid_cache );
+	return true;
+}
+
+/**
+ * Size of the record, inotify_event or fanotify_event_metadata + info, starting with header.
+ */
+static size_t fswatcher_record_len( fswatcher_t watcher, const char* header )
+{
+	if( watcher->backend == FSWATCHER_BACKEND_FANOTIFY )
+		return ( (const fanotify_event_metadata*)header )->event_len;
+	return sizeof( inotify_event ) + ( (const inotify_event*)header )->len;
+}
+
+static size_t fswatcher_record_header_len( fswatcher_t watcher )
+{
+	return watcher->backend == FSWATCHER_BACKEND_FANOTIFY ? sizeof( fanotify_event_metadata ) : sizeof( inotify_event );
+}
+
+static void fswatcher_ring_copy_out( fswatcher_t watcher, size_t pos, char* dst, size_t size )
+{
+	size_t offset = pos & ( watcher->ring_cap - 1 );
+	size_t first  = watcher->ring_cap - offset < size ? watcher->ring_cap - offset : size;
+	memcpy( dst, watcher->ring + offset, first );
+	memcpy( dst + first, watcher->ring, size - first );
+}
+
+/**
+ * Push records in buffer to the ring, blocking while the ring is full.
+ *
+ * @return false if the reader was asked to stop.
+ */
+static bool fswatcher_ring_push( fswatcher_t watcher, const char* buffer, size_t size )
+{
+	pollfd pfd[2] = { { watcher->ring_spacefd, POLLIN, 0 }, { watcher->reader_stopfd, POLLIN, 0 } };
+	while( size > 0 )
+	{
+		size_t head = watcher->ring_head;
+		size_t tail = __atomic_load_n( &watcher->ring_tail, __ATOMIC_SEQ_CST );
+		size_t space = watcher->ring_cap - ( head - tail );
+		if( space == 0 )
+		{
+			// ... set blocked before checking for space again so that a pop in between will signal ring_spacefd ...
+			__atomic_store_n( &watcher->reader_blocked, true, __ATOMIC_SEQ_CST );
+			if( __atomic_load_n( &watcher->ring_tail, __ATOMIC_SEQ_CST ) == tail )
+			{
+				poll( pfd, 2, -1 );
+				if( pfd[1].revents & POLLIN )
+					return false;
+				eventfd_t value;
+				eventfd_read( watcher->ring_spacefd, &value );
+			}
+			__atomic_store_n( &watcher->reader_blocked, false, __ATOMIC_SEQ_CST );
+			continue;
+		}
+
+		// ... records are pushed partially if they do not fit, the poll only pops whole records ...
+		size_t chunk  = size < space ? size : space;
+		size_t offset = head & ( watcher->ring_cap - 1 );
+		size_t first  = watcher->ring_cap - offset < chunk ? watcher->ring_cap - offset : chunk;
+		memcpy( watcher->ring + offset, buffer, first );
+		memcpy( watcher->ring, buffer + first, chunk - first );
+		__atomic_store_n( &watcher->ring_head, head + chunk, __ATOMIC_RELEASE );
+		eventfd_write( watcher->ring_datafd, 1 );
+
+		buffer += chunk;
+		size   -= chunk;
+	}
+	return true;
+}
+
+static void* fswatcher_reader_main( void* arg )
+{
+	fswatcher_t watcher = (fswatcher_t)arg;
+	pollfd pfd[2] = { { watcher->notifierfd, POLLIN, 0 }, { watcher->reader_stopfd, POLLIN, 0 } };
+	while( true )
+	{
+		if( poll( pfd, 2, -1 ) < 0 && errno != EINTR )
+			break;
+		if( pfd[1].revents & POLLIN )
+			break;
+
+		ssize_t read_bytes = read( watcher->notifierfd, watcher->reader_buffer, FSWATCHER_READER_BUFFER_SIZE );
+		__atomic_fetch_add( &watcher->stats.read_syscalls, 1, __ATOMIC_RELAXED );
+		if( read_bytes <= 0 )
+			continue;
+		if( !fswatcher_ring_push( watcher, watcher->reader_buffer, (size_t)read_bytes ) )
+			break;
+	}
+	return 0x0;
+}
+
+static bool fswatcher_start_reader( fswatcher_t watcher, size_t ring_size )
+{
+	size_t cap = 4096;
+	while( cap < ring_size )
+		cap *= 2;
+
+	watcher->reader_stopfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	watcher->ring_datafd   = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	watcher->ring_spacefd  = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	watcher->reader_buffer = (char*)fswatcher_realloc( watcher->allocator, 0x0, 0, FSWATCHER_READER_BUFFER_SIZE );
+	watcher->ring          = (char*)fswatcher_realloc( watcher->allocator, 0x0, 0, cap );
+	watcher->ring_cap      = cap;
+	if( watcher->reader_stopfd < 0 || watcher->ring_datafd < 0 || watcher->ring_spacefd < 0 || watcher->reader_buffer == 0x0 || watcher->ring == 0x0 )
+		return false;
+
+	watcher->reader_started = pthread_create( &watcher->reader, 0x0, fswatcher_reader_main, watcher ) == 0;
+	return watcher->reader_started;
+}
+
+static void fswatcher_stop_reader( fswatcher_t watcher )
+{
+	if( watcher->reader_started )
+	{
+		eventfd_write( watcher->reader_stopfd, 1 );
+		pthread_join( watcher->reader, 0x0 );
+	}
+	if( watcher->reader_stopfd >= 0 ) close( watcher->reader_stopfd );
+	if( watcher->ring_datafd   >= 0 ) close( watcher->ring_datafd );
+	if( watcher->ring_spacefd  >= 0 ) close( watcher->ring_spacefd );
+	fswatcher_free( watcher->allocator, watcher->reader_buffer );
+	fswatcher_free( watcher->allocator, watcher->ring );
+}
+
+/**
+ * Pop as many whole records from the ring as fits in watcher->read_buffer.
+ *
+ * @return number of bytes copied to read_buffer.
+ */
+static size_t fswatcher_ring_pop( fswatcher_t watcher )
+{
+	size_t tail = watcher->ring_tail;
+	size_t head = __atomic_load_n( &watcher->ring_head, __ATOMIC_ACQUIRE );
+	if( head == tail )
+	{
+		// ... reset the data-fd before checking again so that a push in between keeps it signaled ...
+		eventfd_t value;
+		eventfd_read( watcher->ring_datafd, &value );
+		head = __atomic_load_n( &watcher->ring_head, __ATOMIC_ACQUIRE );
+	}
+
+	size_t header_len = fswatcher_record_header_len( watcher );
+	size_t size = 0;
+	while( head - tail >= header_len )
+	{
+		char header[sizeof( fanotify_event_metadata ) > sizeof( inotify_event ) ? sizeof( fanotify_event_metadata ) : sizeof( inotify_event )] __attribute__( ( aligned( 8 ) ) );
+		fswatcher_ring_copy_out( watcher, tail, header, header_len );
+		size_t record_len = fswatcher_record_len( watcher, header );
+		if( record_len > head - tail || size + record_len > watcher->read_buffer_cap )
+			break; // ... record only partially pushed or read_buffer is full ...
+
+		fswatcher_ring_copy_out( watcher, tail, watcher->read_buffer + size, record_len );
+		tail += record_len;
+		size += record_len;
+	}
+
+	if( size > 0 )
+	{
+		__atomic_store_n( &watcher->ring_tail, tail, __ATOMIC_SEQ_CST );
+		if( __atomic_load_n( &watcher->reader_blocked, __ATOMIC_SEQ_CST ) )
+			eventfd_write( watcher->ring_spacefd, 1 );
+	}
+	return size;
+}
+
+/**
+ * Wait for the notifier fd to become readable, fswatcher_wakeup() to be called or timeout_ms to pass, -1 to wait forever.
+ *
+ * @return true if woken by fswatcher_wakeup().
+ */
+static bool fswatcher_wait( fswatcher_t watcher, int timeout_ms )
+{
+	pollfd pfd[2] = { { fswatcher_get_fd( watcher ), POLLIN, 0 }, { watcher->wakeupfd, POLLIN, 0 } };
+	timespec ts = { timeout_ms / 1000, ( timeout_ms % 1000 ) * 1000000L };
+	// ... an interrupted wait just return and is treated as a timeout by the caller, the deadline is rechecked ...
+	if( ppoll( pfd, 2, timeout_ms < 0 ? 0x0 : &ts, 0x0 ) <= 0 || ( pfd[1].revents & POLLIN ) == 0 )
+		return false;
+
+	// ... reset the eventfd, all wakeups before this point are consumed by this wait ...
+	eventfd_t value;
+	eventfd_read( watcher->wakeupfd, &value );
+	return true;
+}
+
+/**
+ * Grow read_buffer to fit all events currently queued by the kernel so that they are read with one syscall. Only
+ * called when read_buffer is empty, if the grow fails the old buffer is kept.
+ */
+static void fswatcher_fit_read_buffer( fswatcher_t watcher )
+{
+	int queued = 0;
+	if( ioctl( watcher->notifierfd, FIONREAD, &queued ) != 0 || (size_t)queued <= watcher->read_buffer_cap )
+		return;
+
+	size_t new_cap = watcher->read_buffer_cap;
+	while( new_cap < (size_t)queued && new_cap < FSWATCHER_READ_BUFFER_MAX )
+		new_cap *= 2;
+	char* buffer = (char*)fswatcher_realloc( watcher->allocator, watcher->read_buffer, watcher->read_buffer_cap, new_cap );
+	if( buffer == 0x0 )
+		return;
+	watcher->read_buffer     = buffer;
+	watcher->read_buffer_cap = new_cap;
+}
+
+/**
+ * Read and process events until the kernel queue is drained or the sink is full. Events already read from the kernel but
+ * not consumed by the sink are kept in the watcher read-buffer until next call.
+ *
+ * @return false if sink stopped accepting events.
+ */
+static bool fswatcher_drain( fswatcher_t watcher, fswatcher_sink* sink )
+{
+	size_t new_dir_budget = FSWATCHER_NEW_DIR_BATCH;
+	while( !sink->stop )
+	{
+		if( !fswatcher_queue_flush( watcher, sink ) )
+			return false;
+
+		// ... new directories are listed before reading more so that their content is reported right after them, the
+		//     rest is left for the next poll once the budget is used up so that a big extract does not stall a poll ...
+		if( new_dir_budget > 0 && fswatcher_new_dirs_pending( watcher ) )
+		{
+			fswatcher_list_new_dirs( watcher, &new_dir_budget );
+			continue;
+		}
+
+		if( watcher->read_pos >= watcher->read_end )
+		{
+			if( watcher->read_fionread && !watcher->reader_started )
+				fswatcher_fit_read_buffer( watcher );
+			ssize_t read_bytes;
+			if( watcher->reader_started )
+				read_bytes = (ssize_t)fswatcher_ring_pop( watcher );
+			else
+			{
+				read_bytes = read( watcher->notifierfd, watcher->read_buffer, watcher->read_buffer_cap );
+				__atomic_fetch_add( &watcher->stats.read_syscalls, 1, __ATOMIC_RELAXED );
+			}
+			if( read_bytes <= 0 )
+			{
+				if( read_bytes < 0 && errno == EINTR )
+					continue;
+				break;
+			}
+			watcher->read_pos = 0;
+			watcher->read_end = (size_t)read_bytes;
+		}
+
+		if( watcher->backend == FSWATCHER_BACKEND_POLL )
+		{
+			// ... the timer fired, the changes are queued and delivered at the top of the next iteration. Scans start
+			//     once an async crawl is done and all directories has a snapshot to diff against ...
+			watcher->read_pos = watcher->read_end;
+			if( !fswatcher_crawl_complete( watcher ) )
+				continue;
+			if( !fswatcher_snap_rescan_all( watcher ) )
+				fswatcher_queue_push( watcher, 0, FSWATCHER_EVENT_BUFFER_OVERFLOW, 0x0, 0x0 );
+			continue;
+		}
+
+		if( watcher->backend == FSWATCHER_BACKEND_FANOTIFY )
+		{
+			fanotify_event_metadata* meta = (fanotify_event_metadata*)( watcher->read_buffer + watcher->read_pos );
+			if( meta->vers != FANOTIFY_METADATA_VERSION )
+			{
+				watcher->read_pos = watcher->read_end;
+				break;
+			}
+			if( !fswatcher_fan_process_event( watcher, sink, meta ) )
+				return false;
+
+			watcher->read_pos += meta->event_len;
+			watcher->fan_done = 0;
+			continue;
+		}
+
+		inotify_event* ev = (inotify_event*)( watcher->read_buffer + watcher->read_pos );
+		if( !fswatcher_process_event( watcher, sink, ev ) )
+			return false;
+
+		watcher->read_pos += sizeof(inotify_event) + ev->len;
+	}
+
+	if( sink->stop )
+		return false;
+
+	// ... we have a "move to outside of watch" that was never closed ...
+	return fswatcher_flush_move_src( watcher, sink );
+}
+
+/**
+ * Process events into sink, waiting up to timeout_ms for the first event, -1 to wait until an event is delivered.
+ */
+static void fswatcher_process( fswatcher_t watcher, fswatcher_sink* sink, int timeout_ms )
+{
+	fswatcher_coalescer* coalescer = watcher->coalesce ? &watcher->coalescer : 0x0;
+	if( coalescer )
+		coalescer->target = sink;
+
+	uint64_t deadline = timeout_ms > 0 ? fswatcher_time_ms() + (uint64_t)timeout_ms : 0;
+	uint64_t busy_ns = 0;
+	while( true )
+	{
+		uint64_t start = fswatcher_time_ns();
+		fswatcher_lock_tree( watcher );
+		bool drained = fswatcher_drain( watcher, coalescer ? &coalescer->sink : sink );
+		if( drained && watcher->settler.entries_cnt > 0 )
+			drained = fswatcher_settle_release( watcher, coalescer ? &coalescer->sink : sink );
+		if( drained && coalescer )
+			fswatcher_coalesce_release( coalescer, sink );
+		fswatcher_unlock_tree( watcher );
+
+		busy_ns += fswatcher_time_ns() - start;
+		if( busy_ns > watcher->stats.max_poll_ns )
+			watcher->stats.max_poll_ns = busy_ns;
+		if( !drained )
+			return;
+
+		// ... only wait while nothing has been delivered, otherwise a blocking poll would never return ...
+		if( timeout_ms == 0 || sink->delivered > 0 || sink->stop )
+			return;
+
+		int wait_ms = -1;
+		if( timeout_ms > 0 )
+		{
+			uint64_t now = fswatcher_time_ms();
+			if( now >= deadline )
+				return;
+			wait_ms = (int)( deadline - now );
+		}
+
+		int coalesce_ms = coalescer ? fswatcher_coalesce_timeout( coalescer ) : -1;
+		if( coalesce_ms >= 0 && ( wait_ms < 0 || coalesce_ms < wait_ms ) )
+			wait_ms = coalesce_ms;
+
+		int settle_ms = fswatcher_settle_timeout( watcher );
+		if( settle_ms >= 0 && ( wait_ms < 0 || settle_ms < wait_ms ) )
+			wait_ms = settle_ms;
+
+		if( fswatcher_new_dirs_pending( watcher ) )
+			wait_ms = 0;
+
+		if( fswatcher_wait( watcher, wait_ms ) )
+			return;
+	}
+}
+
+/**
+ * Count event delivered to the user.
+ */
+static void fswatcher_count_event( fswatcher_t watcher, fswatcher_event_type type )
+{
+	switch( type )
+	{
+		case FSWATCHER_EVENT_CREATE: ++watcher->stats.events_create; break;
+		case FSWATCHER_EVENT_REMOVE: ++watcher->stats.events_remove; break;
+		case FSWATCHER_EVENT_MODIFY: ++watcher->stats.events_modify; break;
+		case FSWATCHER_EVENT_MOVE:   ++watcher->stats.events_move;   break;
+		case FSWATCHER_EVENT_WRITE_DONE: ++watcher->stats.events_write_done; break;
+		default: break;
+	}
+}
+
+struct fswatcher_handler_sink
+{
+	fswatcher_sink sink;
+	fswatcher_t watcher;
+	fswatcher_event_handler* handler;
+};
+
+static bool fswatcher_handler_sink_emit( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst )
+{
+	(void)root;
+	fswatcher_count_event( ( (fswatcher_handler_sink*)sink )->watcher, type );
+	fswatcher_event_handler* handler = ( (fswatcher_handler_sink*)sink )->handler;
+	if( !handler->callback( handler, type, src, dst ) )
+		sink->stop = true;
+	return true;
+}
+
+struct fswatcher_root_handler_sink
+{
+	fswatcher_sink sink;
+	fswatcher_t watcher;
+	fswatcher_root_event_handler* handler;
+};
+
+static bool fswatcher_root_handler_sink_emit( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_count_event( ( (fswatcher_root_handler_sink*)sink )->watcher, type );
+	fswatcher_root_event_handler* handler = ( (fswatcher_root_handler_sink*)sink )->handler;
+	if( !handler->callback( handler, root, type, src, dst ) )
+		sink->stop = true;
+	return true;
+}
+
+void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator )
+{
+	// ... all temporary paths are built in the per-watcher path-buffers, allocated with the watcher allocator ...
+	(void)allocator;
+
+	fswatcher_handler_sink sink = { { fswatcher_handler_sink_emit, false, 0 }, watcher, handler };
+	fswatcher_process( watcher, &sink.sink, watcher->blocking ? -1 : 0 );
+}
+
+void fswatcher_poll_timeout( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator, int timeout_ms )
+{
+	(void)allocator;
+
+	fswatcher_handler_sink sink = { { fswatcher_handler_sink_emit, false, 0 }, watcher, handler };
+	fswatcher_process( watcher, &sink.sink, timeout_ms );
+}
+
+void fswatcher_poll_roots( fswatcher_t watcher, fswatcher_root_event_handler* handler, int timeout_ms )
+{
+	fswatcher_root_handler_sink sink = { { fswatcher_root_handler_sink_emit, false, 0 }, watcher, handler };
+	fswatcher_process( watcher, &sink.sink, timeout_ms );
+}
+
+int fswatcher_get_fd( fswatcher_t watcher )
+{
+	return watcher->reader_started ? watcher->ring_datafd : watcher->notifierfd;
+}
+
+void fswatcher_wakeup( fswatcher_t watcher )
+{
+	eventfd_write( watcher->wakeupfd, 1 );
+}
+
+struct fswatcher_batch_sink
+{
+	fswatcher_sink sink;
+	fswatcher_t watcher;
+
+	fswatcher_event* out;
+	size_t cap;
+	size_t count;
+
+	char*  path_arena;
+	size_t arena_size;
+	size_t arena_used;
+};
+
+static uint32_t fswatcher_batch_sink_push_path( fswatcher_batch_sink* batch, const char* path, size_t len )
+{
+	if( path == 0x0 )
+		return FSWATCHER_NO_PATH;
+
+	uint32_t offset = (uint32_t)batch->arena_used;
+	memcpy( batch->path_arena + batch->arena_used, path, len + 1 );
+	batch->arena_used += len + 1;
+	return offset;
+}
+
+static bool fswatcher_batch_sink_emit( fswatcher_sink* sink, uint32_t root, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_batch_sink* batch = (fswatcher_batch_sink*)sink;
+	if( batch->count >= batch->cap )
+		return false;
+
+	size_t src_len = src ? strlen( src ) : 0;
+	size_t dst_len = dst ? strlen( dst ) : 0;
+	size_t need    = ( src ? src_len + 1 : 0 ) + ( dst ? dst_len + 1 : 0 );
+	if( batch->arena_used + need > batch->arena_size || batch->arena_used + need > FSWATCHER_NO_PATH )
+		return false;
+
+	fswatcher_event* ev = &batch->out[batch->count++];
+	ev->type = type;
+	ev->root = root;
+	ev->src  = fswatcher_batch_sink_push_path( batch, src, src_len );
+	ev->dst  = fswatcher_batch_sink_push_path( batch, dst, dst_len );
+	fswatcher_count_event( batch->watcher, type );
+	return true;
+}
+
+size_t fswatcher_poll_batch( fswatcher_t watcher, fswatcher_event* out, size_t cap, char* path_arena, size_t arena_size )
+{
+	fswatcher_batch_sink batch = { { fswatcher_batch_sink_emit, false, 0 }, watcher, out, cap, 0, path_arena, arena_size, 0 };
+	fswatcher_process( watcher, &batch.sink, watcher->blocking ? -1 : 0 );
+	return batch.count;
+}
+
+/**
+ * Event queued on a dispatcher worker, paths are stored in a buffer owned by the slot that is reused by later events.
+ */
+struct fswatcher_dispatch_item
+{
+	fswatcher_event_type type; ///< 0 for a fence, see fswatcher_dispatch_fence().
+	uint32_t src;              ///< offset of src in paths or FSWATCHER_NO_PATH.
+	uint32_t dst;              ///< offset of dst in paths or FSWATCHER_NO_PATH.
+	uint32_t fence_worker;     ///< fence, index of the worker to wait for.
+	uint64_t fence_done;       ///< fence, wait until fence_worker has handled this many items.
+	size_t   paths_cap;
+	char*    paths;
+};
+
+/**
+ * Worker of a dispatcher, items is a ring of queue_size slots. The poll pushes at head + count and the worker handles
+ * the item at head and only pops it once it is handled, so the slot it reads is never written while handled.
+ */
+struct fswatcher_dispatch_worker
+{
+	fswatcher_dispatcher* dispatcher;
+	pthread_t thread;
+	bool      started;
+	bool      stop;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  not_empty; ///< signaled when an item is pushed or the worker is stopped.
+	pthread_cond_t  not_full;  ///< broadcast when an item has been handled.
+
+	fswatcher_dispatch_item* items;
+	size_t   head;
+	size_t   count;
+	uint64_t pushed; ///< items pushed so far.
+	uint64_t done;   ///< items handled so far.
+};
+
+struct fswatcher_dispatcher
+{
+	fswatcher_event_handler handler; ///< handler passed to polls.
+	fswatcher_event_handler* target;
+	fswatcher_allocator* allocator;
+	bool stop; ///< set by a worker when target returned false, passed on to the poll by the next dispatched event.
+	uint64_t events_inline; ///< events handled on the polling thread, see fswatcher_dispatcher_stats.
+
+	size_t queue_size;
+	unsigned int workers_cnt;
+	fswatcher_dispatch_worker* workers;
+};
+
+static void* fswatcher_dispatch_worker_main( void* arg )
+{
+	fswatcher_dispatch_worker* worker = (fswatcher_dispatch_worker*)arg;
+	fswatcher_dispatcher* d = worker->dispatcher;
+	fswatcher_event_handler* target = d->target;
+
+	pthread_mutex_lock( &worker->lock );
+	while( true )
+	{
+		// ... a stopped worker handles what is left before it exits ...
+		while( worker->count == 0 && !worker->stop )
+			pthread_cond_wait( &worker->not_empty, &worker->lock );
+		if( worker->count == 0 )
+			break;
+
+		fswatcher_dispatch_item* item = &worker->items[worker->head];
+		pthread_mutex_unlock( &worker->lock );
+
+		if( item->type == 0 )
+		{
+			fswatcher_dispatch_worker* other = &d->workers[item->fence_worker];
+			pthread_mutex_lock( &other->lock );
+			while( other->done < item->fence_done )
+				pthread_cond_wait( &other->not_full, &other->lock );
+			pthread_mutex_unlock( &other->lock );
+		}
+		else
+		{
+			const char* src = item->src != FSWATCHER_NO_PATH ? item->paths + item->src : 0x0;
+			const char* dst = item->dst != FSWATCHER_NO_PATH ? item->paths + item->dst : 0x0;
+			if( !target->callback( target, item->type, src, dst ) )
+				__atomic_store_n( &d->stop, true, __ATOMIC_RELEASE );
+		}
+
+		pthread_mutex_lock( &worker->lock );
+		worker->head = ( worker->head + 1 ) % d->queue_size;
+		--worker->count;
+		++worker->done;
+		pthread_cond_broadcast( &worker->not_full );
+	}
+	pthread_mutex_unlock( &worker->lock );
+	return 0x0;
+}
+
+static uint32_t fswatcher_dispatch_shard( fswatcher_dispatcher* d, const char* path, size_t len )
+{
+	return (uint32_t)( fswatcher_hash_bytes( path, len ) % d->workers_cnt );
+}
+
+static uint32_t fswatcher_dispatch_dir_shard( fswatcher_dispatcher* d, const char* path )
+{
+	const char* sep = strrchr( path, '/' );
+	return fswatcher_dispatch_shard( d, path, sep ? (size_t)( sep - path ) : 0 );
+}
+
+/**
+ * Wait for room in worker and return the slot to fill in with room for path_bytes, 0x0 if out of memory. Called with
+ * worker->lock held, the slot is pushed with fswatcher_dispatch_commit().
+ */
+static fswatcher_dispatch_item* fswatcher_dispatch_reserve( fswatcher_dispatcher* d, fswatcher_dispatch_worker* worker, size_t path_bytes )
+{
+	while( worker->count == d->queue_size )
+		pthread_cond_wait( &worker->not_full, &worker->lock );
+
+	fswatcher_dispatch_item* item = &worker->items[( worker->head + worker->count ) % d->queue_size];
+	if( item->paths_cap < path_bytes )
+	{
+		size_t new_cap = item->paths_cap ? item->paths_cap : 256;
+		while( new_cap < path_bytes )
+			new_cap *= 2;
+		char* paths = (char*)fswatcher_realloc( d->allocator, item->paths, item->paths_cap, new_cap );
+		if( paths == 0x0 )
+			return 0x0;
+		item->paths     = paths;
+		item->paths_cap = new_cap;
+	}
+	return item;
+}
+
+static void fswatcher_dispatch_commit( fswatcher_dispatch_worker* worker )
+{
+	++worker->count;
+	++worker->pushed;
+	pthread_cond_signal( &worker->not_empty );
+}
+
+/**
+ * Make worker wait until other has handled done items before it handles anything pushed to it after this.
+ */
+static void fswatcher_dispatch_fence( fswatcher_dispatcher* d, uint32_t worker, uint32_t other, uint64_t done )
+{
+	fswatcher_dispatch_worker* o = &d->workers[other];
+	pthread_mutex_lock( &o->lock );
+	bool reached = o->done >= done;
+	pthread_mutex_unlock( &o->lock );
+	if( reached )
+		return;
+
+	fswatcher_dispatch_worker* w = &d->workers[worker];
+	pthread_mutex_lock( &w->lock );
+	fswatcher_dispatch_item* item = fswatcher_dispatch_reserve( d, w, 0 );
+	item->type         = (fswatcher_event_type)0;
+	item->fence_worker = other;
+	item->fence_done   = done;
+	fswatcher_dispatch_commit( w );
+	pthread_mutex_unlock( &w->lock );
+}
+
+static bool fswatcher_dispatch_callback( fswatcher_event_handler* handler, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_dispatcher* d = (fswatcher_dispatcher*)handler;
+	const char* path = src ? src : dst;
+
+	// ... events without a path, i.e. overflow, are ordered against everything ...
+	if( path == 0x0 )
+		fswatcher_dispatcher_flush( d );
+
+	// ... shard by directory so that all events in the same directory end up on the same worker, in order. Events that
+	// affect other directories are fenced against their workers: the destination directory of a move and, as any item
+	// created, removed or moved might be a directory, the items own path ...
+	uint32_t primary = path ? fswatcher_dispatch_dir_shard( d, path ) : 0;
+	uint32_t others[3];
+	size_t   others_cnt = 0;
+	if( path != 0x0 && type != FSWATCHER_EVENT_MODIFY && type != FSWATCHER_EVENT_WRITE_DONE )
+	{
+		uint32_t candidates[3];
+		size_t   candidates_cnt = 0;
+		if( src )
+			candidates[candidates_cnt++] = fswatcher_dispatch_shard( d, src, strlen( src ) );
+		if( dst )
+			candidates[candidates_cnt++] = fswatcher_dispatch_shard( d, dst, strlen( dst ) );
+		if( src && dst )
+			candidates[candidates_cnt++] = fswatcher_dispatch_dir_shard( d, dst );
+		for( size_t i = 0; i < candidates_cnt; ++i )
+		{
+			bool seen = candidates[i] == primary;
+			for( size_t j = 0; j < others_cnt && !seen; ++j )
+				seen = others[j] == candidates[i];
+			if( !seen )
+				others[others_cnt++] = candidates[i];
+		}
+	}
+
+	// ... wait for what is already queued on the other workers, the poll is the only thread pushing ...
+	for( size_t i = 0; i < others_cnt; ++i )
+		fswatcher_dispatch_fence( d, primary, others[i], d->workers[others[i]].pushed );
+
+	size_t src_len = src ? strlen( src ) + 1 : 0;
+	size_t dst_len = dst ? strlen( dst ) + 1 : 0;
+
+	fswatcher_dispatch_worker* worker = &d->workers[primary];
+	pthread_mutex_lock( &worker->lock );
+	fswatcher_dispatch_item* item = fswatcher_dispatch_reserve( d, worker, src_len + dst_len );
+	if( item == 0x0 )
+	{
+		// ... out of memory, handle the event here once everything before it is handled. Nothing is queued after it
+		//     so no fences are needed ...
+		pthread_mutex_unlock( &worker->lock );
+		fswatcher_dispatcher_flush( d );
+		++d->events_inline;
+		bool keep_going = d->target->callback( d->target, type, src, dst );
+		return !__atomic_exchange_n( &d->stop, false, __ATOMIC_ACQ_REL ) && keep_going;
+	}
+
+	item->type = type;
+	item->src  = src ? 0 : FSWATCHER_NO_PATH;
+	item->dst  = dst ? (uint32_t)src_len : FSWATCHER_NO_PATH;
+	if( src )
+		memcpy( item->paths, src, src_len );
+	if( dst )
+		memcpy( item->paths + src_len, dst, dst_len );
+	fswatcher_dispatch_commit( worker );
+	uint64_t pushed = worker->pushed;
+	pthread_mutex_unlock( &worker->lock );
 
-			bufp += sizeof(inotify_event) + ev->len;
+	// ... and hold back what is queued on the other workers after this until it is handled ...
+	for( size_t i = 0; i < others_cnt; ++i )
+		fswatcher_dispatch_fence( d, others[i], primary, pushed );
+	if( path == 0x0 )
+		fswatcher_dispatcher_flush( d );
+
+	return !__atomic_exchange_n( &d->stop, false, __ATOMIC_ACQ_REL );
+}
+
+fswatcher_dispatcher_t fswatcher_dispatcher_create( const fswatcher_dispatcher_params* params )
+{
+	fswatcher_allocator* allocator = params->allocator ? params->allocator : &g_fswatcher_default_alloc;
+	if( params->handler == 0x0 )
+		return 0x0;
+
+	fswatcher_dispatcher* d = (fswatcher_dispatcher*)fswatcher_realloc( allocator, 0x0, 0, sizeof( fswatcher_dispatcher ) );
+	if( d == 0x0 )
+		return 0x0;
+	memset( d, 0x0, sizeof( fswatcher_dispatcher ) );
+	d->handler.callback = fswatcher_dispatch_callback;
+	d->target      = params->handler;
+	d->allocator   = allocator;
+	d->queue_size  = params->queue_size ? params->queue_size : 1024;
+	d->workers_cnt = params->workers ? params->workers : 4;
+
+	d->workers = (fswatcher_dispatch_worker*)fswatcher_realloc( allocator, 0x0, 0, sizeof( fswatcher_dispatch_worker ) * d->workers_cnt );
+	if( d->workers == 0x0 )
+	{
+		fswatcher_free( allocator, d );
+		return 0x0;
+	}
+	memset( d->workers, 0x0, sizeof( fswatcher_dispatch_worker ) * d->workers_cnt );
+
+	bool ok = true;
+	for( unsigned int i = 0; i < d->workers_cnt; ++i )
+	{
+		fswatcher_dispatch_worker* worker = &d->workers[i];
+		worker->dispatcher = d;
+		pthread_mutex_init( &worker->lock, 0x0 );
+		pthread_cond_init( &worker->not_empty, 0x0 );
+		pthread_cond_init( &worker->not_full, 0x0 );
+		worker->items = (fswatcher_dispatch_item*)fswatcher_realloc( allocator, 0x0, 0, sizeof( fswatcher_dispatch_item ) * d->queue_size );
+		if( worker->items != 0x0 )
+		{
+			memset( worker->items, 0x0, sizeof( fswatcher_dispatch_item ) * d->queue_size );
+			worker->started = pthread_create( &worker->thread, 0x0, fswatcher_dispatch_worker_main, worker ) == 0;
 		}
+		ok = ok && worker->started;
+	}
+
+	if( !ok )
+	{
+		fswatcher_dispatcher_destroy( d );
+		return 0x0;
+	}
+	return d;
+}
+
+void fswatcher_dispatcher_destroy( fswatcher_dispatcher_t dispatcher )
+{
+	for( unsigned int i = 0; i < dispatcher->workers_cnt; ++i )
+	{
+		fswatcher_dispatch_worker* worker = &dispatcher->workers[i];
+		pthread_mutex_lock( &worker->lock );
+		worker->stop = true;
+		pthread_cond_signal( &worker->not_empty );
+		pthread_mutex_unlock( &worker->lock );
 	}
 
-	if( move_src )
+	fswatcher_allocator* allocator = dispatcher->allocator;
+	for( unsigned int i = 0; i < dispatcher->workers_cnt; ++i )
 	{
-		// ... we have a "move to outside of watch" that was never closed ...
-		FS_MAKE_CALLBACK( FSWATCHER_EVENT_MOVE, move_src, 0x0 );
-		fswatcher_free( allocator, move_src );
+		fswatcher_dispatch_worker* worker = &dispatcher->workers[i];
+		if( worker->started )
+			pthread_join( worker->thread, 0x0 );
+		pthread_cond_destroy( &worker->not_full );
+		pthread_cond_destroy( &worker->not_empty );
+		pthread_mutex_destroy( &worker->lock );
+		for( size_t j = 0; worker->items && j < dispatcher->queue_size; ++j )
+			fswatcher_free( allocator, worker->items[j].paths );
+		fswatcher_free( allocator, worker->items );
 	}
+	fswatcher_free( allocator, dispatcher->workers );
+	fswatcher_free( allocator, dispatcher );
+}
+
+fswatcher_event_handler* fswatcher_dispatcher_handler( fswatcher_dispatcher_t dispatcher )
+{
+	return &dispatcher->handler;
 }
 
-#undef FS_MAKE_CALLBACK
+void fswatcher_dispatcher_flush( fswatcher_dispatcher_t dispatcher )
+{
+	for( unsigned int i = 0; i < dispatcher->workers_cnt; ++i )
+	{
+		fswatcher_dispatch_worker* worker = &dispatcher->workers[i];
+		pthread_mutex_lock( &worker->lock );
+		while( worker->count > 0 )
+			pthread_cond_wait( &worker->not_full, &worker->lock );
+		pthread_mutex_unlock( &worker->lock );
+	}
+}
 
+void fswatcher_dispatcher_get_stats( fswatcher_dispatcher_t dispatcher, fswatcher_dispatcher_stats* stats )
+{
+	memset( stats, 0x0, sizeof( fswatcher_dispatcher_stats ) );
+	stats->events_inline = dispatcher->events_inline;
+}
@@ -26,12 +26,20 @@
 
 #include <fswatcher/fswatcher.h>
 
+#include <string.h> // memset
+
 fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type types, const char* watch_dir, fswatcher_allocator* allocator )
 {
 	(void)flags; (void)types; (void)watch_dir; (void)allocator;
 	return 0x0;
 }
 
+fswatcher_t fswatcher_create_ex( const fswatcher_create_params* params )
+{
+	(void)params;
+	return 0x0;
+}
+
 void fswatcher_destroy( fswatcher_t watcher )
 {
 	(void)watcher;
@@ -41,3 +49,95 @@ void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswa
 {
 	(void)watcher; (void)handler; (void)allocator;
 }
+
+uint32_t fswatcher_add_root( fswatcher_t watcher, const char* watch_dir )
+{
+	(void)watcher; (void)watch_dir;
+	return FSWATCHER_NO_ROOT;
+}
+
+bool fswatcher_remove_root( fswatcher_t watcher, uint32_t root )
+{
+	(void)watcher; (void)root;
+	return false;
+}
+
+bool fswatcher_watch_subtree( fswatcher_t watcher, const char* path, unsigned int max_depth )
+{
+	(void)watcher; (void)path; (void)max_depth;
+	return false;
+}
+
+bool fswatcher_unwatch_subtree( fswatcher_t watcher, const char* path )
+{
+	(void)watcher; (void)path;
+	return false;
+}
+
+void fswatcher_crawl_progress( fswatcher_t watcher, fswatcher_progress* progress )
+{
+	(void)watcher;
+	memset( progress, 0x0, sizeof( fswatcher_progress ) );
+	progress->done = true;
+}
+
+void fswatcher_poll_timeout( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator, int timeout_ms )
+{
+	(void)watcher; (void)handler; (void)allocator; (void)timeout_ms;
+}
+
+void fswatcher_poll_roots( fswatcher_t watcher, fswatcher_root_event_handler* handler, int timeout_ms )
+{
+	(void)watcher; (void)handler; (void)timeout_ms;
+}
+
+int fswatcher_get_fd( fswatcher_t watcher )
+{
+	(void)watcher;
+	return -1;
+}
+
+void fswatcher_wakeup( fswatcher_t watcher )
+{
+	(void)watcher;
+}
+
+void fswatcher_get_stats( fswatcher_t watcher, fswatcher_stats* stats )
+{
+	(void)watcher;
+	memset( stats, 0x0, sizeof( fswatcher_stats ) );
+}
+
+size_t fswatcher_poll_batch( fswatcher_t watcher, fswatcher_event* out, size_t cap, char* path_arena, size_t arena_size )
+{
+	(void)watcher; (void)out; (void)cap; (void)path_arena; (void)arena_size;
+	return 0;
+}
+
+fswatcher_dispatcher_t fswatcher_dispatcher_create( const fswatcher_dispatcher_params* params )
+{
+	(void)params;
+	return 0x0;
+}
+
+void fswatcher_dispatcher_destroy( fswatcher_dispatcher_t dispatcher )
+{
+	(void)dispatcher;
+}
+
+fswatcher_event_handler* fswatcher_dispatcher_handler( fswatcher_dispatcher_t dispatcher )
+{
+	(void)dispatcher;
+	return 0x0;
+}
+
+void fswatcher_dispatcher_flush( fswatcher_dispatcher_t dispatcher )
+{
+	(void)dispatcher;
+}
+
+void fswatcher_dispatcher_get_stats( fswatcher_dispatcher_t dispatcher, fswatcher_dispatcher_stats* stats )
+{
+	(void)dispatcher;
+	memset( stats, 0x0, sizeof( fswatcher_dispatcher_stats ) );
+}
@@ -29,6 +29,7 @@
 #include <windows.h>
 
 #include <stdio.h> // remove
+#include <string.h> // memset
 
 struct fswatcher
 {
@@ -40,9 +41,30 @@ struct fswatcher
     size_t watch_dir_len;
 
     HANDLE     directory;
+    HANDLE     read_event; // signaled when the read started by fswatcher_begin_read() completes.
     OVERLAPPED overlapped;
+    volatile LONG wakeup; // set by fswatcher_wakeup(), consumed by the next poll.
 
     DWORD read_buffer[2048]; // hmmmm.
+    bool  pending;           // read_buffer holds events not yet delivered starting at pending_offset, no read is started.
+    DWORD pending_offset;
+
+    fswatcher_stats stats;   // counters, watches and memory are filled in by fswatcher_get_stats().
+};
+
+/**
+ * Receiver of events from fswatcher_process(), either a user handler or the arrays passed to fswatcher_poll_batch().
+ */
+struct fswatcher_sink
+{
+	/**
+	 * Deliver one event.
+	 *
+	 * @return false if the event could not be consumed, processing stops and the event is delivered again on next poll.
+	 */
+	bool ( *emit )( fswatcher_sink* sink, fswatcher_event_type type, const char* src, const char* dst );
+
+	bool stop; // set by emit() to stop processing after the current, consumed, event.
 };
 
 static void* fswatcher_default_realloc( fswatcher_allocator*, void* ptr, size_t, size_t new_size )
@@ -68,8 +90,6 @@ static void fswatcher_free( fswatcher_allocator* allocator, void* ptr )
 		allocator->free( allocator, ptr );
 }
 
-#define FS_MAKE_CALLBACK( type, src, dst ) handler->callback( handler, (type), (src), (dst) );
-
 static char* fswatcher_build_full_path( fswatcher_t watcher, fswatcher_allocator* allocator, FILE_NOTIFY_INFORMATION* ev )
 {
 	size_t path_len = (size_t)( ev->FileNameLength / 2 );
@@ -104,7 +124,9 @@ static char* fswatcher_build_full_path( fswatcher_t watcher, fswatcher_allocator
 static void fswatcher_begin_read( fswatcher_t watcher )
 {
     ::ZeroMemory( &watcher->overlapped, sizeof( watcher->overlapped ) );
+    watcher->overlapped.hEvent = watcher->read_event;
 
+    ++watcher->stats.read_syscalls;
     BOOL success = ::ReadDirectoryChangesW( watcher->directory,
                                             watcher->read_buffer,
                                             sizeof( watcher->read_buffer ),
@@ -119,6 +141,29 @@ static void fswatcher_begin_read( fswatcher_t watcher )
 
 fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type types, const char* watch_dir, fswatcher_allocator* allocator )
 {
+    fswatcher_create_params params;
+    ::ZeroMemory( &params, sizeof( params ) );
+    params.flags     = flags;
+    params.types     = types;
+    params.watch_dir = watch_dir;
+    params.allocator = allocator;
+    return fswatcher_create_ex( &params );
+}
+
+fswatcher_t fswatcher_create_ex( const fswatcher_create_params* params )
+{
+    fswatcher_create_flags flags = params->flags;
+    const char*        watch_dir = params->watch_dir;
+    fswatcher_allocator* allocator = params->allocator;
+
+    // ... only ReadDirectoryChangesW is available on windows ...
+    if( params->backend != FSWATCHER_BACKEND_DEFAULT )
+        return 0x0;
+
+    // ... events are not held back on windows, fail rather than silently deliver them uncoalesced ...
+    if( flags & FSWATCHER_CREATE_COALESCE )
+        return 0x0;
+
     if( allocator == 0x0 )
 		allocator = &g_fswatcher_default_alloc;
 
@@ -137,6 +182,10 @@ fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type
                                  FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, // file attributes
                                  NULL ); // file with attributes to copy
     // handle error ...
+    w->read_event = ::CreateEvent( NULL, TRUE, FALSE, NULL ); // manual reset, reset by ReadDirectoryChangesW()
+    w->wakeup     = 0;
+    w->pending    = false;
+    memset( &w->stats, 0x0, sizeof( fswatcher_stats ) );
 
     fswatcher_begin_read( w );
 	return w;
@@ -145,57 +194,98 @@ fswatcher_t fswatcher_create( fswatcher_create_flags flags, fswatcher_event_type
 void fswatcher_destroy( fswatcher_t watcher )
 {
     ::CloseHandle( watcher->directory );
+    ::CloseHandle( watcher->read_event );
 	fswatcher_free( watcher->allocator, watcher );
 }
 
-void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator )
+static void fswatcher_process( fswatcher_t watcher, fswatcher_sink* sink, DWORD timeout )
 {
-    DWORD bytes;
-    BOOL res = ::GetOverlappedResult( watcher->directory,
-                                      &watcher->overlapped,
-                                      &bytes,
-                                      watcher->blocking );
-    if( res != TRUE )
-    	return;
+    // ... events left by the last poll are delivered without waiting for more ...
+    if( !watcher->pending )
+    {
+        // ... a wakeup while no poll was waiting, the read might not have been there to cancel ...
+        if( ::InterlockedExchange( &watcher->wakeup, 0 ) != 0 )
+            return;
+
+        if( ::WaitForSingleObject( watcher->read_event, timeout ) != WAIT_OBJECT_0 )
+            return;
+
+        DWORD bytes;
+        BOOL res = ::GetOverlappedResult( watcher->directory,
+                                          &watcher->overlapped,
+                                          &bytes,
+                                          FALSE );
+        if( res != TRUE )
+        {
+            // ... read cancelled by fswatcher_wakeup(), start a new one ...
+            if( ::GetLastError() == ERROR_OPERATION_ABORTED )
+            {
+                ::InterlockedExchange( &watcher->wakeup, 0 );
+                fswatcher_begin_read( watcher );
+            }
+            return;
+        }
+
+        // ... 0 bytes, the events did not fit in read_buffer and its content is not valid ...
+        if( bytes == 0 )
+        {
+            ++watcher->stats.overflows;
+            fswatcher_begin_read( watcher );
+            return;
+        }
+        watcher->pending        = true;
+        watcher->pending_offset = 0;
+    }
 
     char* move_src = 0x0;
+    DWORD move_offset = 0; // offset of the FILE_ACTION_RENAMED_OLD_NAME that move_src was built from.
 
-	FILE_NOTIFY_INFORMATION* ev = (FILE_NOTIFY_INFORMATION*)watcher->read_buffer;
+	DWORD offset = watcher->pending_offset;
 	do
 	{
+		FILE_NOTIFY_INFORMATION* ev = (FILE_NOTIFY_INFORMATION*)( (char*)watcher->read_buffer + offset );
+		DWORD resume   = offset;
+		bool  consumed = true;
 		switch(ev->Action)
 		{
 			case FILE_ACTION_ADDED:
 			{
 				char* src = fswatcher_build_full_path( watcher, watcher->allocator, ev );
-				FS_MAKE_CALLBACK( FSWATCHER_EVENT_CREATE, src, 0x0 );
+				consumed = sink->emit( sink, FSWATCHER_EVENT_CREATE, src, 0x0 );
 				fswatcher_free( watcher->allocator, src );
 			}
 			break;
 			case FILE_ACTION_REMOVED:
 			{
 				char* src = fswatcher_build_full_path( watcher, watcher->allocator, ev );
-				FS_MAKE_CALLBACK( FSWATCHER_EVENT_REMOVE, src, 0x0 );
+				consumed = sink->emit( sink, FSWATCHER_EVENT_REMOVE, src, 0x0 );
 				fswatcher_free( watcher->allocator, src );
 			}
 			break;
 			case FILE_ACTION_MODIFIED:
 			{
 				char* src = fswatcher_build_full_path( watcher, watcher->allocator, ev );
-				FS_MAKE_CALLBACK( FSWATCHER_EVENT_MODIFY, src, 0x0 );
+				consumed = sink->emit( sink, FSWATCHER_EVENT_MODIFY, src, 0x0 );
 				fswatcher_free( watcher->allocator, src );
 			}
 			break;
 			case FILE_ACTION_RENAMED_OLD_NAME:
 			{
-				move_src = fswatcher_build_full_path( watcher, watcher->allocator, ev );
+				if( move_src != 0x0 )
+					fswatcher_free( watcher->allocator, move_src );
+				move_src    = fswatcher_build_full_path( watcher, watcher->allocator, ev );
+				move_offset = offset;
 			}
 			break;
 			case FILE_ACTION_RENAMED_NEW_NAME:
 			{
+				// ... a move that is not consumed is read again from its old name ...
+				if( move_src != 0x0 )
+					resume = move_offset;
 				char* dst = fswatcher_build_full_path( watcher, watcher->allocator, ev );
-				FS_MAKE_CALLBACK( FSWATCHER_EVENT_MOVE, move_src, dst );
-				fswatcher_free( watcher->allocator, move_src );
+				consumed = sink->emit( sink, FSWATCHER_EVENT_MOVE, move_src, dst );
+				if( move_src != 0x0 )
+					fswatcher_free( watcher->allocator, move_src );
 				fswatcher_free( watcher->allocator, dst );
 				move_src = 0x0;
 			}
@@ -204,9 +294,25 @@ void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswa
 				printf("unhandled action %d\n", ev->Action);
 		}
 
+		if( !consumed )
+		{
+			watcher->pending_offset = move_src != 0x0 ? move_offset : resume;
+			if( move_src != 0x0 )
+				fswatcher_free( watcher->allocator, move_src );
+			return;
+		}
+
 		if( ev->NextEntryOffset == 0 )
 			break;
-		ev = (FILE_NOTIFY_INFORMATION*)((char*)ev + ev->NextEntryOffset);
+		offset += ev->NextEntryOffset;
+
+		if( sink->stop )
+		{
+			watcher->pending_offset = move_src != 0x0 ? move_offset : offset;
+			if( move_src != 0x0 )
+				fswatcher_free( watcher->allocator, move_src );
+			return;
+		}
 	}
 	while( true );
 
@@ -216,5 +322,198 @@ void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswa
 		fswatcher_free( watcher->allocator, move_src );
 	}
 
+	watcher->pending = false;
 	fswatcher_begin_read( watcher );
 }
+
+static void fswatcher_count_event( fswatcher_t watcher, fswatcher_event_type type )
+{
+	switch( type )
+	{
+		case FSWATCHER_EVENT_CREATE: ++watcher->stats.events_create; break;
+		case FSWATCHER_EVENT_REMOVE: ++watcher->stats.events_remove; break;
+		case FSWATCHER_EVENT_MODIFY: ++watcher->stats.events_modify; break;
+		case FSWATCHER_EVENT_MOVE:   ++watcher->stats.events_move;   break;
+		default: break;
+	}
+}
+
+struct fswatcher_handler_sink
+{
+	fswatcher_sink sink;
+	fswatcher_t watcher;
+	fswatcher_event_handler* handler;
+};
+
+static bool fswatcher_handler_sink_emit( fswatcher_sink* sink, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_count_event( ( (fswatcher_handler_sink*)sink )->watcher, type );
+	fswatcher_event_handler* handler = ( (fswatcher_handler_sink*)sink )->handler;
+	if( !handler->callback( handler, type, src, dst ) )
+		sink->stop = true;
+	return true;
+}
+
+void fswatcher_poll( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator )
+{
+	(void)allocator;
+	fswatcher_handler_sink sink = { { fswatcher_handler_sink_emit, false }, watcher, handler };
+	fswatcher_process( watcher, &sink.sink, watcher->blocking ? INFINITE : 0 );
+}
+
+uint32_t fswatcher_add_root( fswatcher_t watcher, const char* watch_dir )
+{
+	(void)watcher; (void)watch_dir;
+	return FSWATCHER_NO_ROOT;
+}
+
+bool fswatcher_remove_root( fswatcher_t watcher, uint32_t root )
+{
+	(void)watcher; (void)root;
+	return false;
+}
+
+bool fswatcher_watch_subtree( fswatcher_t watcher, const char* path, unsigned int max_depth )
+{
+	(void)watcher; (void)path; (void)max_depth;
+	return false;
+}
+
+bool fswatcher_unwatch_subtree( fswatcher_t watcher, const char* path )
+{
+	(void)watcher; (void)path;
+	return false;
+}
+
+void fswatcher_crawl_progress( fswatcher_t watcher, fswatcher_progress* progress )
+{
+	(void)watcher;
+	memset( progress, 0x0, sizeof( fswatcher_progress ) );
+	progress->done = true;
+}
+
+void fswatcher_poll_timeout( fswatcher_t watcher, fswatcher_event_handler* handler, fswatcher_allocator* allocator, int timeout_ms )
+{
+	(void)allocator;
+	fswatcher_handler_sink sink = { { fswatcher_handler_sink_emit, false }, watcher, handler };
+	fswatcher_process( watcher, &sink.sink, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms );
+}
+
+struct fswatcher_root_adapter
+{
+	fswatcher_event_handler handler;
+	fswatcher_root_event_handler* root_handler;
+};
+
+static bool fswatcher_root_adapter_callback( fswatcher_event_handler* handler, fswatcher_event_type evtype, const char* src, const char* dst )
+{
+	// ... only the dir passed to fswatcher_create() is watched on windows, so everything is root 0 ...
+	fswatcher_root_event_handler* root_handler = ( (fswatcher_root_adapter*)handler )->root_handler;
+	return root_handler->callback( root_handler, 0, evtype, src, dst );
+}
+
+void fswatcher_poll_roots( fswatcher_t watcher, fswatcher_root_event_handler* handler, int timeout_ms )
+{
+	fswatcher_root_adapter adapter = { { fswatcher_root_adapter_callback }, handler };
+	fswatcher_poll_timeout( watcher, &adapter.handler, 0x0, timeout_ms );
+}
+
+int fswatcher_get_fd( fswatcher_t watcher )
+{
+	(void)watcher;
+	return -1;
+}
+
+void fswatcher_wakeup( fswatcher_t watcher )
+{
+	::InterlockedExchange( &watcher->wakeup, 1 );
+	::CancelIoEx( watcher->directory, 0x0 );
+}
+
+void fswatcher_get_stats( fswatcher_t watcher, fswatcher_stats* stats )
+{
+	*stats = watcher->stats;
+	stats->watches = watcher->directory != INVALID_HANDLE_VALUE ? 1 : 0;
+	stats->memory  = sizeof( fswatcher ) + watcher->watch_dir_len + 1;
+}
+
+struct fswatcher_batch_sink
+{
+	fswatcher_sink sink;
+	fswatcher_t watcher;
+
+	fswatcher_event* out;
+	size_t cap;
+	size_t count;
+
+	char*  path_arena;
+	size_t arena_size;
+	size_t arena_used;
+};
+
+static uint32_t fswatcher_batch_sink_push_path( fswatcher_batch_sink* batch, const char* path, size_t len )
+{
+	if( path == 0x0 )
+		return FSWATCHER_NO_PATH;
+
+	uint32_t offset = (uint32_t)batch->arena_used;
+	memcpy( batch->path_arena + batch->arena_used, path, len + 1 );
+	batch->arena_used += len + 1;
+	return offset;
+}
+
+static bool fswatcher_batch_sink_emit( fswatcher_sink* sink, fswatcher_event_type type, const char* src, const char* dst )
+{
+	fswatcher_batch_sink* batch = (fswatcher_batch_sink*)sink;
+	if( batch->count >= batch->cap )
+		return false;
+
+	size_t src_len = src ? strlen( src ) : 0;
+	size_t dst_len = dst ? strlen( dst ) : 0;
+	size_t need    = ( src ? src_len + 1 : 0 ) + ( dst ? dst_len + 1 : 0 );
+	if( batch->arena_used + need > batch->arena_size || batch->arena_used + need > FSWATCHER_NO_PATH )
+		return false;
+
+	fswatcher_event* ev = &batch->out[batch->count++];
+	ev->type = type;
+	ev->root = 0;
+	ev->src  = fswatcher_batch_sink_push_path( batch, src, src_len );
+	ev->dst  = fswatcher_batch_sink_push_path( batch, dst, dst_len );
+	fswatcher_count_event( batch->watcher, type );
+	return true;
+}
+
+size_t fswatcher_poll_batch( fswatcher_t watcher, fswatcher_event* out, size_t cap, char* path_arena, size_t arena_size )
+{
+	fswatcher_batch_sink batch = { { fswatcher_batch_sink_emit, false }, watcher, out, cap, 0, path_arena, arena_size, 0 };
+	fswatcher_process( watcher, &batch.sink, watcher->blocking ? INFINITE : 0 );
+	return batch.count;
+}
+
+fswatcher_dispatcher_t fswatcher_dispatcher_create( const fswatcher_dispatcher_params* params )
+{
+	(void)params;
+	return 0x0;
+}
+
+void fswatcher_dispatcher_destroy( fswatcher_dispatcher_t dispatcher )
+{
+	(void)dispatcher;
+}
+
+fswatcher_event_handler* fswatcher_dispatcher_handler( fswatcher_dispatcher_t dispatcher )
+{
+	(void)dispatcher;
+	return 0x0;
+}
+
+void fswatcher_dispatcher_flush( fswatcher_dispatcher_t dispatcher )
+{
+	(void)dispatcher;
+}
+
+void fswatcher_dispatcher_get_stats( fswatcher_dispatcher_t dispatcher, fswatcher_dispatcher_stats* stats )
+{
+	(void)dispatcher;
+	memset( stats, 0x0, sizeof( fswatcher_dispatcher_stats ) );
+}
@@ -36,6 +36,9 @@
 #  include <windows.h>
 #  define DIR_SEP "\\"
 #else
+#  include <unistd.h> // usleep
+#  include <poll.h>
+#  include <pthread.h>
 #  define DIR_SEP "/"
 #endif
 
@@ -263,6 +266,1442 @@ TEST create_remove_file_in_subdir()
 	return 0;
 }
 
+TEST create_file_in_new_subdir()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+	test_handler handler = { { watch_event_handler }, FSWATCHER_EVENT_ALL, 0x0, 0x0 };
+
+	create_dir( test_dir_path( "d1" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, test_dir_path( "d1" ), 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	create_dir( test_dir_path( "d1" DIR_SEP "d2" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, test_dir_path( "d1" DIR_SEP "d2" ), 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	const char* path = test_dir_path( "d1" DIR_SEP "d2" DIR_SEP "f1" );
+	create_file( path );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, path, 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+struct counting_allocator
+{
+	fswatcher_allocator alloc;
+	size_t allocs;
+};
+
+static void* counting_realloc( fswatcher_allocator* allocator, void* ptr, size_t, size_t new_size )
+{
+	++( (counting_allocator*)allocator )->allocs;
+	return realloc( ptr, new_size );
+}
+
+static void counting_free( fswatcher_allocator*, void* ptr )
+{
+	free( ptr );
+}
+
+struct counting_handler
+{
+	fswatcher_event_handler handler;
+	size_t events;
+};
+
+static bool counting_event_handler( fswatcher_event_handler* handler, fswatcher_event_type, const char*, const char* )
+{
+	++( (counting_handler*)handler )->events;
+	return true;
+}
+
+static void write_file( const char* path )
+{
+	FILE* f = fopen( path, "w" );
+	if( f == 0x0 )
+		return;
+	fputc( 'a', f );
+	fclose( f );
+}
+
+TEST no_allocations_in_steady_state_poll()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	counting_allocator alloc = { { counting_realloc, counting_free }, 0 };
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, get_test_dir(), &alloc.alloc );
+	counting_handler handler = { { counting_event_handler }, 0 };
+
+	char src[4096];
+	char dst[4096];
+	test_dir_path( "a_file_with_a_name_long_enough", src );
+	test_dir_path( "a_file_with_a_name_long_enough_after_move", dst );
+
+	// ... warm up, let scratch-buffers grow to fit the paths ...
+	write_file( src );
+	move_file( src, dst );
+	remove( dst );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT( handler.events > 0 );
+
+	alloc.allocs   = 0;
+	handler.events = 0;
+	for( int i = 0; i < 1000; ++i )
+	{
+		write_file( src );
+		rename( src, dst );
+		remove( dst );
+		if( i % 100 == 99 )
+			fswatcher_poll( watcher, &handler.handler, 0x0 );
+	}
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+
+	// ... create + modify + move + remove per iteration ...
+	ASSERT_EQ( (size_t)4000, handler.events );
+	ASSERT_EQ( (size_t)0, alloc.allocs );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST poll_batch()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+
+	char f1[2048];
+	char f2[2048];
+	char f3[2048];
+	create_file( test_dir_path( "f1", f1 ) );
+	create_file( test_dir_path( "f2", f2 ) );
+	move_file( f1, test_dir_path( "f3", f3 ) );
+
+	fswatcher_event events[2];
+	char paths[8192];
+
+	// ... only 2 events fit, the move should be kept until next call ...
+	ASSERT_EQ( (size_t)2, fswatcher_poll_batch( watcher, events, 2, paths, sizeof( paths ) ) );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, events[0].type );
+	ASSERT_STR_EQ( f1, paths + events[0].src );
+	ASSERT_EQ( FSWATCHER_NO_PATH, events[0].dst );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, events[1].type );
+	ASSERT_STR_EQ( f2, paths + events[1].src );
+
+	ASSERT_EQ( (size_t)1, fswatcher_poll_batch( watcher, events, 2, paths, sizeof( paths ) ) );
+	ASSERT_EQ( FSWATCHER_EVENT_MOVE, events[0].type );
+	ASSERT_STR_EQ( f1, paths + events[0].src );
+	ASSERT_STR_EQ( f3, paths + events[0].dst );
+
+	ASSERT_EQ( (size_t)0, fswatcher_poll_batch( watcher, events, 2, paths, sizeof( paths ) ) );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST blocking_poll_returns_after_drain()
+{
+	setup_test_dir();
+
+	fswatcher_t watcher = fswatcher_create( (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_BLOCKING ), FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+	test_handler handler = { { watch_event_handler }, FSWATCHER_EVENT_ALL, 0x0, 0x0 };
+
+	const char* path = test_dir_path( "f1" );
+	create_file( path );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, path, 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	fswatcher_destroy( watcher );
+	return 0;
+}
+
+struct recording_handler
+{
+	fswatcher_event_handler handler;
+	size_t count;
+	fswatcher_event_type types[16];
+	char paths[16][256];
+};
+
+static bool recording_event_handler( fswatcher_event_handler* handler, fswatcher_event_type evtype, const char* src, const char* )
+{
+	recording_handler* h = (recording_handler*)handler;
+	if( h->count < 16 )
+	{
+		h->types[h->count] = evtype;
+		strncpy( h->paths[h->count], src ? src : "", sizeof( h->paths[0] ) - 1 );
+		h->paths[h->count][sizeof( h->paths[0] ) - 1] = '\0';
+	}
+	++h->count;
+	return true;
+}
+
+static void sleep_ms( unsigned int ms )
+{
+#if defined( _WIN32 )
+	Sleep( ms );
+#else
+	usleep( ms * 1000 );
+#endif
+}
+
+TEST poll_timeout()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+	test_handler handler = { { watch_event_handler }, FSWATCHER_EVENT_ALL, 0x0, 0x0 };
+
+	// ... nothing happened, should return after the timeout ...
+	pollfd pfd = { fswatcher_get_fd( watcher ), POLLIN, 0 };
+	ASSERT( pfd.fd >= 0 );
+	ASSERT_EQ( 0, poll( &pfd, 1, 0 ) );
+	fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 20 );
+	ASSERT_EQ( FSWATCHER_EVENT_ALL, handler.type );
+
+	const char* path = test_dir_path( "f1" );
+	create_file( path );
+	ASSERT_EQ( 1, poll( &pfd, 1, 1000 ) );
+	fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 1000 );
+
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, path, 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+#if !defined( _WIN32 )
+static void* wakeup_thread( void* watcher )
+{
+	usleep( 50 * 1000 );
+	fswatcher_wakeup( (fswatcher_t)watcher );
+	return 0x0;
+}
+#endif
+
+TEST wakeup_blocking_poll()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_t watcher = fswatcher_create( (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_BLOCKING ), FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+	test_handler handler = { { watch_event_handler }, FSWATCHER_EVENT_ALL, 0x0, 0x0 };
+
+	// ... no events will arrive, poll should only return due to the wakeup ...
+	pthread_t thread;
+	ASSERT_EQ( 0, pthread_create( &thread, 0x0, wakeup_thread, watcher ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	pthread_join( thread, 0x0 );
+	ASSERT_EQ( FSWATCHER_EVENT_ALL, handler.type );
+
+	// ... wakeup without a waiting poll should make the next poll return ...
+	fswatcher_wakeup( watcher );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( FSWATCHER_EVENT_ALL, handler.type );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST reader_thread()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	// ... use the smallest ring so that the reader has to wait for the poll to make room ...
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags            = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_READER_THREAD );
+	params.types            = FSWATCHER_EVENT_ALL;
+	params.watch_dir        = get_test_dir();
+	params.reader_ring_size = 1;
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( watcher != 0x0 );
+
+	static const int FILE_COUNT = 500;
+	char path[4096 + 64]; // room for get_test_dir() and the file name.
+	for( int i = 0; i < FILE_COUNT; ++i )
+	{
+		snprintf( path, sizeof( path ), "%sfile_with_a_long_name_to_fill_the_ring_%d", get_test_dir(), i );
+		write_file( path );
+	}
+
+	counting_handler handler = { { counting_event_handler }, 0 };
+	for( int i = 0; i < 10000 && handler.events < (size_t)FILE_COUNT * 2; ++i )
+		fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 100 );
+
+	// ... create + modify per file ...
+	ASSERT_EQ( (size_t)FILE_COUNT * 2, handler.events );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST fionread_buffer()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags     = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_FIONREAD_BUFFER );
+	params.types     = FSWATCHER_EVENT_CREATE;
+	params.watch_dir = get_test_dir();
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( watcher != 0x0 );
+
+	// ... ~64 bytes per event, well over the smallest read buffer of 4KB ...
+	static const int FILE_COUNT = 200;
+	char cmd[4096 + 128]; // room for get_test_dir() and the command around it.
+	snprintf( cmd, sizeof( cmd ), "cd %s && touch $(seq -f file_with_a_name_long_enough_to_fill_%%g %d)", get_test_dir(), FILE_COUNT );
+	ASSERT_EQ( 0, system( cmd ) );
+
+	fswatcher_stats before;
+	fswatcher_get_stats( watcher, &before );
+	counting_handler handler = { { counting_event_handler }, 0 };
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)FILE_COUNT, handler.events );
+
+	// ... one read for all events and one finding the queue empty ...
+	fswatcher_stats after;
+	fswatcher_get_stats( watcher, &after );
+	ASSERT_EQ( (uint64_t)2, after.read_syscalls - before.read_syscalls );
+	ASSERT_EQ( (uint64_t)0, after.overflows );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+struct snapshot_handler
+{
+	fswatcher_event_handler handler;
+	size_t overflows;
+	size_t creates;
+	bool modified;
+	bool removed;
+	bool created_in_new_dir;
+};
+
+static bool snapshot_event_handler( fswatcher_event_handler* handler, fswatcher_event_type evtype, const char* src, const char* )
+{
+	snapshot_handler* h = (snapshot_handler*)handler;
+	switch( evtype )
+	{
+		case FSWATCHER_EVENT_BUFFER_OVERFLOW: ++h->overflows; break;
+		case FSWATCHER_EVENT_CREATE:
+			++h->creates;
+			h->created_in_new_dir |= strcmp( src, test_dir_path( "new_dir" DIR_SEP "file" ) ) == 0;
+			break;
+		case FSWATCHER_EVENT_MODIFY: h->modified |= strcmp( src, test_dir_path( "mod" ) ) == 0; break;
+		case FSWATCHER_EVENT_REMOVE: h->removed  |= strcmp( src, test_dir_path( "del" ) ) == 0; break;
+		default: break;
+	}
+	return true;
+}
+
+TEST snapshot_overflow_recovery()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	write_file( test_dir_path( "mod" ) );
+	write_file( test_dir_path( "del" ) );
+
+	fswatcher_t watcher = fswatcher_create( (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_SNAPSHOT ), FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+	ASSERT( watcher != 0x0 );
+
+	// ... overflow the inotify queue, default max_queued_events is 16384 ...
+	static const int FILE_COUNT = 20000;
+	char path[4096 + 64]; // room for get_test_dir() and the file name.
+	for( int i = 0; i < FILE_COUNT; ++i )
+	{
+		snprintf( path, sizeof( path ), "%sspam_%d", get_test_dir(), i );
+		FILE* f = fopen( path, "w" );
+		if( f )
+			fclose( f );
+	}
+
+	// ... all of these are lost in the os and have to be found by the rescan ...
+	sleep_ms( 10 ); // ... make sure mtime moves ...
+	FILE* f = fopen( test_dir_path( "mod" ), "a" );
+	ASSERT( f != 0x0 );
+	fputc( 'b', f );
+	fclose( f );
+	remove_file( test_dir_path( "del" ) );
+	create_dir( test_dir_path( "new_dir" ) );
+	write_file( test_dir_path( "new_dir" DIR_SEP "file" ) );
+
+	snapshot_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = snapshot_event_handler;
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+
+	ASSERT_EQ( (size_t)0, handler.overflows );
+	ASSERT_EQ( (size_t)FILE_COUNT + 2, handler.creates ); // ... spam + new_dir + new_dir/file ...
+	ASSERT( handler.modified );
+	ASSERT( handler.removed );
+	ASSERT( handler.created_in_new_dir );
+
+	// ... the new directory is watched ...
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = snapshot_event_handler;
+	write_file( test_dir_path( "new_dir" DIR_SEP "file2" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.creates );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST snapshot_file()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	static const char* SNAPSHOT_FILE = "/tmp/fswatcher_test.snapshot";
+	remove( SNAPSHOT_FILE );
+
+	create_dir( test_dir_path( "d" ) );
+	write_file( test_dir_path( "a" ) );
+	write_file( test_dir_path( "b" ) );
+	write_file( test_dir_path( "d" DIR_SEP "c" ) );
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags         = FSWATCHER_CREATE_DEFAULT;
+	params.types         = FSWATCHER_EVENT_ALL;
+	params.watch_dir     = get_test_dir();
+	params.snapshot_file = SNAPSHOT_FILE;
+
+	recording_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = recording_event_handler;
+
+	// ... no file, nothing to report ...
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( watcher != 0x0 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)0, handler.count );
+	fswatcher_destroy( watcher );
+
+	// ... change the tree while no one is watching ...
+	FILE* f = fopen( test_dir_path( "a" ), "a" );
+	ASSERT( f != 0x0 );
+	fputc( 'b', f );
+	fclose( f );
+	remove_file( test_dir_path( "b" ) );
+	remove_dir( test_dir_path( "d" ) );
+	write_file( test_dir_path( "e" ) );
+
+	watcher = fswatcher_create_ex( &params );
+	ASSERT( watcher != 0x0 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+
+	// ... reported in path-order ...
+	ASSERT_EQ( (size_t)5, handler.count );
+	ASSERT_EQ( FSWATCHER_EVENT_MODIFY, handler.types[0] );
+	ASSERT_STR_EQ( test_dir_path( "a" ), handler.paths[0] );
+	ASSERT_EQ( FSWATCHER_EVENT_REMOVE, handler.types[1] );
+	ASSERT_STR_EQ( test_dir_path( "b" ), handler.paths[1] );
+	ASSERT_EQ( FSWATCHER_EVENT_REMOVE, handler.types[2] );
+	ASSERT_STR_EQ( test_dir_path( "d" ), handler.paths[2] );
+	ASSERT_EQ( FSWATCHER_EVENT_REMOVE, handler.types[3] );
+	ASSERT_STR_EQ( test_dir_path( "d" DIR_SEP "c" ), handler.paths[3] );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, handler.types[4] );
+	ASSERT_STR_EQ( test_dir_path( "e" ), handler.paths[4] );
+	fswatcher_destroy( watcher );
+
+	remove( SNAPSHOT_FILE );
+#endif
+	return 0;
+}
+
+TEST filters()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	create_dir( test_dir_path( ".git" DIR_SEP "objects" ) );
+	create_dir( test_dir_path( "src" ) );
+
+	static const char* EXCLUDE[] = { ".git", "node_modules", "build*", "*.o" };
+	static const char* INCLUDE[] = { "*.c", "*.h", "READ?E" };
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags       = FSWATCHER_CREATE_DEFAULT;
+	params.types       = FSWATCHER_EVENT_ALL;
+	params.watch_dir   = get_test_dir();
+	params.exclude     = EXCLUDE;
+	params.exclude_cnt = sizeof( EXCLUDE ) / sizeof( EXCLUDE[0] );
+	params.include     = INCLUDE;
+	params.include_cnt = sizeof( INCLUDE ) / sizeof( INCLUDE[0] );
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( watcher != 0x0 );
+
+	recording_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = recording_event_handler;
+
+	// ... nothing in excluded dirs, existing or new, and only included files ...
+	create_file( test_dir_path( ".git" DIR_SEP "objects" DIR_SEP "a.c" ) );
+	create_dir( test_dir_path( "node_modules" ) );
+	create_dir( test_dir_path( "build_debug" ) );
+	create_file( test_dir_path( "src" DIR_SEP "a.o" ) );
+	create_file( test_dir_path( "src" DIR_SEP "a.txt" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	create_file( test_dir_path( "node_modules" DIR_SEP "b.c" ) );
+	create_file( test_dir_path( "build_debug" DIR_SEP "b.c" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)0, handler.count );
+
+	create_dir( test_dir_path( "src" DIR_SEP "sub" ) );
+	create_file( test_dir_path( "src" DIR_SEP "a.c" ) );
+	create_file( test_dir_path( "README" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)3, handler.count );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, handler.types[0] );
+	ASSERT_STR_EQ( test_dir_path( "src" DIR_SEP "sub" ), handler.paths[0] );
+	ASSERT_STR_EQ( test_dir_path( "src" DIR_SEP "a.c" ), handler.paths[1] );
+	ASSERT_STR_EQ( test_dir_path( "README" ), handler.paths[2] );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+/**
+ * Allocator tracking bytes held, each allocation is prefixed with its size as free() does not pass it.
+ */
+struct tracking_allocator
+{
+	fswatcher_allocator alloc;
+	size_t current;
+};
+
+static void* tracking_realloc( fswatcher_allocator* allocator, void* ptr, size_t, size_t new_size )
+{
+	tracking_allocator* a = (tracking_allocator*)allocator;
+	size_t* block = ptr ? (size_t*)ptr - 2 : 0x0;
+	if( block )
+		a->current -= block[0];
+	block = (size_t*)realloc( block, new_size + 2 * sizeof( size_t ) );
+	block[0] = new_size;
+	a->current += new_size;
+	return block + 2;
+}
+
+static void tracking_free( fswatcher_allocator* allocator, void* ptr )
+{
+	if( ptr == 0x0 )
+		return;
+	size_t* block = (size_t*)ptr - 2;
+	( (tracking_allocator*)allocator )->current -= block[0];
+	free( block );
+}
+
+TEST stats()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	create_dir( test_dir_path( "a" DIR_SEP "b" ) );
+
+	tracking_allocator alloc = { { tracking_realloc, tracking_free }, 0 };
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, get_test_dir(), &alloc.alloc );
+	ASSERT( watcher != 0x0 );
+
+	fswatcher_stats stats;
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (size_t)3, stats.watches );
+	ASSERT_EQ( alloc.current, stats.memory );
+	ASSERT_EQ( (uint64_t)0, stats.events_create );
+	ASSERT_EQ( (uint64_t)0, stats.add_watch_failures );
+
+	counting_handler handler = { { counting_event_handler }, 0 };
+	create_file( test_dir_path( "f1" ) );
+	create_dir( test_dir_path( "a" DIR_SEP "c" ) );
+	remove_file( test_dir_path( "f1" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (size_t)4, stats.watches );
+	ASSERT_EQ( alloc.current, stats.memory );
+	ASSERT_EQ( (uint64_t)2, stats.events_create );
+	ASSERT_EQ( (uint64_t)1, stats.events_remove );
+	ASSERT_EQ( (uint64_t)0, stats.overflows );
+	ASSERT( stats.read_syscalls > 0 );
+	ASSERT( stats.max_poll_ns > 0 );
+
+	fswatcher_destroy( watcher );
+	ASSERT_EQ( (size_t)0, alloc.current );
+#endif
+	return 0;
+}
+
+TEST path_too_long()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	// ... a tree deeper than the max path length, the dir that does not fit is counted as a failure ...
+	char cmd[8192];
+	int len = snprintf( cmd, sizeof( cmd ), "mkdir -p %s", get_test_dir() );
+	for( int i = 0; i < 20; ++i )
+		len += snprintf( cmd + len, sizeof( cmd ) - (size_t)len, "%0250d/", i );
+	ASSERT_EQ( 0, system( cmd ) );
+
+	for( unsigned int threads = 0; threads < 3; threads += 2 )
+	{
+		fswatcher_create_params params;
+		memset( &params, 0x0, sizeof( params ) );
+		params.flags         = FSWATCHER_CREATE_DEFAULT;
+		params.types         = FSWATCHER_EVENT_ALL;
+		params.watch_dir     = get_test_dir();
+		params.crawl_threads = threads;
+		fswatcher_t watcher = fswatcher_create_ex( &params );
+		ASSERT( watcher != 0x0 );
+
+		fswatcher_stats stats;
+		fswatcher_get_stats( watcher, &stats );
+		ASSERT_EQ( (uint64_t)1, stats.add_watch_failures );
+		ASSERT_EQ( (uint64_t)1, stats.add_watch_failures_other );
+		fswatcher_destroy( watcher );
+	}
+#endif
+	return 0;
+}
+
+TEST write_done()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.types     = FSWATCHER_EVENT_WRITE_DONE;
+	params.watch_dir = get_test_dir();
+
+	char f1[2048];
+	char f2[2048];
+	test_dir_path( "f1", f1 );
+	test_dir_path( "f2", f2 );
+
+	// ... reported on every close ...
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+	recording_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = recording_event_handler;
+
+	write_file( f1 );
+	write_file( f2 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)2, handler.count );
+	ASSERT_EQ( FSWATCHER_EVENT_WRITE_DONE, handler.types[0] );
+	ASSERT_STR_EQ( f1, handler.paths[0] );
+	ASSERT_STR_EQ( f2, handler.paths[1] );
+	fswatcher_destroy( watcher );
+
+	// ... settled, reported once when the size has not changed for the period ...
+	params.write_settle_ms = 50;
+	watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = recording_event_handler;
+
+	write_file( f1 );
+	write_file( f1 );
+	write_file( f2 );
+	remove_file( f2 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)0, handler.count );
+
+	fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 1000 );
+	ASSERT_EQ( (size_t)1, handler.count );
+	ASSERT_EQ( FSWATCHER_EVENT_WRITE_DONE, handler.types[0] );
+	ASSERT_STR_EQ( f1, handler.paths[0] );
+
+	fswatcher_stats stats;
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)1, stats.events_write_done );
+
+	// ... many files pending at once, each closed twice and reported once ...
+	char path[4096 + 64]; // room for get_test_dir() and the file name.
+	for( int pass = 0; pass < 2; ++pass )
+		for( int i = 0; i < 100; ++i )
+		{
+			snprintf( path, sizeof( path ), "%smany_%d", get_test_dir(), i );
+			write_file( path );
+		}
+	for( int i = 0; i < 100 && handler.count < 101; ++i )
+		fswatcher_poll_timeout( watcher, &handler.handler, 0x0, 100 );
+	ASSERT_EQ( (size_t)101, handler.count );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST content_hash()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	char f1[2048];
+	test_dir_path( "f1", f1 );
+	write_file( f1 );
+
+	fswatcher_t watcher = fswatcher_create( (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_CONTENT_HASH ), FSWATCHER_EVENT_MODIFY, get_test_dir(), 0x0 );
+	ASSERT( 0x0 != watcher );
+	counting_handler handler = { { counting_event_handler }, 0 };
+
+	// ... first modify is always reported, rewriting the same content is not ...
+	write_file( f1 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.events );
+
+	write_file( f1 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.events );
+
+	FILE* f = fopen( f1, "w" );
+	ASSERT( f != 0x0 );
+	fputc( 'b', f );
+	fclose( f );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)2, handler.events );
+
+	// ... files larger than a read-chunk, rewritten with the same content and then appended to ...
+	char f2[2048];
+	test_dir_path( "f2", f2 );
+	for( int pass = 0; pass < 3; ++pass )
+	{
+		f = fopen( f2, pass == 2 ? "a" : "w" );
+		ASSERT( f != 0x0 );
+		for( int i = 0; i < ( pass == 2 ? 1 : 200 * 1024 ); ++i )
+			fputc( 'a' + i % 26, f );
+		fclose( f );
+		fswatcher_poll( watcher, &handler.handler, 0x0 );
+	}
+	ASSERT_EQ( (size_t)4, handler.events );
+
+	fswatcher_stats stats;
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT( stats.events_modify_dropped > 0 );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST coalesce_events()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags       = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_COALESCE );
+	params.types       = FSWATCHER_EVENT_ALL;
+	params.watch_dir   = get_test_dir();
+	params.coalesce_ms = 50;
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+
+	recording_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = recording_event_handler;
+
+	char f1[2048];
+	char f2[2048];
+	test_dir_path( "f1", f1 );
+	test_dir_path( "f2", f2 );
+
+	// ... create + modifies -> create, held until quiet ...
+	write_file( f1 );
+	write_file( f1 );
+	write_file( f1 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)0, handler.count );
+
+	sleep_ms( 100 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.count );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, handler.types[0] );
+	ASSERT_STR_EQ( f1, handler.paths[0] );
+
+	// ... modifies -> modify and create + remove -> nothing ...
+	handler.count = 0;
+	write_file( f1 );
+	write_file( f1 );
+	write_file( f2 );
+	remove_file( f2 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)0, handler.count );
+
+	sleep_ms( 100 );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.count );
+	ASSERT_EQ( FSWATCHER_EVENT_MODIFY, handler.types[0] );
+	ASSERT_STR_EQ( f1, handler.paths[0] );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST parallel_crawl()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	create_dir( test_dir_path( "a" DIR_SEP "b" DIR_SEP "c" ) );
+	create_dir( test_dir_path( "a" DIR_SEP "d" ) );
+	create_dir( test_dir_path( "e" DIR_SEP "f" ) );
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags         = FSWATCHER_CREATE_DEFAULT;
+	params.types         = FSWATCHER_EVENT_ALL;
+	params.watch_dir     = get_test_dir();
+	params.crawl_threads = 4;
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+
+	test_handler handler = { { watch_event_handler }, FSWATCHER_EVENT_ALL, 0x0, 0x0 };
+
+	const char* paths[] = { "a" DIR_SEP "b" DIR_SEP "c" DIR_SEP "f1", "a" DIR_SEP "d" DIR_SEP "f1", "e" DIR_SEP "f" DIR_SEP "f1" };
+	for( size_t i = 0; i < sizeof( paths ) / sizeof( paths[0] ); ++i )
+	{
+		const char* path = test_dir_path( paths[i] );
+		create_file( path );
+		fswatcher_poll( watcher, &handler.handler, 0x0 );
+		ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, path, 0x0, &handler ) );
+		HANDLER_RESET( handler );
+	}
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST async_crawl()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	char cmd[4096];
+	char dir[2048];
+	snprintf( cmd, sizeof( cmd ), "cd %s && seq 200 | xargs mkdir && mkdir -p 1/a/b", test_dir_path( "", dir ) );
+	ASSERT_EQ( 0, system( cmd ) );
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags     = (fswatcher_create_flags)( FSWATCHER_CREATE_DEFAULT | FSWATCHER_CREATE_ASYNC_CRAWL );
+	params.types     = FSWATCHER_EVENT_CREATE;
+	params.watch_dir = get_test_dir();
+
+	// ... destroy while the crawl is running ...
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+	fswatcher_destroy( watcher );
+
+	watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+	counting_handler handler = { { counting_event_handler }, 0 };
+
+	// ... polls are served while crawling ...
+	fswatcher_progress progress;
+	for( int i = 0; i < 1000; ++i )
+	{
+		fswatcher_poll( watcher, &handler.handler, 0x0 );
+		fswatcher_crawl_progress( watcher, &progress );
+		if( progress.done )
+			break;
+		sleep_ms( 1 );
+	}
+	ASSERT( progress.done );
+	ASSERT_EQ( (uint64_t)203, progress.watches_added );
+	ASSERT_EQ( (uint64_t)203, progress.dirs_scanned );
+
+	create_file( test_dir_path( "1/a/b/f1" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.events );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+#if !defined( _WIN32 )
+struct ordering_handler
+{
+	fswatcher_event_handler handler;
+	pthread_mutex_t lock;
+	int last[4];
+	size_t events;
+	bool in_order;
+};
+
+static bool ordering_event_handler( fswatcher_event_handler* handler, fswatcher_event_type, const char* src, const char* )
+{
+	ordering_handler* h = (ordering_handler*)handler;
+	int dir = -1;
+	int file = -1;
+	const char* name = strrchr( src, '/' );
+	if( name == 0x0 || name - src < 2 || sscanf( name - 1, "%d/%d", &dir, &file ) != 2 || dir < 0 || dir >= 4 )
+		return true;
+
+	pthread_mutex_lock( &h->lock );
+	h->in_order = h->in_order && file == h->last[dir] + 1;
+	h->last[dir] = file;
+	++h->events;
+	pthread_mutex_unlock( &h->lock );
+	return true;
+}
+
+struct failing_allocator
+{
+	fswatcher_allocator alloc;
+	bool fail;
+};
+
+static void* failing_realloc( fswatcher_allocator* allocator, void* ptr, size_t, size_t new_size )
+{
+	return ( (failing_allocator*)allocator )->fail ? 0x0 : realloc( ptr, new_size );
+}
+
+static void failing_free( fswatcher_allocator*, void* ptr )
+{
+	free( ptr );
+}
+#endif
+
+TEST dispatcher()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	char path[4096 + 64]; // room for get_test_dir() and the file name.
+	for( int dir = 0; dir < 4; ++dir )
+	{
+		snprintf( path, sizeof( path ), "%s%d", get_test_dir(), dir );
+		create_dir( path );
+	}
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_CREATE, get_test_dir(), 0x0 );
+	ASSERT( watcher != 0x0 );
+
+	ordering_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = ordering_event_handler;
+	pthread_mutex_init( &handler.lock, 0x0 );
+	for( int dir = 0; dir < 4; ++dir )
+		handler.last[dir] = -1;
+	handler.in_order = true;
+
+	// ... the smallest queue so that the poll has to wait for the workers ...
+	fswatcher_dispatcher_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.handler    = &handler.handler;
+	params.workers    = 3;
+	params.queue_size = 1;
+	fswatcher_dispatcher_t dispatcher = fswatcher_dispatcher_create( &params );
+	ASSERT( dispatcher != 0x0 );
+
+	static const int FILE_COUNT = 100;
+	for( int file = 0; file < FILE_COUNT; ++file )
+		for( int dir = 0; dir < 4; ++dir )
+		{
+			snprintf( path, sizeof( path ), "%s%d/%d", get_test_dir(), dir, file );
+			create_file( path );
+		}
+
+	fswatcher_poll( watcher, fswatcher_dispatcher_handler( dispatcher ), 0x0 );
+	fswatcher_dispatcher_flush( dispatcher );
+
+	pthread_mutex_lock( &handler.lock );
+	ASSERT_EQ( (size_t)FILE_COUNT * 4, handler.events );
+	ASSERT( handler.in_order );
+	pthread_mutex_unlock( &handler.lock );
+
+	fswatcher_dispatcher_stats stats;
+	fswatcher_dispatcher_get_stats( dispatcher, &stats );
+	ASSERT_EQ( (uint64_t)0, stats.events_inline );
+	fswatcher_dispatcher_destroy( dispatcher );
+
+	// ... events that can not be queued, out of memory, are handled in order on the polling thread ...
+	failing_allocator alloc = { { failing_realloc, failing_free }, false };
+	params.allocator = &alloc.alloc;
+	dispatcher = fswatcher_dispatcher_create( &params );
+	ASSERT( dispatcher != 0x0 );
+	alloc.fail = true;
+
+	handler.events = 0;
+	for( int dir = 0; dir < 4; ++dir )
+		handler.last[dir] = FILE_COUNT - 1;
+	for( int file = FILE_COUNT; file < FILE_COUNT + 10; ++file )
+		for( int dir = 0; dir < 4; ++dir )
+		{
+			snprintf( path, sizeof( path ), "%s%d/%d", get_test_dir(), dir, file );
+			create_file( path );
+		}
+
+	fswatcher_poll( watcher, fswatcher_dispatcher_handler( dispatcher ), 0x0 );
+	fswatcher_dispatcher_flush( dispatcher );
+	ASSERT_EQ( (size_t)40, handler.events );
+	ASSERT( handler.in_order );
+	fswatcher_dispatcher_get_stats( dispatcher, &stats );
+	ASSERT_EQ( (uint64_t)40, stats.events_inline );
+
+	alloc.fail = false;
+	fswatcher_dispatcher_destroy( dispatcher );
+	pthread_mutex_destroy( &handler.lock );
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+#if !defined( _WIN32 )
+struct cross_dir_handler
+{
+	fswatcher_event_handler handler;
+	pthread_mutex_t lock;
+	size_t prefix_len;
+	int  stage[50]; ///< 1 dir created, 2 file created in it, 3 file moved out, 4 moved file modified.
+	bool in_order;
+};
+
+static bool cross_dir_event_handler( fswatcher_event_handler* handler, fswatcher_event_type type, const char* src, const char* dst )
+{
+	cross_dir_handler* h = (cross_dir_handler*)handler;
+	const char* path = type == FSWATCHER_EVENT_MOVE ? dst : src;
+	if( path == 0x0 || strlen( path ) <= h->prefix_len )
+		return true;
+	const char* rel = path + h->prefix_len;
+
+	int  i = -1;
+	char c;
+	int  need  = -1;
+	int  stage = -1;
+	int  parts = sscanf( rel, "s%d/%c", &i, &c );
+	if( type == FSWATCHER_EVENT_CREATE && parts == 1 )
+	{
+		need  = 0;
+		stage = 1;
+	}
+	else if( type == FSWATCHER_EVENT_CREATE && parts == 2 )
+	{
+		need  = 1;
+		stage = 2;
+	}
+	else if( sscanf( rel, "d/f%d", &i ) == 1 && ( type == FSWATCHER_EVENT_MOVE || type == FSWATCHER_EVENT_MODIFY ) )
+	{
+		need  = type == FSWATCHER_EVENT_MOVE ? 2 : 3;
+		stage = type == FSWATCHER_EVENT_MOVE ? 3 : 4;
+	}
+	if( stage < 0 || i < 0 || i >= 50 )
+		return true;
+
+	pthread_mutex_lock( &h->lock );
+	if( h->stage[i] < need || ( need == 0 && h->stage[i] != 0 ) )
+		h->in_order = false;
+	if( h->stage[i] < stage )
+		h->stage[i] = stage;
+	pthread_mutex_unlock( &h->lock );
+	return true;
+}
+
+static bool stopping_event_handler( fswatcher_event_handler* handler, fswatcher_event_type, const char*, const char* )
+{
+	__atomic_fetch_add( &( (counting_handler*)handler )->events, 1, __ATOMIC_RELAXED );
+	return false;
+}
+#endif
+
+TEST dispatcher_cross_dir()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	char cmd[4096];
+	char dir[2048];
+	test_dir_path( "", dir );
+	snprintf( cmd, sizeof( cmd ), "mkdir %sd", dir );
+	ASSERT_EQ( 0, system( cmd ) );
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, dir, 0x0 );
+	ASSERT( watcher != 0x0 );
+
+	cross_dir_handler handler;
+	memset( &handler, 0x0, sizeof( handler ) );
+	handler.handler.callback = cross_dir_event_handler;
+	handler.prefix_len = strlen( dir );
+	handler.in_order   = true;
+	pthread_mutex_init( &handler.lock, 0x0 );
+
+	fswatcher_dispatcher_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.handler    = &handler.handler;
+	params.workers    = 4;
+	params.queue_size = 2;
+	fswatcher_dispatcher_t dispatcher = fswatcher_dispatcher_create( &params );
+	ASSERT( dispatcher != 0x0 );
+
+	// ... dirs created and filled before they are watched, the creates of the dirs are handled first ...
+	snprintf( cmd, sizeof( cmd ), "cd %s && for i in $(seq 0 49); do mkdir s$i && touch s$i/f; done", dir );
+	ASSERT_EQ( 0, system( cmd ) );
+	fswatcher_poll( watcher, fswatcher_dispatcher_handler( dispatcher ), 0x0 );
+	fswatcher_dispatcher_flush( dispatcher );
+
+	// ... files moved to another dir and modified there, the moves are handled first ...
+	snprintf( cmd, sizeof( cmd ), "cd %s && for i in $(seq 0 49); do mv s$i/f d/f$i && echo a > d/f$i; done", dir );
+	ASSERT_EQ( 0, system( cmd ) );
+	fswatcher_poll( watcher, fswatcher_dispatcher_handler( dispatcher ), 0x0 );
+	fswatcher_dispatcher_destroy( dispatcher );
+
+	ASSERT( handler.in_order );
+	for( int i = 0; i < 50; ++i )
+		ASSERT_EQ( 4, handler.stage[i] );
+	pthread_mutex_destroy( &handler.lock );
+
+	// ... a handler returning false stops the poll, what is not dispatched is kept for the next poll ...
+	counting_handler stopping = { { stopping_event_handler }, 0 };
+	params.handler    = &stopping.handler;
+	params.workers    = 1;
+	params.queue_size = 1;
+	dispatcher = fswatcher_dispatcher_create( &params );
+	ASSERT( dispatcher != 0x0 );
+
+	snprintf( cmd, sizeof( cmd ), "cd %s && touch $(seq 0 9)", dir );
+	ASSERT_EQ( 0, system( cmd ) );
+	fswatcher_poll( watcher, fswatcher_dispatcher_handler( dispatcher ), 0x0 );
+	fswatcher_dispatcher_flush( dispatcher );
+	size_t first = __atomic_load_n( &stopping.events, __ATOMIC_RELAXED );
+	ASSERT( first >= 1 && first <= 2 );
+
+	for( int i = 0; i < 20 && __atomic_load_n( &stopping.events, __ATOMIC_RELAXED ) < 10; ++i )
+	{
+		fswatcher_poll( watcher, fswatcher_dispatcher_handler( dispatcher ), 0x0 );
+		fswatcher_dispatcher_flush( dispatcher );
+	}
+	ASSERT_EQ( (size_t)10, __atomic_load_n( &stopping.events, __ATOMIC_RELAXED ) );
+
+	fswatcher_dispatcher_destroy( dispatcher );
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+struct root_handler
+{
+	fswatcher_root_event_handler handler;
+	size_t   events;
+	uint32_t last_root;
+};
+
+static bool root_event_handler( fswatcher_root_event_handler* handler, uint32_t root, fswatcher_event_type, const char*, const char* )
+{
+	++( (root_handler*)handler )->events;
+	( (root_handler*)handler )->last_root = root;
+	return true;
+}
+
+TEST multiple_roots()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	char dir_a[2048];
+	char dir_b[2048];
+	create_dir( test_dir_path( "a/", dir_a ) );
+	create_dir( test_dir_path( "b/", dir_b ) );
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, dir_a, 0x0 );
+	ASSERT_EQ( 1u, fswatcher_add_root( watcher, dir_b ) );
+
+	// ... a dir that is already watched can not be added as another root ...
+	ASSERT_EQ( FSWATCHER_NO_ROOT, fswatcher_add_root( watcher, dir_a ) );
+
+	char f1[2048];
+	char f2[2048];
+	char f3[2048];
+	create_file( test_dir_path( "a/f1", f1 ) );
+	create_file( test_dir_path( "b/f2", f2 ) );
+	move_file( f1, test_dir_path( "b/f3", f3 ) );
+
+	fswatcher_event events[8];
+	char paths[8192];
+	ASSERT_EQ( (size_t)4, fswatcher_poll_batch( watcher, events, 8, paths, sizeof( paths ) ) );
+	ASSERT_EQ( 0u, events[0].root );
+	ASSERT_STR_EQ( f1, paths + events[0].src );
+	ASSERT_EQ( 1u, events[1].root );
+	ASSERT_STR_EQ( f2, paths + events[1].src );
+
+	// ... move between roots is split into a move out and a move in ...
+	ASSERT_EQ( FSWATCHER_EVENT_MOVE, events[2].type );
+	ASSERT_EQ( 0u, events[2].root );
+	ASSERT_STR_EQ( f1, paths + events[2].src );
+	ASSERT_EQ( FSWATCHER_NO_PATH, events[2].dst );
+	ASSERT_EQ( FSWATCHER_EVENT_MOVE, events[3].type );
+	ASSERT_EQ( 1u, events[3].root );
+	ASSERT_EQ( FSWATCHER_NO_PATH, events[3].src );
+	ASSERT_STR_EQ( f3, paths + events[3].dst );
+
+	ASSERT( fswatcher_remove_root( watcher, 1 ) );
+	ASSERT_FALSE( fswatcher_remove_root( watcher, 1 ) );
+	remove_file( f3 );
+	remove_file( f2 );
+	ASSERT_EQ( (size_t)0, fswatcher_poll_batch( watcher, events, 8, paths, sizeof( paths ) ) );
+
+	// ... id of removed root is reused ...
+	ASSERT_EQ( 1u, fswatcher_add_root( watcher, dir_b ) );
+
+	root_handler handler = { { root_event_handler }, 0, 0 };
+	create_file( f2 );
+	fswatcher_poll_roots( watcher, &handler.handler, 0 );
+	ASSERT_EQ( (size_t)1, handler.events );
+	ASSERT_EQ( 1u, handler.last_root );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST fanotify_backend()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+
+	char dir[2048];
+	create_dir( test_dir_path( "sub", dir ) );
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags     = FSWATCHER_CREATE_DEFAULT;
+	params.types     = FSWATCHER_EVENT_ALL;
+	params.watch_dir = get_test_dir();
+	params.backend   = FSWATCHER_BACKEND_FANOTIFY;
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	if( watcher == 0x0 )
+		SKIPm( "fanotify not available, requires CAP_SYS_ADMIN" );
+
+	char f1[2048];
+	char f2[2048];
+	create_file( test_dir_path( "sub/f1", f1 ) );
+	move_file( f1, test_dir_path( "f2", f2 ) );
+	remove_file( f2 );
+
+	fswatcher_event events[16];
+	char paths[8192];
+	size_t count = fswatcher_poll_batch( watcher, events, 16, paths, sizeof( paths ) );
+
+	// ... the whole filesystem is marked, events outside the test dir should have been filtered out ...
+	ASSERT_EQ( (size_t)3, count );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, events[0].type );
+	ASSERT_EQ( 0u, events[0].root );
+	ASSERT_STR_EQ( f1, paths + events[0].src );
+	ASSERT_EQ( FSWATCHER_EVENT_MOVE, events[1].type );
+	ASSERT_STR_EQ( f1, paths + events[1].src );
+	ASSERT_STR_EQ( f2, paths + events[1].dst );
+	ASSERT_EQ( FSWATCHER_EVENT_REMOVE, events[2].type );
+	ASSERT_STR_EQ( f2, paths + events[2].src );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST poll_backend()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	char sub[2048];
+	char f1[2048];
+	create_dir( test_dir_path( "sub", sub ) );
+	write_file( test_dir_path( "f1", f1 ) );
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags            = FSWATCHER_CREATE_DEFAULT;
+	params.types            = FSWATCHER_EVENT_ALL;
+	params.watch_dir        = get_test_dir();
+	params.backend          = FSWATCHER_BACKEND_POLL;
+	params.poll_interval_ms = 20;
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+
+	char f2[2048];
+	write_file( test_dir_path( "f2", f2 ) );
+	FILE* f = fopen( f1, "a" );
+	ASSERT( f != 0x0 );
+	fputc( 'b', f );
+	fclose( f );
+	sleep_ms( 100 );
+
+	fswatcher_event events[16];
+	char paths[8192];
+	size_t count = fswatcher_poll_batch( watcher, events, 16, paths, sizeof( paths ) );
+	ASSERT_EQ( (size_t)2, count );
+	ASSERT_EQ( FSWATCHER_EVENT_MODIFY, events[0].type );
+	ASSERT_STR_EQ( f1, paths + events[0].src );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, events[1].type );
+	ASSERT_STR_EQ( f2, paths + events[1].src );
+
+	// ... renames are found by inode, also for a file in a directory that is moved in the same scan ...
+	char sub2[2048];
+	char f3[2048];
+	move_file( f1, test_dir_path( "sub/f3" ) );
+	move_file( sub, test_dir_path( "sub2", sub2 ) );
+	remove_file( f2 );
+	test_dir_path( "sub2/f3", f3 );
+	sleep_ms( 100 );
+
+	count = fswatcher_poll_batch( watcher, events, 16, paths, sizeof( paths ) );
+	ASSERT_EQ( (size_t)3, count );
+	int found = 0;
+	for( size_t i = 0; i < count; ++i )
+	{
+		const char* src = paths + events[i].src;
+		const char* dst = events[i].dst != FSWATCHER_NO_PATH ? paths + events[i].dst : "";
+		if( events[i].type == FSWATCHER_EVENT_MOVE && strcmp( src, sub ) == 0 && strcmp( dst, sub2 ) == 0 ) found |= 1;
+		if( events[i].type == FSWATCHER_EVENT_MOVE && strcmp( src, f1 ) == 0 && strcmp( dst, f3 ) == 0 )   found |= 2;
+		if( events[i].type == FSWATCHER_EVENT_REMOVE && strcmp( src, f2 ) == 0 )                          found |= 4;
+	}
+	ASSERT_EQ( 7, found );
+
+	// ... and the moved dir is still watched at its new path ...
+	char f4[2048];
+	write_file( test_dir_path( "sub2/f4", f4 ) );
+	sleep_ms( 100 );
+	count = fswatcher_poll_batch( watcher, events, 16, paths, sizeof( paths ) );
+	ASSERT_EQ( (size_t)1, count );
+	ASSERT_EQ( FSWATCHER_EVENT_CREATE, events[0].type );
+	ASSERT_STR_EQ( f4, paths + events[0].src );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST watch_subtree()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	create_dir( test_dir_path( "a/b/c" ) );
+
+	fswatcher_create_params params;
+	memset( &params, 0x0, sizeof( params ) );
+	params.flags     = FSWATCHER_CREATE_DEFAULT;
+	params.types     = FSWATCHER_EVENT_ALL;
+	params.watch_dir = get_test_dir();
+	params.max_depth = 2;
+	fswatcher_t watcher = fswatcher_create_ex( &params );
+	ASSERT( 0x0 != watcher );
+	counting_handler handler = { { counting_event_handler }, 0 };
+
+	// ... root and a are watched, b is reported as it is created in a but not watched ...
+	fswatcher_stats stats;
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)2, stats.watches );
+	create_dir( test_dir_path( "a/d" ) );
+	write_file( test_dir_path( "a/b/f1" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, handler.events );
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)2, stats.watches );
+
+	char b[2048];
+	test_dir_path( "a/b", b );
+	ASSERT( fswatcher_watch_subtree( watcher, b, 0 ) );
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)4, stats.watches );
+	write_file( test_dir_path( "a/b/c/f2" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)3, handler.events ); // ... create + modify ...
+
+	ASSERT( fswatcher_unwatch_subtree( watcher, b ) );
+	ASSERT_FALSE( fswatcher_unwatch_subtree( watcher, b ) );
+	ASSERT_FALSE( fswatcher_unwatch_subtree( watcher, get_test_dir() ) );
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)2, stats.watches );
+	write_file( test_dir_path( "a/b/c/f3" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)3, handler.events );
+
+	// ... dirs in between are watched without their siblings ...
+	create_dir( test_dir_path( "x/y/z" ) );
+	create_dir( test_dir_path( "x/w" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT( fswatcher_watch_subtree( watcher, test_dir_path( "x/y/z" ), 1 ) );
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)5, stats.watches );
+
+	// ... a path that fails partway, missing or already watched via a symlink, leaves no watches behind ...
+	ASSERT_FALSE( fswatcher_watch_subtree( watcher, test_dir_path( "a/d/missing" ), 0 ) );
+	ASSERT_EQ( 0, symlink( get_test_dir(), test_dir_path( "a/d/root" ) ) );
+	ASSERT_FALSE( fswatcher_watch_subtree( watcher, test_dir_path( "a/d/root" ), 0 ) );
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)5, stats.watches );
+	ASSERT( fswatcher_watch_subtree( watcher, test_dir_path( "a/d" ), 1 ) );
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (uint64_t)6, stats.watches );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
+TEST list_new_dir()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_CREATE, get_test_dir(), 0x0 );
+	ASSERT( 0x0 != watcher );
+	counting_handler handler = { { counting_event_handler }, 0 };
+
+	// ... everything below a is created before a is watched ...
+	char dir[2048];
+	char cmd[4096];
+	snprintf( cmd, sizeof( cmd ), "mkdir -p %s && touch %s/f1", test_dir_path( "a/b/c", dir ), dir );
+	ASSERT_EQ( 0, system( cmd ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)4, handler.events );
+
+	// ... and the nested dirs are watched ...
+	create_file( test_dir_path( "a/b/c/f2" ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)5, handler.events );
+
+	// ... a big dir is reported over multiple polls ...
+	handler.events = 0;
+	snprintf( cmd, sizeof( cmd ), "mkdir %s && cd %s && seq 3000 | xargs touch", test_dir_path( "big", dir ), dir );
+	ASSERT_EQ( 0, system( cmd ) );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT( handler.events > 1 && handler.events < 3001 );
+	for( int i = 0; i < 10 && handler.events < 3001; ++i )
+		fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( (size_t)3001, handler.events );
+
+	fswatcher_destroy( watcher );
+#endif
+	return 0;
+}
+
 TEST test_move_file()
 {
 	setup_test_dir();
@@ -286,6 +1725,62 @@ TEST test_move_file()
 	return 0;
 }
 
+TEST move_dir()
+{
+#if !defined( _WIN32 )
+	setup_test_dir();
+	create_dir( test_dir_path( "d1" DIR_SEP "sub" ) );
+	create_dir( test_dir_path( "d1" DIR_SEP "a" DIR_SEP "b" DIR_SEP "c" ) );
+	create_dir( test_dir_path( "d1" DIR_SEP "a" DIR_SEP "e" ) );
+	create_dir( test_dir_path( "d2" ) );
+	remove_dir( P_tmpdir "/fswatcher_test_moved" );
+
+	fswatcher_t watcher = fswatcher_create( FSWATCHER_CREATE_DEFAULT, FSWATCHER_EVENT_ALL, get_test_dir(), 0x0 );
+	ASSERT( watcher != 0x0 );
+	test_handler handler = { { watch_event_handler }, FSWATCHER_EVENT_ALL, 0x0, 0x0 };
+
+	// ... a move within the tree is one event and the watches below it follow along ...
+	char src[2048];
+	char dst[2048];
+	move_file( test_dir_path( "d1", src ), test_dir_path( "d2" DIR_SEP "d3", dst ) );
+	recording_handler recorder;
+	memset( &recorder, 0x0, sizeof( recorder ) );
+	recorder.handler.callback = recording_event_handler;
+	fswatcher_poll( watcher, &recorder.handler, 0x0 );
+	ASSERT_EQ( (size_t)1, recorder.count );
+	ASSERT_EQ( FSWATCHER_EVENT_MOVE, recorder.types[0] );
+	ASSERT_STR_EQ( src, recorder.paths[0] );
+
+	const char* path = test_dir_path( "d2" DIR_SEP "d3" DIR_SEP "sub" DIR_SEP "f1" );
+	create_file( path );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_CREATE, path, 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	// ... a move out of the tree drops all watches below it ...
+	fswatcher_stats stats;
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (size_t)8, stats.watches );
+
+	move_file( test_dir_path( "d2" DIR_SEP "d3", src ), P_tmpdir "/fswatcher_test_moved" );
+	fswatcher_poll( watcher, &handler.handler, 0x0 );
+	ASSERT_EQ( 0, check_event_handler( FSWATCHER_EVENT_MOVE, src, 0x0, &handler ) );
+	HANDLER_RESET( handler );
+
+	fswatcher_get_stats( watcher, &stats );
+	ASSERT_EQ( (size_t)2, stats.watches );
+
+	counting_handler counter = { { counting_event_handler }, 0 };
+	create_file( P_tmpdir "/fswatcher_test_moved/sub/f2" );
+	fswatcher_poll( watcher, &counter.handler, 0x0 );
+	ASSERT_EQ( (size_t)0, counter.events );
+
+	fswatcher_destroy( watcher );
+	remove_dir( P_tmpdir "/fswatcher_test_moved" );
+#endif
+	return 0;
+}
+
 TEST watch_symlinked_dir()
 {
 #if !defined( _WIN32 )
@@ -330,7 +1825,33 @@ GREATEST_SUITE( fswatcher )
 	RUN_TEST( create_remove_dir );
 	RUN_TEST( create_remove_file );
 	RUN_TEST( create_remove_file_in_subdir );
+	RUN_TEST( create_file_in_new_subdir );
+	RUN_TEST( no_allocations_in_steady_state_poll );
+	RUN_TEST( poll_batch );
+	RUN_TEST( blocking_poll_returns_after_drain );
+	RUN_TEST( poll_timeout );
+	RUN_TEST( wakeup_blocking_poll );
+	RUN_TEST( reader_thread );
+	RUN_TEST( fionread_buffer );
+	RUN_TEST( snapshot_overflow_recovery );
+	RUN_TEST( snapshot_file );
+	RUN_TEST( filters );
+	RUN_TEST( stats );
+	RUN_TEST( path_too_long );
+	RUN_TEST( write_done );
+	RUN_TEST( content_hash );
+	RUN_TEST( coalesce_events );
+	RUN_TEST( parallel_crawl );
+	RUN_TEST( async_crawl );
+	RUN_TEST( dispatcher );
+	RUN_TEST( dispatcher_cross_dir );
+	RUN_TEST( multiple_roots );
+	RUN_TEST( fanotify_backend );
+	RUN_TEST( poll_backend );
+	RUN_TEST( watch_subtree );
+	RUN_TEST( list_new_dir );
 	RUN_TEST( test_move_file );
+	RUN_TEST( move_dir );
 	RUN_TEST( watch_symlinked_dir );
 }
 
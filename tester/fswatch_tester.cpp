@@ -52,7 +52,7 @@ int main( int argc, const char** argv )
 	while( true )
 	{
 		fswatcher_event_handler handler = { watch_event_handler };
-		fswatcher_poll( watcher, &handler, 0x0 );
+		fswatcher_poll_timeout( watcher, &handler, 0x0, 1000 );
 	};
 
 	fswatcher_destroy( watcher );